@@ -0,0 +1,485 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <atomic>
+#include <random>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "frame_ring.h"
+#include "color_kernels.h"
+
+// Frame buffer as it was before the zero-copy ring: every write clones
+// the decoded image into the slot, and every read clones it back out.
+class clone_ring {
+
+    struct frame {
+        cv::Mat             image;
+        std::shared_mutex   mutex;
+    };
+
+public:
+
+    uint64_t bytes_copied = 0;
+    uint64_t allocations = 0;
+
+    explicit clone_ring(int32_t frames)
+        : m_frames(frames), m_counter(0), m_slots(new frame[frames]) {
+    }
+
+    ~clone_ring() {
+        delete[] m_slots;
+    }
+
+    void write(const cv::Mat& image) {
+        auto& slot = m_slots[(m_counter + 1) % m_frames];
+        slot.mutex.lock();
+        slot.image = image.clone();
+        slot.mutex.unlock();
+
+        bytes_copied += image.total() * image.elemSize();
+        allocations += 1;
+        ++m_counter;
+    }
+
+    cv::Mat read() {
+        auto& slot = m_slots[m_counter % m_frames];
+        slot.mutex.lock_shared();
+        auto image = slot.image.clone();
+        slot.mutex.unlock_shared();
+
+        bytes_copied += image.total() * image.elemSize();
+        allocations += image.empty() ? 0 : 1;
+        return image;
+    }
+
+private:
+
+    int32_t m_frames;
+    int32_t m_counter;
+    frame*  m_slots;
+};
+
+struct bench_result {
+    std::string name;
+    double      ms_per_frame;
+    double      bytes_copied_per_frame;
+    double      allocations_per_frame;
+};
+
+// Stand-in for VideoCapture::retrieve, writes a full frame worth of pixels.
+void synthesize_frame(cv::Mat& image, const cv::Size& size, int32_t index) {
+    image.create(size, CV_8UC3);
+    image.setTo(cv::Scalar(index & 0xff, (index >> 8) & 0xff, 0x80));
+}
+
+// Touch the consumer side of the frame, so that reads cannot be elided.
+uint64_t consume_frame(const cv::Mat& image) {
+    return image.empty() ? 0 : image.at<cv::Vec3b>(image.rows / 2, image.cols / 2)[0];
+}
+
+bench_result bench_clone_ring(const cv::Size& size, int32_t buffer, int32_t frames, int32_t readers) {
+    clone_ring ring(buffer);
+    uint64_t checksum = 0;
+    uint64_t allocations = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int32_t i = 0; i < frames; ++i) {
+        // VideoCapture::read was given a fresh Mat every frame
+        cv::Mat decoded;
+        synthesize_frame(decoded, size, i);
+        allocations += 1;
+
+        ring.write(decoded);
+        for (int32_t r = 0; r < readers; ++r) {
+            checksum += consume_frame(ring.read());
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<double, std::milli> elapsed = end - start;
+    std::cout << "  (checksum " << checksum << ")" << std::endl;
+
+    return {
+        "clone",
+        elapsed.count() / frames,
+        double(ring.bytes_copied) / frames,
+        double(ring.allocations + allocations) / frames
+    };
+}
+
+bench_result bench_frame_ring(const cv::Size& size, int32_t buffer, int32_t frames, int32_t readers) {
+    FrameRing ring;
+    ring.init(buffer, size, CV_8UC3);
+    uint64_t checksum = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int32_t i = 0; i < frames; ++i) {
+        ring.write([&](cv::Mat& image) {
+            synthesize_frame(image, size, i);
+            return true;
+        });
+
+        for (int32_t r = 0; r < readers; ++r) {
+            auto view = ring.read(0);
+            checksum += consume_frame(view.image());
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<double, std::milli> elapsed = end - start;
+    std::cout << "  (checksum " << checksum << ")" << std::endl;
+
+    // Views share the slot buffers, the only copies or allocations
+    // left are the ones caused by a slot having to be reallocated.
+    auto stats = ring.getStats();
+    uint64_t frame_bytes = uint64_t(size.area()) * 3;
+
+    return {
+        "zero-copy",
+        elapsed.count() / frames,
+        double(stats.reallocations * frame_bytes) / frames,
+        double(stats.reallocations) / frames
+    };
+}
+
+struct latency_report {
+    double  p50;
+    double  p99;
+    double  p999;
+    double  max;
+};
+
+// Percentiles of the given samples, in microseconds.
+latency_report compute_latency(std::vector<int64_t>& samples_ns) {
+    if (samples_ns.empty()) {
+        return { 0, 0, 0, 0 };
+    }
+
+    std::sort(samples_ns.begin(), samples_ns.end());
+    auto at = [&](double p) {
+        auto i = std::min(size_t(p * samples_ns.size()), samples_ns.size() - 1);
+        return samples_ns[i] / 1000.0;
+    };
+
+    return { at(.5), at(.99), at(.999), samples_ns.back() / 1000.0 };
+}
+
+void print_latency(const std::string& name, std::vector<int64_t>& samples_ns) {
+    auto report = compute_latency(samples_ns);
+    std::cout << name << " (" << samples_ns.size() << " samples) us:"
+        << " p50 " << report.p50
+        << " p99 " << report.p99
+        << " p99.9 " << report.p999
+        << " max " << report.max
+        << std::endl;
+}
+
+// Run one producer and several consumers concurrently on the lock-free
+// ring, checking that no consumer ever sees a frame being overwritten,
+// and report the tail latency of the handoff on both sides, as well as
+// the age of the latest frame when a consumer gets it. Returns the number
+// of torn frames, which is 0 unless the ring is broken.
+uint64_t stress_frame_ring(const cv::Size& size, int32_t buffer, int32_t consumers,
+    int32_t fps, int32_t hold_us, int32_t seconds) {
+    typedef std::chrono::high_resolution_clock clock;
+
+    FrameRing ring;
+    ring.init(buffer, size, CV_8UC3);
+
+    std::atomic<bool> running(true);
+    std::atomic<uint64_t> torn_frames(0);
+    std::atomic<uint64_t> empty_reads(0);
+
+    std::vector<int64_t> write_samples;
+    std::vector<std::vector<int64_t>> read_samples(consumers);
+    std::vector<std::vector<int64_t>> age_samples(consumers);
+    auto now_ns = [] {
+        return int64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            clock::now().time_since_epoch()).count());
+    };
+
+    std::thread producer([&] {
+        auto period = std::chrono::microseconds(fps > 0 ? 1000000 / fps : 0);
+        auto next = clock::now();
+
+        while (running.load(std::memory_order_relaxed)) {
+            // Producer is the only writer, it knows the next sequence
+            int32_t sequence = ring.getSequence() + 1;
+            clock::duration fill_time(0);
+
+            auto start = clock::now();
+            ring.write([&](cv::Mat& image) {
+                auto fill_start = clock::now();
+                image.setTo(cv::Scalar::all(sequence & 0xff));
+                fill_time = clock::now() - fill_start;
+                return true;
+            }, now_ns());
+            auto end = clock::now();
+
+            // Only account for the handoff, not for the pixels written
+            write_samples.push_back(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - start - fill_time).count());
+
+            if (fps > 0) {
+                next += period;
+                std::this_thread::sleep_until(next);
+            }
+        }
+    });
+
+    std::vector<std::thread> readers;
+    for (int32_t c = 0; c < consumers; ++c) {
+        readers.emplace_back([&, c] {
+            std::mt19937 rng(c);
+            std::uniform_int_distribution<int32_t> offsets(-(buffer - 1), 0);
+            auto& samples = read_samples[c];
+            auto& ages = age_samples[c];
+
+            while (running.load(std::memory_order_relaxed)) {
+                int32_t offset = offsets(rng);
+                auto start = clock::now();
+                auto view = ring.read(offset);
+                auto end = clock::now();
+
+                samples.push_back(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+                if (view.empty()) {
+                    empty_reads.fetch_add(1, std::memory_order_relaxed);
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                // Older frames are old on purpose, only the latest one tells
+                // how long a frame takes to reach its consumers
+                if (offset == 0) {
+                    ages.push_back(now_ns() - view.timestamp());
+                }
+
+                // Hold the frame as if processing it, then make sure
+                // the producer has not written into it meanwhile.
+                const auto& image = view.image();
+                uchar expected = uchar(view.sequence() & 0xff);
+                std::this_thread::sleep_for(std::chrono::microseconds(hold_us));
+                if (image.at<cv::Vec3b>(0, 0)[0] != expected
+                    || image.at<cv::Vec3b>(image.rows - 1, image.cols - 1)[0] != expected) {
+                    torn_frames.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running.store(false, std::memory_order_relaxed);
+
+    producer.join();
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    std::vector<int64_t> all_reads;
+    for (auto& samples : read_samples) {
+        all_reads.insert(all_reads.end(), samples.begin(), samples.end());
+    }
+
+    std::vector<int64_t> all_ages;
+    for (auto& samples : age_samples) {
+        all_ages.insert(all_ages.end(), samples.begin(), samples.end());
+    }
+
+    auto stats = ring.getStats();
+    std::cout << "Stress " << seconds << "s, " << consumers << " consumers, "
+        << "frames written: " << stats.framesWritten
+        << " dropped: " << stats.framesDropped
+        << " read retries: " << stats.readRetries
+        << " empty reads: " << empty_reads.load()
+        << " torn frames: " << torn_frames.load()
+        << std::endl;
+
+    print_latency("write", write_samples);
+    print_latency("read", all_reads);
+    print_latency("latest frame age", all_ages);
+
+    return torn_frames.load();
+}
+
+struct color_space {
+    const char* name;
+    int32_t     code;
+};
+
+static const color_space color_spaces[] = {
+    { "RGB", cv::COLOR_BGR2RGB },
+    { "HSV", cv::COLOR_BGR2HSV },
+    { "YCrCb", cv::COLOR_BGR2YCrCb },
+    { "Lab", cv::COLOR_BGR2Lab },
+};
+
+// As show_gui reduces the channel previews by
+const int32_t PREVIEW_SCALE = 3;
+
+template<typename Fn>
+double time_ms_per_frame(int32_t iterations, Fn&& fn) {
+    fn(); // warm-up, outputs get allocated here
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int32_t i = 0; i < iterations; ++i) {
+        fn();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    std::chrono::duration<double, std::milli> elapsed = end - start;
+    return elapsed.count() / iterations;
+}
+
+// Check the fused conversion kernel against the OpenCV path on every
+// 8-bit BGR color, in every display layout and at the preview scale, then
+// time both on a random frame of the given size.
+// Returns the number of bytes they disagree on, over all color spaces.
+uint64_t bench_fused(const cv::Size& size, int32_t iterations) {
+    cv::Mat frame(size, CV_8UC3);
+    cv::randu(frame, cv::Scalar::all(0), cv::Scalar::all(256));
+
+    // Sweep all reds in 16 passes, to bound the memory in use
+    cv::Mat sweep = kernels::makeColorSweep(16);
+
+    uint64_t total_mismatches = 0;
+    for (const auto& space : color_spaces) {
+        uint64_t mismatches = 0;
+        for (int32_t red = 0; red < 16; ++red) {
+            cv::Mat colors;
+            cv::add(sweep, cv::Scalar(0, 0, red), colors);
+            mismatches += kernels::verifyFusedConversion(colors, space.code, PREVIEW_SCALE);
+        }
+
+        // At full scale, rather than behind the downscale, so that the
+        // conversion is what gets timed
+        cv::Mat color_space_frame, channels[3];
+        double reference = time_ms_per_frame(iterations, [&] {
+            kernels::convertSplitPreview(frame, false, 1, space.code, false,
+                color_space_frame, channels, CV_8UC4);
+        });
+
+        kernels::setUseSimd(false);
+        double scalar = time_ms_per_frame(iterations, [&] {
+            kernels::convertSplitPreview(frame, false, 1, space.code, true,
+                color_space_frame, channels, CV_8UC4);
+        });
+
+        kernels::setUseSimd(true);
+        double fused = time_ms_per_frame(iterations, [&] {
+            kernels::convertSplitPreview(frame, false, 1, space.code, true,
+                color_space_frame, channels, CV_8UC4);
+        });
+
+        std::cout << space.name << ": "
+            << (mismatches == 0 ? "bit-exact" : "MISMATCH")
+            << " (" << mismatches << " bytes differ over 2^24 colors), "
+            << "cvtColor " << reference << " ms, "
+            << "fused scalar " << scalar << " ms, "
+            << "fused " << (kernels::useSimd() ? "simd " : "") << fused << " ms, "
+            << "speed-up x" << reference / fused
+            << std::endl;
+
+        total_mismatches += mismatches;
+    }
+
+    return total_mismatches;
+}
+
+void print_result(const bench_result& result) {
+    std::cout << result.name << ": "
+        << result.ms_per_frame << " ms/frame, "
+        << result.bytes_copied_per_frame << " bytes copied/frame, "
+        << result.allocations_per_frame << " allocations/frame"
+        << std::endl;
+}
+
+int main(int32_t argc, char* argv[]) {
+
+    try {
+        std::string options =
+            "{help h usage| |Program usage}"
+            "{frames n|600|Number of frames to produce}"
+            "{readers r|1|Number of reads per produced frame}"
+            "{frames-buffer f|2|Number of frames to hold in the buffer}"
+            "{stress s| |Run producer and consumers concurrently and report tail latency}"
+            "{consumers c|4|Number of consumer threads in stress mode}"
+            "{fps|0|Producer frame-rate in stress mode, 0 to run flat out}"
+            "{hold-us|1000|Microseconds each consumer holds a frame in stress mode}"
+            "{duration d|5|Seconds to run the stress mode for}"
+            "{fused| |Verify and time the fused color conversion kernel}"
+            "{iterations i|100|Number of iterations per kernel in fused mode}"
+            "{@width|1920|Frame width}"
+            "{@height|1080|Frame height}";
+
+        cv::CommandLineParser parser(argc, argv, options);
+        parser.about("Benchmarks the camera frame buffers");
+
+        if (parser.has("help")) {
+            parser.printMessage();
+            return EXIT_SUCCESS;
+        }
+
+        if (!parser.check()) {
+            parser.printErrors();
+            return EXIT_FAILURE;
+        }
+
+        cv::Size size(parser.get<int32_t>("@width"), parser.get<int32_t>("@height"));
+        int32_t frames = std::max(parser.get<int32_t>("frames"), 1);
+        int32_t readers = std::max(parser.get<int32_t>("readers"), 0);
+        int32_t buffer = std::min(std::max(parser.get<int32_t>("frames-buffer"), 1), 64);
+
+        if (parser.has("stress")) {
+            auto torn_frames = stress_frame_ring(size, buffer,
+                std::max(parser.get<int32_t>("consumers"), 1),
+                std::max(parser.get<int32_t>("fps"), 0),
+                std::max(parser.get<int32_t>("hold-us"), 0),
+                std::max(parser.get<int32_t>("duration"), 1));
+
+            if (torn_frames > 0) {
+                std::cerr << torn_frames << " frames overwritten while being read" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            return EXIT_SUCCESS;
+        }
+
+        if (parser.has("fused")) {
+            auto mismatches = bench_fused(size, std::max(parser.get<int32_t>("iterations"), 1));
+            if (mismatches > 0) {
+                std::cerr << "The fused kernel differs from OpenCV on " << mismatches << " bytes" << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            return EXIT_SUCCESS;
+        }
+
+        std::cout << "Frame " << size.width << "x" << size.height
+            << " frames: " << frames
+            << " readers: " << readers
+            << " buffer: " << buffer
+            << std::endl;
+
+        auto before = bench_clone_ring(size, buffer, frames, readers);
+        auto after = bench_frame_ring(size, buffer, frames, readers);
+
+        print_result(before);
+        print_result(after);
+
+    } catch (cv::Exception& cv_exc) {
+        std::cerr << cv_exc.msg << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    return EXIT_SUCCESS;
+}
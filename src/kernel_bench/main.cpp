@@ -0,0 +1,592 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <cstring>
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/ocl.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include "color_kernels.h"
+#include "color_classifier.h"
+#include "frame_tiles.h"
+#include "perf_counters.h"
+#include "task_pool.h"
+#include "thread_scratch.h"
+#include "umat_pipeline.h"
+
+// Blocks of tiles show_gui processes frames in when tiled: runs of tiles
+// along a row of tiles, as many as fit in half of the L2 cache with what
+// the stages read and write of them, here a BGR frame, the BGRA display
+// image, its masked copy and the labels.
+std::vector<cv::Rect> make_tile_blocks(const cv::Size& size) {
+    const int64_t bytes_per_pixel = 3 + 4 + 4 + 4;
+    const int64_t pixels = int64_t(TaskPool::getL2CacheSize() / 2) / bytes_per_pixel;
+    const int32_t tile_size = TileGrid::TILE_SIZE;
+    const int32_t cols = int32_t(std::max(pixels / (tile_size * tile_size), int64_t(1))) * tile_size;
+
+    std::vector<cv::Rect> blocks;
+    for (int32_t y = 0; y < size.height; y += tile_size) {
+        for (int32_t x = 0; x < size.width; x += cols) {
+            blocks.emplace_back(x, y, std::min(cols, size.width - x), std::min(tile_size, size.height - y));
+        }
+    }
+
+    return blocks;
+}
+
+// Images a kernel reads from and writes into, allocated once per frame
+// size so that only the kernels themselves are timed.
+struct frame_buffers {
+    cv::Size    size;
+    cv::Mat     bgr;            // Camera frame
+    cv::Mat     bgr_next;       // Differs from it everywhere
+    cv::Mat     bgr16;          // Same, as a 16-bit source would deliver it
+    cv::Mat     bgra;           // Display image
+    cv::Mat     converted;
+    cv::Mat     color_space;
+    cv::Mat     channels[3];
+    cv::Mat     planes[3];
+    cv::Mat     merged;
+    cv::Mat     mask;
+    cv::Mat     masked;
+    cv::Mat     labels;
+    cv::Mat     display;
+    cv::Mat     upload;
+
+    std::vector<uint8_t>    changed_tiles;
+    TileChangeDetector      detector;
+    bool                    next;
+
+    std::vector<cv::Rect>   blocks;         // Tiled execution
+    TaskPool*               pool;
+
+    // The same on the OpenCL device, the camera frame uploaded already
+    cv::UMat                device_bgr;
+    cv::UMat                device_bgra;
+    cv::UMat                device_color_space;
+    cv::UMat                device_mask;
+    std::vector<cv::UMat>   device_planes;
+    cv::Mat                 atlas;          // Channel previews side by side
+    UMatPipeline            umat_pipeline;
+
+    explicit frame_buffers(const cv::Size& frame_size) : size(frame_size), next(false), pool(nullptr) {
+        bgr.create(size, CV_8UC3);
+        cv::randu(bgr, cv::Scalar::all(0), cv::Scalar::all(256));
+        cv::bitwise_not(bgr, bgr_next);
+        bgr.convertTo(bgr16, CV_16UC3, 257.0);
+        cv::cvtColor(bgr, bgra, cv::COLOR_BGR2BGRA);
+        upload.create(size, CV_8UC4);
+        cv::split(bgr, planes);
+        blocks = make_tile_blocks(size);
+        bgr.copyTo(device_bgr);
+        cv::cvtColor(device_bgr, device_color_space, cv::COLOR_BGR2HSV);
+    }
+};
+
+struct kernel_case {
+    std::string name;
+    double      bytes_per_pixel;    // Read and written, per frame pixel
+    std::function<void(frame_buffers&)> run;
+    bool        uses_pool = false;      // Runs on a task pool rather than OpenCV's
+    bool        uses_opencl = false;    // Runs on the OpenCL device, whatever the threads
+};
+
+struct color_space {
+    const char* name;
+    int32_t     code;
+};
+
+static const color_space color_spaces[] = {
+    { "RGB", cv::COLOR_BGR2RGB },
+    { "HSV", cv::COLOR_BGR2HSV },
+    { "YCrCb", cv::COLOR_BGR2YCrCb },
+    { "Lab", cv::COLOR_BGR2Lab },
+};
+
+static const color_space display_formats[] = {
+    { "BGRA", cv::COLOR_BGR2BGRA },
+    { "RGB", cv::COLOR_BGR2RGB },
+    { "RGBA", cv::COLOR_BGR2RGBA },
+};
+
+struct frame_size {
+    const char* name;
+    cv::Size    size;
+};
+
+static const frame_size frame_sizes[] = {
+    { "360p", cv::Size(640, 360) },
+    { "720p", cv::Size(1280, 720) },
+    { "1080p", cv::Size(1920, 1080) },
+    { "4k", cv::Size(3840, 2160) },
+    { "8k", cv::Size(7680, 4320) },
+};
+
+const int32_t PREVIEW_SCALE = 3;
+
+// Every image operation show_gui runs per frame, as well as the ones its
+// fused kernels have replaced, so that both can be compared on one machine.
+std::vector<kernel_case> make_kernel_cases(const ColorClassifier::Table& table) {
+    std::vector<kernel_case> cases;
+
+    // Sources delivering more than 8 bits per channel
+    cases.push_back({ "convertTo 16UC3->8UC3", 6 + 3, [](frame_buffers& buffers) {
+        buffers.bgr16.convertTo(buffers.converted, CV_8UC3, 1.0 / 257.0);
+    } });
+
+    // Camera frame into the display format, tile copies included
+    for (const auto& format : display_formats) {
+        int32_t code = format.code;
+        double written = code == cv::COLOR_BGR2RGB ? 3 : 4;
+        cases.push_back({ std::string("cvtColor display ") + format.name, 3 + written,
+            [code](frame_buffers& buffers) {
+                cv::cvtColor(buffers.bgr, buffers.display, code);
+            } });
+    }
+
+    for (const auto& space : color_spaces) {
+        int32_t code = space.code;
+        cases.push_back({ std::string("cvtColor ") + space.name, 3 + 3, [code](frame_buffers& buffers) {
+            cv::cvtColor(buffers.bgr, buffers.color_space, code);
+        } });
+    }
+
+    // The channels display and the masking, as done before the fused kernels
+    cases.push_back({ "split", 3 + 3, [](frame_buffers& buffers) {
+        cv::split(buffers.bgr, buffers.planes);
+    } });
+
+    cases.push_back({ "merge", 3 + 3, [](frame_buffers& buffers) {
+        cv::merge(buffers.planes, 3, buffers.merged);
+    } });
+
+    cases.push_back({ "inRange", 3 + 1, [](frame_buffers& buffers) {
+        cv::inRange(buffers.bgr, cv::Scalar(40, 40, 40), cv::Scalar(200, 200, 200), buffers.mask);
+    } });
+
+    cases.push_back({ "bitwise_and masked", 4 + 1 + 4, [](frame_buffers& buffers) {
+        if (buffers.mask.empty()) {
+            cv::inRange(buffers.bgr, cv::Scalar(40, 40, 40), cv::Scalar(200, 200, 200), buffers.mask);
+        }
+
+        // Cleared once by the warm-up run, so that only bitwise_and is
+        // timed, which writes where the mask is set and nowhere else
+        if (buffers.masked.empty()) {
+            buffers.masked.create(buffers.size, CV_8UC4);
+            buffers.masked.setTo(cv::Scalar::all(0));
+        }
+
+        cv::bitwise_and(buffers.bgra, buffers.bgra, buffers.masked, buffers.mask);
+    } });
+
+    // Channel previews at the reduced resolution they are displayed at
+    const double preview_bytes = 4 + (3 + 3) / double(PREVIEW_SCALE * PREVIEW_SCALE);
+    for (const auto& space : color_spaces) {
+        int32_t code = space.code;
+        for (bool fused : { false, true }) {
+            if (fused && !kernels::isFusedConversion(code)) {
+                continue;
+            }
+
+            cases.push_back({ std::string("convertSplitPreview ") + (fused ? "fused " : "cvtColor ") + space.name,
+                preview_bytes, [code, fused](frame_buffers& buffers) {
+                    kernels::convertSplitPreview(buffers.bgra, false, PREVIEW_SCALE, code, fused,
+                        buffers.color_space, buffers.channels, CV_8UC1);
+                } });
+        }
+    }
+
+    // Lookup table classification, which replaced inRange and bitwise_and
+    cases.push_back({ "classify", 4 + 4 + 4, [&table](frame_buffers& buffers) {
+        ColorClassifier::classify(table, buffers.bgra, false, buffers.labels, buffers.display);
+    } });
+
+    // Every tile changes, each call compares against the other frame
+    cases.push_back({ "tile detect", 3 + 3 + 3, [](frame_buffers& buffers) {
+        buffers.next = !buffers.next;
+        buffers.detector.detect(buffers.next ? buffers.bgr_next : buffers.bgr, false, buffers.changed_tiles);
+    } });
+
+    // Conversion into the display format, masking and channel previews,
+    // as show_gui runs them on every frame. Frame by frame, each of them
+    // is a pass over the whole frame on OpenCV's pool, which goes through
+    // frame-sized intermediates. Tiled, each block of tiles goes through
+    // the three of them on one thread of a task pool, with intermediates
+    // in per-thread scratch. Both are rated by the bytes they cannot avoid
+    // moving: the frame read once, and each output written once.
+    const double pipeline_bytes = 3 + 4 + 4 + 3.0 / (PREVIEW_SCALE * PREVIEW_SCALE);
+    cases.push_back({ "pipeline frames", pipeline_bytes, [&table](frame_buffers& buffers) {
+        cv::cvtColor(buffers.bgr, buffers.display, cv::COLOR_BGR2BGRA);
+        ColorClassifier::classify(table, buffers.display, false, buffers.labels, buffers.masked);
+        kernels::convertSplitPreview(buffers.display, false, PREVIEW_SCALE, cv::COLOR_BGR2HSV,
+            kernels::isFusedConversion(cv::COLOR_BGR2HSV), buffers.color_space, buffers.channels, CV_8UC1);
+    } });
+
+    cases.push_back({ "pipeline tiled", pipeline_bytes, [&table](frame_buffers& buffers) {
+        const cv::Size preview_size(buffers.size.width / PREVIEW_SCALE, buffers.size.height / PREVIEW_SCALE);
+        buffers.display.create(buffers.size, CV_8UC4);
+        buffers.masked.create(buffers.size, CV_8UC4);
+        for (auto& channel : buffers.channels) {
+            channel.create(preview_size, CV_8UC1);
+        }
+
+        const bool fused = kernels::isFusedConversion(cv::COLOR_BGR2HSV);
+        buffers.pool->parallelFor(int32_t(buffers.blocks.size()), [&](int32_t index) {
+            const cv::Rect& block = buffers.blocks[index];
+            cv::Mat display = buffers.display(block);
+            cv::cvtColor(buffers.bgr(block), display, cv::COLOR_BGR2BGRA);
+
+            cv::Mat labels = scratch::get(scratch::Labels, block.size(), CV_32SC1);
+            cv::Mat masked = buffers.masked(block);
+            ColorClassifier::classify(table, display, false, labels, masked);
+
+            // Blocks start on multiples of the scale, only their ends round down
+            cv::Rect preview(block.x / PREVIEW_SCALE, block.y / PREVIEW_SCALE,
+                (block.x + block.width) / PREVIEW_SCALE - block.x / PREVIEW_SCALE,
+                (block.y + block.height) / PREVIEW_SCALE - block.y / PREVIEW_SCALE);
+            if (preview.empty()) {
+                return;
+            }
+
+            cv::Rect source(preview.x * PREVIEW_SCALE, preview.y * PREVIEW_SCALE,
+                preview.width * PREVIEW_SCALE, preview.height * PREVIEW_SCALE);
+            cv::Mat color_space = scratch::get(scratch::ColorSpace, preview.size(), CV_8UC3);
+            cv::Mat channels[3] = {
+                buffers.channels[0](preview), buffers.channels[1](preview), buffers.channels[2](preview)
+            };
+
+            kernels::convertSplitPreview(buffers.display(source), false, PREVIEW_SCALE, cv::COLOR_BGR2HSV,
+                fused, color_space, channels, CV_8UC1);
+        });
+    }, true });
+
+    // The same on the OpenCL device. Kernels alone, on a frame uploaded
+    // already, wait for the device to be done. The pipeline is timed from
+    // the host frame to the outputs mapped back into host buffers, as in
+    // show_gui, which picks it over the CPU stages when it is faster.
+    cases.push_back({ "umat cvtColor display BGRA", 3 + 4, [](frame_buffers& buffers) {
+        cv::cvtColor(buffers.device_bgr, buffers.device_bgra, cv::COLOR_BGR2BGRA);
+        cv::ocl::finish();
+    }, false, true });
+
+    cases.push_back({ "umat cvtColor HSV", 3 + 3, [](frame_buffers& buffers) {
+        cv::cvtColor(buffers.device_bgr, buffers.device_color_space, cv::COLOR_BGR2HSV);
+        cv::ocl::finish();
+    }, false, true });
+
+    cases.push_back({ "umat split", 3 + 3, [](frame_buffers& buffers) {
+        cv::split(buffers.device_bgr, buffers.device_planes);
+        cv::ocl::finish();
+    }, false, true });
+
+    cases.push_back({ "umat inRange", 3 + 1, [](frame_buffers& buffers) {
+        cv::inRange(buffers.device_color_space, cv::Scalar(20, 60, 60), cv::Scalar(60, 255, 255), buffers.device_mask);
+        cv::ocl::finish();
+    }, false, true });
+
+    cases.push_back({ "pipeline umat", pipeline_bytes, [&table](frame_buffers& buffers) {
+        const cv::Size preview_size(buffers.size.width / PREVIEW_SCALE, buffers.size.height / PREVIEW_SCALE);
+        buffers.display.create(buffers.size, CV_8UC4);
+        buffers.masked.create(buffers.size, CV_8UC4);
+        buffers.atlas.create(preview_size.height, preview_size.width * UMatPipeline::NUM_OF_PREVIEWS, CV_8UC1);
+        buffers.umat_pipeline.process(buffers.bgr, cv::COLOR_BGR2BGRA, cv::COLOR_BGR2HSV, &table, PREVIEW_SCALE,
+            &buffers.display, &buffers.masked, &buffers.atlas);
+    }, false, true });
+
+    // The copy of the display image bgfx makes when a texture is updated
+    cases.push_back({ "texture upload copy", 4 + 4, [](frame_buffers& buffers) {
+        std::memcpy(buffers.upload.data, buffers.bgra.data, buffers.bgra.total() * buffers.bgra.elemSize());
+    } });
+
+    return cases;
+}
+
+struct kernel_result {
+    std::string name;
+    std::string size_name;
+    cv::Size    size;
+    int32_t     threads;
+    double      ms;
+    double      mpix_per_s;
+    double      gb_per_s;
+    double      llc_bytes_per_pixel;    // Measured, negative if unknown
+};
+
+struct timing {
+    double  ms;
+    double  cache_misses;   // Last level, per iteration, negative if unknown
+};
+
+// Run at least the given iterations, and for at least the given time.
+// Counters are those of the calling thread: they only account for all of
+// the kernel's memory traffic when it runs on that thread alone.
+timing time_kernel(int32_t iterations, double min_ms, const std::function<void()>& fn) {
+    fn(); // warm-up, outputs get allocated here
+
+    perf::Sample start_counters;
+    bool has_counters = perf::read(start_counters);
+
+    int32_t count = 0;
+    std::chrono::duration<double, std::milli> elapsed(0);
+    auto start = std::chrono::high_resolution_clock::now();
+    while (count < iterations || elapsed.count() < min_ms) {
+        fn();
+        ++count;
+        elapsed = std::chrono::high_resolution_clock::now() - start;
+    }
+
+    timing result = { elapsed.count() / count, -1.0 };
+
+    perf::Sample end_counters;
+    if (has_counters && perf::read(end_counters)) {
+        auto counters = perf::subtract(end_counters, start_counters);
+        if (counters.valid & (1u << perf::CacheMisses)) {
+            result.cache_misses = double(counters.values[perf::CacheMisses]) / count;
+        }
+    }
+
+    return result;
+}
+
+// Thread counts to run with: powers of two up to the maximum, and it
+std::vector<int32_t> make_thread_counts(int32_t max_threads) {
+    std::vector<int32_t> counts;
+    for (int32_t threads = 1; threads < max_threads; threads *= 2) {
+        counts.push_back(threads);
+    }
+
+    counts.push_back(max_threads);
+    return counts;
+}
+
+std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = std::min(list.find(',', start), list.size());
+        if (end > start) {
+            items.push_back(list.substr(start, end - start));
+        }
+
+        start = end + 1;
+    }
+
+    return items;
+}
+
+std::string escape_json(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+
+        escaped += c;
+    }
+
+    return escaped;
+}
+
+bool write_json(const std::string& path, const std::vector<kernel_result>& results) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    file << "{\n"
+        << "    \"opencv\": \"" << CV_VERSION << "\",\n"
+#if defined(__clang__)
+        << "    \"compiler\": \"clang " << __clang_version__ << "\",\n"
+#elif defined(__GNUC__)
+        << "    \"compiler\": \"gcc " << __VERSION__ << "\",\n"
+#elif defined(_MSC_VER)
+        << "    \"compiler\": \"msvc " << _MSC_FULL_VER << "\",\n"
+#endif
+        << "    \"simd\": " << (kernels::useSimd() ? "true" : "false") << ",\n"
+        << "    \"cpus\": " << cv::getNumberOfCPUs() << ",\n"
+        << "    \"opencl\": \"" << escape_json(UMatPipeline::getDeviceName()) << "\",\n"
+        << "    \"results\": [\n";
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& result = results[i];
+        file << "        { \"kernel\": \"" << escape_json(result.name) << "\""
+            << ", \"size\": \"" << result.size_name << "\""
+            << ", \"width\": " << result.size.width
+            << ", \"height\": " << result.size.height
+            << ", \"threads\": " << result.threads
+            << ", \"ms\": " << result.ms
+            << ", \"mpix_per_s\": " << result.mpix_per_s
+            << ", \"gb_per_s\": " << result.gb_per_s;
+
+        if (result.llc_bytes_per_pixel >= 0.0) {
+            file << ", \"llc_bytes_per_pixel\": " << result.llc_bytes_per_pixel;
+        }
+
+        file << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    file << "    ]\n}\n";
+    return bool(file);
+}
+
+int main(int32_t argc, char* argv[]) {
+
+    try {
+        std::string options =
+            "{help h usage| |Program usage}"
+            "{sizes s|360p,720p,1080p,4k|Frame sizes to run at, among 360p, 720p, 1080p, 4k and 8k}"
+            "{threads t|0|Maximum number of threads, 0 for every CPU}"
+            "{iterations i|20|Minimum number of iterations per kernel}"
+            "{min-ms|200|Minimum time per kernel, in milliseconds}"
+            "{filter f| |Only run the kernels whose name contains this}"
+            "{opencl-device d|-1|OpenCL device the umat kernels run on, numbered as show_gui enumerates them, -1 to skip them}"
+            "{json j| |Write the results into the given JSON file}";
+
+        cv::CommandLineParser parser(argc, argv, options);
+        parser.about("Benchmarks the image kernels of show_gui");
+
+        if (parser.has("help")) {
+            parser.printMessage();
+            return EXIT_SUCCESS;
+        }
+
+        if (!parser.check()) {
+            parser.printErrors();
+            return EXIT_FAILURE;
+        }
+
+        int32_t max_threads = parser.get<int32_t>("threads");
+        if (max_threads <= 0) {
+            max_threads = cv::getNumberOfCPUs();
+        }
+
+        int32_t iterations = std::max(parser.get<int32_t>("iterations"), 1);
+        double min_ms = std::max(parser.get<double>("min-ms"), 0.0);
+        std::string filter = parser.has("filter") ? parser.get<std::string>("filter") : std::string();
+        std::string json = parser.has("json") ? parser.get<std::string>("json") : std::string();
+
+        std::vector<frame_size> sizes;
+        for (const auto& name : split_list(parser.get<std::string>("sizes"))) {
+            auto it = std::find_if(std::begin(frame_sizes), std::end(frame_sizes),
+                [&name](const frame_size& size) { return name == size.name; });
+            if (it == std::end(frame_sizes)) {
+                std::cerr << "Unknown frame size " << name << std::endl;
+                return EXIT_FAILURE;
+            }
+
+            sizes.push_back(*it);
+        }
+
+        // Before any UMat is created, OpenCV only picks its device once
+        const bool has_opencl = UMatPipeline::selectDevice(parser.get<int32_t>("opencl-device"));
+        if (has_opencl) {
+            std::cout << "OpenCL device: " << UMatPipeline::getDeviceName() << std::endl;
+        }
+        else {
+            std::cout << "No OpenCL device, skipping the umat kernels" << std::endl;
+        }
+
+        // A table with a single class, built by the classifier's own worker
+        ColorClassifier classifier;
+        classifier.init(6);
+        classifier.setClass(0, { cv::COLOR_BGR2HSV, cv::Vec3b(20, 60, 60), cv::Vec3b(60, 255, 255) });
+        auto table = classifier.getTable();
+        while (table->classes == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            table = classifier.getTable();
+        }
+
+        // Misses of the last level cache measure the memory traffic of the
+        // single-threaded runs, where the hardware lets us count them
+        if (!perf::enable()) {
+            std::cout << "Hardware counters unavailable: " << perf::getUnavailableReason() << std::endl;
+        }
+
+        auto cases = make_kernel_cases(*table);
+        auto thread_counts = make_thread_counts(max_threads);
+
+        std::vector<kernel_result> results;
+        for (const auto& size : sizes) {
+            frame_buffers buffers(size.size);
+            const double pixels = double(size.size.area());
+
+            for (const auto& kernel : cases) {
+                if (!filter.empty() && kernel.name.find(filter) == std::string::npos) {
+                    continue;
+                }
+
+                if (kernel.uses_opencl && !has_opencl) {
+                    continue;
+                }
+
+                for (auto threads : thread_counts) {
+                    // The device runs as it does whatever OpenCV's threads,
+                    // its kernels are reported with 0 threads
+                    if (kernel.uses_opencl && threads != thread_counts.front()) {
+                        break;
+                    }
+
+                    cv::setNumThreads(threads);
+
+                    // The calling thread is one of the threads, and the pool
+                    // gives OpenCV its threads back when it shuts down
+                    TaskPool pool;
+                    if (kernel.uses_pool) {
+                        pool.init(threads - 1);
+                        buffers.pool = &pool;
+                    }
+
+                    auto measured = time_kernel(iterations, min_ms, [&] {
+                        kernel.run(buffers);
+                    });
+
+                    pool.shutdown();
+                    buffers.pool = nullptr;
+
+                    const double ms = measured.ms;
+                    const bool counts_misses = threads == 1 && !kernel.uses_opencl && measured.cache_misses >= 0.0;
+                    kernel_result result = {
+                        kernel.name, size.name, size.size, kernel.uses_opencl ? 0 : threads, ms,
+                        pixels / (ms * 1e3),
+                        pixels * kernel.bytes_per_pixel / (ms * 1e6),
+                        counts_misses ? measured.cache_misses * 64 / pixels : -1.0
+                    };
+
+                    std::cout << size.name << " " << kernel.name << " x" << result.threads << ": "
+                        << ms << " ms, "
+                        << result.mpix_per_s << " MPix/s, "
+                        << result.gb_per_s << " GB/s";
+
+                    if (result.llc_bytes_per_pixel >= 0.0) {
+                        std::cout << ", " << result.llc_bytes_per_pixel << " LLC miss bytes/pixel";
+                    }
+
+                    std::cout << std::endl;
+
+                    results.push_back(result);
+                }
+            }
+        }
+
+        cv::setNumThreads(-1);
+        classifier.shutdown();
+
+        if (!json.empty() && !write_json(json, results)) {
+            std::cerr << "Cannot write the results to " << json << std::endl;
+            return EXIT_FAILURE;
+        }
+
+    } catch (cv::Exception& cv_exc) {
+        std::cerr << cv_exc.msg << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    return EXIT_SUCCESS;
+}
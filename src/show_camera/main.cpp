@@ -1,12 +1,16 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <algorithm>
 
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 #include <opencv2/core/utility.hpp>
 #include <opencv2/videoio.hpp>
 
+#include "frame_source.h"
+#include "camera_enumeration.h"
+
 template<class T>
 T base_name(T const & path, T const & delims = "/\\")
 {
@@ -28,7 +32,9 @@ void help(const char* path) {
         << "usage: " << progname << " [options]" << std::endl
         << "usage: " << progname << " <camera-id> <width> <height> <fps>" << std::endl
         << "\toptions:" << std::endl
-        << "\t -e: enumerates the cameras in the system" << std::endl;
+        << "\t -e: enumerates the cameras in the system" << std::endl
+        << "\t -r: with -e, probes the cameras again instead of using the cache" << std::endl
+        << "\t -s: video file, image directory or 'synthetic' to show instead" << std::endl;
 }
 
 struct camera_info {
@@ -37,29 +43,16 @@ struct camera_info {
     int32_t     fps;
 };
 
-std::vector<camera_info> enum_available_cameras() {
-    std::vector<camera_info> cameras;
-
-    int32_t device_counts = 0;
-    while (true) {
-        cv::VideoCapture camera;
-        if (!camera.open(device_counts)) {
-            break;
-        }
+void print_camera_description(const CameraDescription& camera) {
+    std::cout << std::endl
+        << "Camera id: " << camera.id
+        << " " << camera.name
+        << " (" << describeCameraMode(camera.defaultMode) << ")"
+        << std::endl;
 
-        cameras.push_back({
-            device_counts,
-            cv::Size(
-                (int32_t)camera.get(CV_CAP_PROP_FRAME_WIDTH),
-                (int32_t)camera.get(CV_CAP_PROP_FRAME_HEIGHT)),
-            (int32_t)camera.get(CV_CAP_PROP_FPS)
-        });
-        
-        ++device_counts;
-        camera.release();
+    for (const auto& mode : camera.modes) {
+        std::cout << "\t" << describeCameraMode(mode) << std::endl;
     }
-
-    return cameras;
 }
 
 void print_camera_info(const camera_info& camera) {
@@ -78,6 +71,10 @@ int main(int32_t argc, char* argv[]) {
             "{help h usage| |Program usage}"
             "{info i| |OpenCV build info}"
             "{enum e| |Enumerates available cameras|}"
+            "{cache|auto|Cache of the enumerated cameras, 'auto' for the user's cache directory, 'none' for no cache|}"
+            "{refresh r| |Probe cameras again rather than using the cache|}"
+            "{timeout|3000|Time each camera has to be probed in, in milliseconds|}"
+            "{source s| |Video file, image directory or 'synthetic' to show instead of a camera|}"
             "{@camera|0|Camera to show|}"
             "{@width|1280|Desired frame width|}"
             "{@height|720|Desired frame height|}"
@@ -103,11 +100,28 @@ int main(int32_t argc, char* argv[]) {
 
         // Users wants to know the cameras availables
         if (parser.has("e")) {
-            auto cameras = enum_available_cameras();
+            std::string cache = parser.get<std::string>("cache");
+            if (cache == "auto") {
+                cache = getDefaultCameraCachePath();
+            }
+            else if (cache == "none") {
+                cache.clear();
+            }
+
+            auto enumeration = enumerateCameras({
+                cache,
+                std::max(parser.get<int32_t>("timeout"), 0),
+                8,
+                parser.has("refresh")
+            });
 
             std::cout << "Available cameras: " << std::endl;
-            for (auto camera : cameras) {
-                print_camera_info(camera);
+            for (const auto& camera : enumeration.cameras) {
+                print_camera_description(camera);
+            }
+
+            for (auto id : enumeration.timedOut) {
+                std::cout << "Camera " << id << " did not answer in time" << std::endl;
             }
 
             return EXIT_SUCCESS;
@@ -122,23 +136,18 @@ int main(int32_t argc, char* argv[]) {
             parser.get<int32_t>("@fps")
         };
 
-        cv::VideoCapture vc;
-        if (!vc.open(ci.id)) {
-            std::cerr << "Camera " << ci.id << " is not available!" << std::endl;
+        std::string input = parser.has("source") ? parser.get<std::string>("source") : std::string();
+        auto source = createFrameSource(input, ci.id, ci.frame_size, ci.fps);
+        if (!source->open()) {
+            std::cerr << source->getDescription() << " is not available!" << std::endl;
             help(argv[0]);
             return EXIT_FAILURE;
         }
 
-        vc.set(CV_CAP_PROP_FRAME_WIDTH, (double)ci.frame_size.width);
-        vc.set(CV_CAP_PROP_FRAME_HEIGHT, (double)ci.frame_size.height);
-        vc.set(CV_CAP_PROP_FPS, (double)ci.fps);
-
         camera_info camera = {
-            ci.id,
-            cv::Size(
-                (int32_t)vc.get(CV_CAP_PROP_FRAME_WIDTH),
-                (int32_t)vc.get(CV_CAP_PROP_FRAME_HEIGHT)),
-            (int32_t)vc.get(CV_CAP_PROP_FPS)
+            source->getCameraId(),
+            source->getFrameSize(),
+            source->getFPS()
         };
 
         // Print caps of current camera
@@ -149,10 +158,10 @@ int main(int32_t argc, char* argv[]) {
         cv::namedWindow(window_name);
 
         cv::Mat frame;
-        while (vc.grab() && vc.retrieve(frame)) {
+        while (source->read(frame)) {
             cv::imshow(window_name, frame);
 
-            auto key = cv::waitKey((int32_t)(1000.0/camera.fps));
+            auto key = cv::waitKey(camera.fps > 0 ? (int32_t)(1000.0/camera.fps) : 1);
             if (key == 27) // ESCAPE
                 break;
 
@@ -0,0 +1,107 @@
+#ifndef BOUNDED_QUEUE_H_HEADER_GUARD
+#define BOUNDED_QUEUE_H_HEADER_GUARD
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <cstddef>
+
+// Blocking FIFO with a fixed capacity, used to connect pipeline stages.
+// A full queue stalls the producer, which is how back-pressure propagates
+// from the slowest stage up to the capture. Once closed, pushes fail and
+// pops drain whatever is left before failing too.
+template<typename T>
+class BoundedQueue {
+
+public:
+
+	explicit BoundedQueue(size_t _capacity = 1)
+		: m_capacity(_capacity), m_closed(false) {
+
+	}
+
+	// Block until there is room for the value.
+	// Returns false if the queue has been closed.
+	bool push(T _value) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notFull.wait(lock, [this] {
+			return m_closed || m_items.size() < m_capacity;
+		});
+
+		if (m_closed) {
+			return false;
+		}
+
+		m_items.push_back(std::move(_value));
+		lock.unlock();
+
+		m_notEmpty.notify_one();
+		return true;
+	}
+
+	// Block until a value is available.
+	// Returns false if the queue has been closed and drained.
+	bool pop(T& _value) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_notEmpty.wait(lock, [this] {
+			return m_closed || !m_items.empty();
+		});
+
+		if (m_items.empty()) {
+			return false;
+		}
+
+		_value = std::move(m_items.front());
+		m_items.pop_front();
+		lock.unlock();
+
+		m_notFull.notify_one();
+		return true;
+	}
+
+	// Pop without blocking, returns false if the queue is empty.
+	bool tryPop(T& _value) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if (m_items.empty()) {
+			return false;
+		}
+
+		_value = std::move(m_items.front());
+		m_items.pop_front();
+		lock.unlock();
+
+		m_notFull.notify_one();
+		return true;
+	}
+
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closed = true;
+		}
+
+		m_notEmpty.notify_all();
+		m_notFull.notify_all();
+	}
+
+	void setCapacity(size_t _capacity) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_capacity = _capacity;
+	}
+
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_items.size();
+	}
+
+private:
+
+	mutable std::mutex		m_mutex;
+	std::condition_variable	m_notEmpty;
+	std::condition_variable	m_notFull;
+	std::deque<T>			m_items;
+	size_t					m_capacity;
+	bool					m_closed;
+};
+
+#endif // BOUNDED_QUEUE_H_HEADER_GUARD
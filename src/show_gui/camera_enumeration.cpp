@@ -0,0 +1,602 @@
+#include "camera_enumeration.h"
+
+#include <opencv2/videoio.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__)
+#	include <linux/videodev2.h>
+#	include <dirent.h>
+#	include <fcntl.h>
+#	include <sys/ioctl.h>
+#	include <unistd.h>
+#	include <cerrno>
+#endif
+
+namespace {
+
+	// Bumped whenever the layout of the cache changes
+	const int32_t CACHE_VERSION = 1;
+
+	// Tried where a device only gives a range of sizes, or none at all
+	const cv::Size s_commonSizes[] = {
+		{ 320, 240 },
+		{ 640, 360 },
+		{ 640, 480 },
+		{ 800, 600 },
+		{ 1024, 768 },
+		{ 1280, 720 },
+		{ 1280, 960 },
+		{ 1600, 1200 },
+		{ 1920, 1080 },
+		{ 2560, 1440 },
+		{ 3840, 2160 },
+	};
+
+	struct Device {
+		int32_t		id;
+		std::string	identity;	// Empty where devices cannot be identified
+	};
+
+	enum class ProbeResult {
+		Camera,
+		NotCamera,		// A device which is known not to capture video
+		Failed,
+	};
+
+	// Largest modes first, then fastest, then by pixel format
+	void sortModes(std::vector<CameraMode>& _modes) {
+		std::sort(_modes.begin(), _modes.end(), [](const CameraMode& _a, const CameraMode& _b) {
+			if (_a.frameSize.area() != _b.frameSize.area()) {
+				return _a.frameSize.area() > _b.frameSize.area();
+			}
+
+			if (_a.frameSize.width != _b.frameSize.width) {
+				return _a.frameSize.width > _b.frameSize.width;
+			}
+
+			if (_a.fps != _b.fps) {
+				return _a.fps > _b.fps;
+			}
+
+			return _a.fourcc < _b.fourcc;
+		});
+
+		_modes.erase(std::unique(_modes.begin(), _modes.end(), [](const CameraMode& _a, const CameraMode& _b) {
+			return _a.frameSize == _b.frameSize && _a.fps == _b.fps && _a.fourcc == _b.fourcc;
+		}), _modes.end());
+	}
+
+#if defined(__linux__)
+	bool readLine(const std::string& _path, std::string& _line) {
+		std::ifstream file(_path);
+		return bool(std::getline(file, _line));
+	}
+
+	// Video nodes from sysfs, identified by name, bus path and node index,
+	// which stay the same for as long as the device is plugged in the same
+	// port, whatever the order devices show up in.
+	bool listDevices(std::vector<Device>& _devices) {
+		const std::string root = "/sys/class/video4linux/";
+		DIR* dir = opendir(root.c_str());
+		if (!dir) {
+			return false;
+		}
+
+		while (dirent* entry = readdir(dir)) {
+			int32_t id;
+			char extra;
+			if (std::sscanf(entry->d_name, "video%d%c", &id, &extra) != 1) {
+				continue;
+			}
+
+			const std::string node = root + entry->d_name;
+			std::string name;
+			std::string index;
+			readLine(node + "/name", name);
+			readLine(node + "/index", index);
+
+			std::string bus;
+			if (char* path = realpath((node + "/device").c_str(), nullptr)) {
+				bus = path;
+				bus = bus.substr(bus.find_last_of('/') + 1);
+				std::free(path);
+			}
+
+			_devices.push_back({ id, name + "|" + bus + "|" + index });
+		}
+
+		closedir(dir);
+
+		std::sort(_devices.begin(), _devices.end(), [](const Device& _a, const Device& _b) {
+			return _a.id < _b.id;
+		});
+
+		return true;
+	}
+
+	int32_t xioctl(int32_t _fd, unsigned long _request, void* _arg) {
+		int32_t result;
+		do {
+			result = ioctl(_fd, _request, _arg);
+		} while (result == -1 && errno == EINTR);
+
+		return result;
+	}
+
+	int32_t toFPS(const v4l2_fract& _interval) {
+		return _interval.numerator > 0
+			? int32_t((_interval.denominator + _interval.numerator / 2) / _interval.numerator)
+			: 0;
+	}
+
+	void addIntervals(int32_t _fd, uint32_t _fourcc, cv::Size _size, std::vector<CameraMode>& _modes) {
+		v4l2_frmivalenum interval;
+		std::memset(&interval, 0, sizeof(interval));
+		interval.pixel_format = _fourcc;
+		interval.width = uint32_t(_size.width);
+		interval.height = uint32_t(_size.height);
+
+		for (; xioctl(_fd, VIDIOC_ENUM_FRAMEINTERVALS, &interval) == 0; ++interval.index) {
+			if (interval.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+				_modes.push_back({ _size, toFPS(interval.discrete), _fourcc });
+				continue;
+			}
+
+			// A range, given by its fastest and slowest ends
+			_modes.push_back({ _size, toFPS(interval.stepwise.min), _fourcc });
+			_modes.push_back({ _size, toFPS(interval.stepwise.max), _fourcc });
+			return;
+		}
+
+		if (interval.index == 0) {
+			_modes.push_back({ _size, 0, _fourcc });
+		}
+	}
+
+	void addSizes(int32_t _fd, uint32_t _fourcc, std::vector<CameraMode>& _modes) {
+		v4l2_frmsizeenum size;
+		std::memset(&size, 0, sizeof(size));
+		size.pixel_format = _fourcc;
+
+		for (; xioctl(_fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; ++size.index) {
+			if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+				addIntervals(_fd, _fourcc, cv::Size(int32_t(size.discrete.width), int32_t(size.discrete.height)), _modes);
+				continue;
+			}
+
+			// A range, given by its ends and the common sizes it holds
+			const auto& range = size.stepwise;
+			addIntervals(_fd, _fourcc, cv::Size(int32_t(range.min_width), int32_t(range.min_height)), _modes);
+			addIntervals(_fd, _fourcc, cv::Size(int32_t(range.max_width), int32_t(range.max_height)), _modes);
+
+			for (const auto& common : s_commonSizes) {
+				const uint32_t width = uint32_t(common.width);
+				const uint32_t height = uint32_t(common.height);
+				if (width < range.min_width || width > range.max_width
+					|| height < range.min_height || height > range.max_height) {
+					continue;
+				}
+
+				if ((range.step_width > 1 && (width - range.min_width) % range.step_width != 0)
+					|| (range.step_height > 1 && (height - range.min_height) % range.step_height != 0)) {
+					continue;
+				}
+
+				addIntervals(_fd, _fourcc, common, _modes);
+			}
+
+			return;
+		}
+	}
+
+	ProbeResult queryDevice(int32_t _fd, CameraDescription& _camera) {
+		v4l2_capability capability;
+		std::memset(&capability, 0, sizeof(capability));
+		if (xioctl(_fd, VIDIOC_QUERYCAP, &capability) != 0) {
+			return ProbeResult::Failed;
+		}
+
+		// Capabilities of the node, rather than of the whole device
+		const uint32_t caps = (capability.capabilities & V4L2_CAP_DEVICE_CAPS) != 0
+			? capability.device_caps
+			: capability.capabilities;
+		if ((caps & V4L2_CAP_VIDEO_CAPTURE) == 0) {
+			return ProbeResult::NotCamera;
+		}
+
+		_camera.name = reinterpret_cast<const char*>(capability.card);
+
+		v4l2_fmtdesc format;
+		std::memset(&format, 0, sizeof(format));
+		format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		for (; xioctl(_fd, VIDIOC_ENUM_FMT, &format) == 0; ++format.index) {
+			addSizes(_fd, format.pixelformat, _camera.modes);
+		}
+
+		// The mode the device is currently set to
+		v4l2_format current;
+		std::memset(&current, 0, sizeof(current));
+		current.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (xioctl(_fd, VIDIOC_G_FMT, &current) == 0) {
+			_camera.defaultMode.frameSize = cv::Size(int32_t(current.fmt.pix.width), int32_t(current.fmt.pix.height));
+			_camera.defaultMode.fourcc = current.fmt.pix.pixelformat;
+		}
+
+		v4l2_streamparm parameters;
+		std::memset(&parameters, 0, sizeof(parameters));
+		parameters.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (xioctl(_fd, VIDIOC_G_PARM, &parameters) == 0) {
+			_camera.defaultMode.fps = toFPS(parameters.parm.capture.timeperframe);
+		}
+
+		return ProbeResult::Camera;
+	}
+
+	// Ask the driver directly, which lists every mode without streaming
+	ProbeResult probeDevice(const Device& _device, CameraDescription& _camera) {
+		if (_device.identity.empty()) {
+			return ProbeResult::Failed;
+		}
+
+		const std::string path = "/dev/video" + std::to_string(_device.id);
+		int32_t fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0) {
+			return ProbeResult::Failed;
+		}
+
+		auto result = queryDevice(fd, _camera);
+		close(fd);
+		return result;
+	}
+#else
+	bool listDevices(std::vector<Device>& /*_devices*/) {
+		return false;
+	}
+
+	ProbeResult probeDevice(const Device& /*_device*/, CameraDescription& /*_camera*/) {
+		return ProbeResult::Failed;
+	}
+#endif
+
+	CameraMode getCaptureMode(cv::VideoCapture& _capture) {
+		return {
+			cv::Size(
+				(int32_t)_capture.get(CV_CAP_PROP_FRAME_WIDTH),
+				(int32_t)_capture.get(CV_CAP_PROP_FRAME_HEIGHT)),
+			(int32_t)_capture.get(CV_CAP_PROP_FPS),
+			uint32_t(int64_t(_capture.get(CV_CAP_PROP_FOURCC)))
+		};
+	}
+
+	// Open the camera with OpenCV and find out which of the common sizes
+	// it accepts, at the rate it then reports.
+	ProbeResult probeCapture(const Device& _device, CameraDescription& _camera) {
+		cv::VideoCapture capture;
+		if (!capture.open(_device.id)) {
+			return ProbeResult::Failed;
+		}
+
+		_camera.name = "camera " + std::to_string(_device.id);
+		_camera.defaultMode = getCaptureMode(capture);
+		_camera.modes.push_back(_camera.defaultMode);
+
+		for (const auto& size : s_commonSizes) {
+			capture.set(CV_CAP_PROP_FRAME_WIDTH, (double)size.width);
+			capture.set(CV_CAP_PROP_FRAME_HEIGHT, (double)size.height);
+
+			auto mode = getCaptureMode(capture);
+			if (mode.frameSize == size) {
+				_camera.modes.push_back(mode);
+			}
+		}
+
+		return ProbeResult::Camera;
+	}
+
+	// Probes still running once the time is up are left behind, detached:
+	// there is no way to interrupt cv::VideoCapture::open. They share their
+	// results through this, which the last one of them frees.
+	struct ProbeState {
+		std::mutex						mutex;
+		std::condition_variable			finished;
+		std::vector<CameraDescription>	cameras;
+		std::vector<std::string>		notCameras;
+		std::vector<int32_t>			pending;
+	};
+
+	// Probes left behind, until they are waited for at shutdown
+	std::mutex									s_probesMutex;
+	std::vector<std::shared_ptr<ProbeState>>	s_probes;
+
+	void probeDevices(const std::vector<Device>& _devices, int32_t _timeoutMs,
+		CameraEnumeration& _enumeration, std::vector<std::string>& _notCameras) {
+		if (_devices.empty()) {
+			return;
+		}
+
+		auto state = std::make_shared<ProbeState>();
+		for (const auto& device : _devices) {
+			state->pending.push_back(device.id);
+		}
+
+		for (const auto& device : _devices) {
+			std::thread([state, device]() {
+				CameraDescription camera;
+				camera.id = device.id;
+				camera.identity = device.identity.empty() ? "camera " + std::to_string(device.id) : device.identity;
+				camera.defaultMode = { cv::Size(), 0, 0 };
+				camera.fromCache = false;
+
+				auto result = device.identity.empty()
+					? probeCapture(device, camera)
+					: probeDevice(device, camera);
+				sortModes(camera.modes);
+
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (result == ProbeResult::Camera) {
+					state->cameras.push_back(camera);
+				}
+				else if (result == ProbeResult::NotCamera) {
+					state->notCameras.push_back(device.identity);
+				}
+
+				state->pending.erase(std::find(state->pending.begin(), state->pending.end(), device.id));
+				state->finished.notify_all();
+			}).detach();
+		}
+
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(_timeoutMs, 0));
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->finished.wait_until(lock, deadline, [&state]() {
+			return state->pending.empty();
+		});
+
+		// What a probe left behind finds is not taken: its device may be
+		// held open by it for as long as it runs
+		if (!state->pending.empty()) {
+			std::lock_guard<std::mutex> probesLock(s_probesMutex);
+			s_probes.push_back(state);
+		}
+
+		_enumeration.cameras.insert(_enumeration.cameras.end(), state->cameras.begin(), state->cameras.end());
+		_enumeration.timedOut = state->pending;
+		_enumeration.numOfProbed = int32_t(state->cameras.size());
+		_notCameras.insert(_notCameras.end(), state->notCameras.begin(), state->notCameras.end());
+	}
+
+	void writeMode(cv::FileStorage& _storage, const CameraMode& _mode) {
+		_storage << _mode.frameSize.width << _mode.frameSize.height << _mode.fps << int32_t(_mode.fourcc);
+	}
+
+	bool readCache(const std::string& _path, std::vector<CameraDescription>& _cameras,
+		std::vector<std::string>& _notCameras) {
+		try {
+			cv::FileStorage storage(_path, cv::FileStorage::READ);
+			if (!storage.isOpened() || (int32_t)storage["version"] != CACHE_VERSION) {
+				return false;
+			}
+
+			cv::FileNode cameras = storage["cameras"];
+			for (auto it = cameras.begin(); it != cameras.end(); ++it) {
+				const cv::FileNode& node = *it;
+
+				std::vector<int32_t> values;
+				node["modes"] >> values;
+
+				std::vector<int32_t> defaultValues;
+				node["default"] >> defaultValues;
+				if (defaultValues.size() != 4 || values.size() % 4 != 0) {
+					return false;
+				}
+
+				// Default mode first, then every other mode
+				values.insert(values.begin(), defaultValues.begin(), defaultValues.end());
+
+				std::vector<CameraMode> modes;
+				for (size_t i = 0; i < values.size(); i += 4) {
+					modes.push_back({ cv::Size(values[i], values[i + 1]), values[i + 2], uint32_t(values[i + 3]) });
+				}
+
+				CameraDescription camera;
+				camera.id = (int32_t)node["id"];
+				camera.identity = (std::string)node["identity"];
+				camera.name = (std::string)node["name"];
+				camera.defaultMode = modes.front();
+				camera.modes.assign(modes.begin() + 1, modes.end());
+				camera.fromCache = true;
+				_cameras.push_back(camera);
+			}
+
+			cv::FileNode notCameras = storage["not_cameras"];
+			for (auto it = notCameras.begin(); it != notCameras.end(); ++it) {
+				_notCameras.push_back((std::string)*it);
+			}
+
+			return true;
+		}
+		catch (const cv::Exception&) {
+			// A damaged cache is as good as none
+			_cameras.clear();
+			_notCameras.clear();
+			return false;
+		}
+	}
+
+	bool writeCache(const std::string& _path, const std::vector<CameraDescription>& _cameras,
+		const std::vector<std::string>& _notCameras) {
+		try {
+			cv::FileStorage storage(_path, cv::FileStorage::WRITE);
+			if (!storage.isOpened()) {
+				return false;
+			}
+
+			storage << "version" << CACHE_VERSION;
+			storage << "cameras" << "[";
+			for (const auto& camera : _cameras) {
+				storage << "{"
+					<< "identity" << camera.identity
+					<< "id" << camera.id
+					<< "name" << camera.name;
+
+				storage << "default" << "[:";
+				writeMode(storage, camera.defaultMode);
+				storage << "]";
+
+				storage << "modes" << "[:";
+				for (const auto& mode : camera.modes) {
+					writeMode(storage, mode);
+				}
+
+				storage << "]" << "}";
+			}
+
+			storage << "]";
+
+			storage << "not_cameras" << "[";
+			for (const auto& identity : _notCameras) {
+				storage << identity;
+			}
+
+			storage << "]";
+			return true;
+		}
+		catch (const cv::Exception&) {
+			return false;
+		}
+	}
+}
+
+std::string getDefaultCameraCachePath() {
+	const char* fileName = "opencv_samples_cameras.yml";
+
+#if defined(_WIN32)
+	if (const char* directory = std::getenv("LOCALAPPDATA")) {
+		return std::string(directory) + "\\" + fileName;
+	}
+#else
+	const char* directory = std::getenv("XDG_CACHE_HOME");
+	if (directory && *directory) {
+		return std::string(directory) + "/" + fileName;
+	}
+
+	if (const char* home = std::getenv("HOME")) {
+		return std::string(home) + "/.cache/" + fileName;
+	}
+#endif
+
+	return std::string();
+}
+
+CameraEnumeration enumerateCameras(const CameraEnumerationOptions& _options) {
+	CameraEnumeration enumeration;
+	enumeration.numOfProbed = 0;
+	enumeration.numOfCached = 0;
+
+	std::vector<CameraDescription> cached;
+	std::vector<std::string> cachedNotCameras;
+	if (!_options.cachePath.empty() && !_options.refresh) {
+		readCache(_options.cachePath, cached, cachedNotCameras);
+	}
+
+	std::vector<Device> devices;
+	const bool listed = listDevices(devices);
+
+	if (!listed) {
+		// Without identities, a cache stands for the whole system
+		if (!cached.empty()) {
+			enumeration.cameras = cached;
+			enumeration.numOfCached = int32_t(cached.size());
+			return enumeration;
+		}
+
+		for (int32_t id = 0; id < _options.maxCameras; ++id) {
+			devices.push_back({ id, std::string() });
+		}
+	}
+
+	// Only the devices the cache knows nothing about get probed
+	std::vector<Device> unknown;
+	std::vector<std::string> notCameras;
+	for (const auto& device : devices) {
+		auto camera = std::find_if(cached.begin(), cached.end(), [&device](const CameraDescription& _camera) {
+			return _camera.identity == device.identity;
+		});
+
+		if (listed && camera != cached.end()) {
+			enumeration.cameras.push_back(*camera);
+			enumeration.cameras.back().id = device.id;
+			++enumeration.numOfCached;
+		}
+		else if (listed && std::find(cachedNotCameras.begin(), cachedNotCameras.end(), device.identity) != cachedNotCameras.end()) {
+			notCameras.push_back(device.identity);
+		}
+		else {
+			unknown.push_back(device);
+		}
+	}
+
+	probeDevices(unknown, _options.timeoutMs, enumeration, notCameras);
+
+	std::sort(enumeration.cameras.begin(), enumeration.cameras.end(), [](const CameraDescription& _a, const CameraDescription& _b) {
+		return _a.id < _b.id;
+	});
+
+	// Rewritten with what is plugged in now, unless nothing has changed.
+	// Devices whose probe timed out are left out, to be probed next time.
+	const bool changed = !unknown.empty()
+		|| enumeration.numOfCached != int32_t(cached.size())
+		|| notCameras.size() != cachedNotCameras.size();
+	if (!_options.cachePath.empty() && changed) {
+		writeCache(_options.cachePath, enumeration.cameras, notCameras);
+	}
+
+	return enumeration;
+}
+
+std::string describeCameraMode(const CameraMode& _mode) {
+	std::string description = std::to_string(_mode.frameSize.width) + "x" + std::to_string(_mode.frameSize.height)
+		+ "@" + std::to_string(_mode.fps);
+
+	if (_mode.fourcc != 0) {
+		description += ' ';
+		for (int32_t shift = 0; shift < 32; shift += 8) {
+			char c = char((_mode.fourcc >> shift) & 0xff);
+			description += c >= ' ' && c <= '~' ? c : '?';
+		}
+	}
+
+	return description;
+}
+
+std::vector<int32_t> waitForCameraProbes(int32_t _timeoutMs) {
+	std::vector<std::shared_ptr<ProbeState>> probes;
+	{
+		std::lock_guard<std::mutex> lock(s_probesMutex);
+		probes.swap(s_probes);
+	}
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(_timeoutMs, 0));
+
+	std::vector<int32_t> running;
+	for (const auto& state : probes) {
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->finished.wait_until(lock, deadline, [&state]() {
+			return state->pending.empty();
+		});
+
+		running.insert(running.end(), state->pending.begin(), state->pending.end());
+	}
+
+	return running;
+}
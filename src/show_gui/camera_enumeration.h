@@ -0,0 +1,63 @@
+#ifndef CAMERA_ENUMERATION_H_HEADER_GUARD
+#define CAMERA_ENUMERATION_H_HEADER_GUARD
+
+#include <opencv2/core.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Cameras of the system, with every mode they support. Opening a camera
+// through cv::VideoCapture can take hundreds of milliseconds, so devices
+// are probed concurrently, each within a time limit, and what is found is
+// kept in an on-disk cache keyed by device identity for the next runs.
+//
+// On Linux, devices are listed from sysfs and queried through V4L2 for
+// their formats, frame sizes and intervals, without being opened by
+// OpenCV; cached devices are not queried at all. Elsewhere, devices can
+// neither be listed nor identified without opening them: ids are probed
+// with cv::VideoCapture, modes by trying common frame sizes, and a cache,
+// when there is one, is taken as is until a refresh is asked for.
+struct CameraMode {
+	cv::Size	frameSize;
+	int32_t		fps;
+	uint32_t	fourcc;			// Pixel format, 0 if unknown
+};
+
+struct CameraDescription {
+	int32_t					id;				// As given to cv::VideoCapture
+	std::string				identity;		// Stable across runs, the cache key
+	std::string				name;
+	CameraMode				defaultMode;
+	std::vector<CameraMode>	modes;
+	bool					fromCache;
+};
+
+struct CameraEnumeration {
+	std::vector<CameraDescription>	cameras;		// By id
+	std::vector<int32_t>			timedOut;		// Ids whose probe did not finish in time, unusable for this run
+	int32_t							numOfProbed;
+	int32_t							numOfCached;
+};
+
+struct CameraEnumerationOptions {
+	std::string	cachePath;		// Empty to neither read nor write a cache
+	int32_t		timeoutMs;		// Per device, probes run concurrently
+	int32_t		maxCameras;		// Ids probed where devices cannot be listed
+	bool		refresh;		// Probe cached devices again
+};
+
+// Cache file in the user's cache directory, empty if there is none
+std::string getDefaultCameraCachePath();
+
+CameraEnumeration enumerateCameras(const CameraEnumerationOptions& _options);
+
+// Wait up to _timeoutMs for the probes which did not finish in time, at
+// shutdown. Returns the ids of those still running, each of which may keep
+// its device open until the process ends.
+std::vector<int32_t> waitForCameraProbes(int32_t _timeoutMs);
+
+// "1280x720@30 MJPG"
+std::string describeCameraMode(const CameraMode& _mode);
+
+#endif // CAMERA_ENUMERATION_H_HEADER_GUARD
@@ -0,0 +1,252 @@
+#include "color_classifier.h"
+
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+	class ClassifyBody : public cv::ParallelLoopBody {
+
+	public:
+
+		ClassifyBody(const ColorClassifier::Table& _table, const cv::Mat& _image, bool _isRGB,
+			cv::Mat& _labels, cv::Mat& _display)
+			: m_table(_table), m_image(_image), m_isRGB(_isRGB), m_labels(_labels), m_display(_display) {
+
+		}
+
+		void operator()(const cv::Range& _rows) const override {
+			const int32_t channels = m_image.channels();
+			const int32_t blue = m_isRGB ? 2 : 0;
+			const int32_t red = 2 - blue;
+
+			for (int32_t y = _rows.start; y < _rows.end; ++y) {
+				const uchar* image = m_image.ptr(y);
+				auto* labels = m_labels.ptr<int32_t>(y);
+				uchar* display = m_display.ptr(y);
+
+				for (int32_t x = 0; x < m_image.cols; ++x, image += channels, display += channels) {
+					auto label = m_table.lookup(image[blue], image[1], image[red]);
+					labels[x] = int32_t(label);
+
+					if (label != 0) {
+						std::memcpy(display, image, channels);
+					}
+					else {
+						std::memset(display, 0, channels);
+					}
+				}
+			}
+		}
+
+	private:
+
+		const ColorClassifier::Table&	m_table;
+		const cv::Mat&					m_image;
+		bool							m_isRGB;
+		cv::Mat&						m_labels;
+		cv::Mat&						m_display;
+	};
+}
+
+void ColorClassifier::init(int32_t _bits) {
+	m_bits = std::min(std::max(_bits, 4), 8);
+	m_version = 0;
+	m_classes = 0;
+
+	const uint32_t numOfCells = 1u << (3 * m_bits);
+	const uint32_t channelMask = (1u << m_bits) - 1;
+	const int32_t shift = 8 - m_bits;
+	const int32_t center = shift > 0 ? 1 << (shift - 1) : 0;
+
+	m_cells.assign(numOfCells, 0);
+	m_cellColors.clear();
+
+	// Same layout as Table::lookup, blue in the most significant bits
+	m_cellCenters.create(int32_t(numOfCells), 1, CV_8UC3);
+	auto* centers = m_cellCenters.ptr<cv::Vec3b>(0);
+	for (uint32_t i = 0; i < numOfCells; ++i) {
+		centers[i] = cv::Vec3b(
+			uchar(((i >> (2 * m_bits)) << shift) + center),
+			uchar((((i >> m_bits) & channelMask) << shift) + center),
+			uchar(((i & channelMask) << shift) + center));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_tableMutex);
+		m_table = makeTable();
+	}
+
+	m_pendingDirty = 0;
+	m_pendingDefined = 0;
+	m_closing = false;
+	m_worker = std::thread([this] {
+		run();
+	});
+}
+
+void ColorClassifier::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(m_pendingMutex);
+		m_closing = true;
+	}
+
+	m_pendingChanged.notify_all();
+	if (m_worker.joinable()) {
+		m_worker.join();
+	}
+}
+
+void ColorClassifier::setClass(int32_t _index, const ColorClass& _class) {
+	if (_index < 0 || _index >= MAX_CLASSES) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_pendingMutex);
+		m_pending[_index] = _class;
+		m_pendingDirty |= 1u << _index;
+		m_pendingDefined |= 1u << _index;
+	}
+
+	m_pendingChanged.notify_one();
+}
+
+void ColorClassifier::clearClass(int32_t _index) {
+	if (_index < 0 || _index >= MAX_CLASSES) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_pendingMutex);
+		m_pendingDirty |= 1u << _index;
+		m_pendingDefined &= ~(1u << _index);
+	}
+
+	m_pendingChanged.notify_one();
+}
+
+void ColorClassifier::clearAll() {
+	{
+		std::lock_guard<std::mutex> lock(m_pendingMutex);
+		m_pendingDirty |= m_pendingDefined;
+		m_pendingDefined = 0;
+	}
+
+	m_pendingChanged.notify_one();
+}
+
+std::shared_ptr<const ColorClassifier::Table> ColorClassifier::getTable() const {
+	std::lock_guard<std::mutex> lock(m_tableMutex);
+	return m_table;
+}
+
+void ColorClassifier::classify(const Table& _table, const cv::Mat& _image, bool _isRGB,
+	cv::Mat& _labels, cv::Mat& _display) {
+	CV_Assert(_image.type() == CV_8UC3 || _image.type() == CV_8UC4);
+
+	_labels.create(_image.size(), CV_32SC1);
+	_display.create(_image.size(), _image.type());
+	cv::parallel_for_(cv::Range(0, _image.rows),
+		ClassifyBody(_table, _image, _isRGB, _labels, _display));
+}
+
+ColorClassifier::ColorClassifier()
+	: m_bits(0)
+	, m_version(0)
+	, m_classes(0)
+	, m_pendingDirty(0)
+	, m_pendingDefined(0)
+	, m_closing(false) {
+
+}
+
+ColorClassifier::~ColorClassifier() {
+	shutdown();
+}
+
+void ColorClassifier::run() {
+	ColorClass classes[MAX_CLASSES];
+	while (true) {
+		uint32_t dirty = 0;
+		uint32_t defined = 0;
+		{
+			std::unique_lock<std::mutex> lock(m_pendingMutex);
+			m_pendingChanged.wait(lock, [this] {
+				return m_pendingDirty != 0 || m_closing;
+			});
+
+			if (m_closing) {
+				return;
+			}
+
+			dirty = m_pendingDirty;
+			defined = m_pendingDefined;
+			std::copy(m_pending, m_pending + MAX_CLASSES, classes);
+			m_pendingDirty = 0;
+		}
+
+		// Only the bits of the classes which have changed are recomputed
+		for (int32_t i = 0; i < MAX_CLASSES; ++i) {
+			if (dirty & (1u << i)) {
+				updateClass(i, (defined & (1u << i)) ? &classes[i] : nullptr);
+			}
+		}
+
+		++m_version;
+		auto table = makeTable();
+
+		std::lock_guard<std::mutex> lock(m_tableMutex);
+		m_table = std::move(table);
+	}
+}
+
+std::shared_ptr<ColorClassifier::Table> ColorClassifier::makeTable() const {
+	auto table = std::make_shared<Table>();
+	table->cells = m_cells;
+	table->bits = m_bits;
+	table->version = m_version;
+	table->classes = m_classes;
+	return table;
+}
+
+const cv::Mat& ColorClassifier::getCellColors(int32_t _colorSpaceCode) {
+	auto it = m_cellColors.find(_colorSpaceCode);
+	if (it == m_cellColors.end()) {
+		cv::Mat colors;
+		cv::cvtColor(m_cellCenters, colors, _colorSpaceCode);
+		it = m_cellColors.emplace(_colorSpaceCode, colors).first;
+	}
+
+	return it->second;
+}
+
+void ColorClassifier::updateClass(int32_t _index, const ColorClass* _class) {
+	const uint32_t bit = 1u << _index;
+	if (!_class) {
+		for (auto& cell : m_cells) {
+			cell &= ~bit;
+		}
+
+		m_classes &= ~bit;
+		return;
+	}
+
+	const auto& colors = getCellColors(_class->colorSpaceCode);
+	const auto* color = colors.ptr<cv::Vec3b>(0);
+	const auto& lower = _class->lower;
+	const auto& upper = _class->upper;
+
+	for (size_t i = 0; i < m_cells.size(); ++i) {
+		const auto& c = color[i];
+		bool inside = c[0] >= lower[0] && c[0] <= upper[0]
+			&& c[1] >= lower[1] && c[1] <= upper[1]
+			&& c[2] >= lower[2] && c[2] <= upper[2];
+
+		m_cells[i] = inside ? (m_cells[i] | bit) : (m_cells[i] & ~bit);
+	}
+
+	m_classes |= bit;
+}
@@ -0,0 +1,114 @@
+#ifndef COLOR_CLASSIFIER_H_HEADER_GUARD
+#define COLOR_CLASSIFIER_H_HEADER_GUARD
+
+#include <opencv2/core.hpp>
+
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+// Multi-class color classifier backed by a 3D lookup table indexed by BGR.
+//
+// Each class is a box in the color space it has been picked in, the same
+// as cv::inRange would test, and owns one bit of the 32-bit table cells.
+// Classifying a pixel is then a single lookup, whatever the color spaces
+// of the classes are, with no per-frame color conversion.
+//
+// The table quantizes each BGR channel to a number of bits, each cell
+// being classified by the color at its center. With 6 bits it takes 1MB;
+// 8 bits index every color exactly, at 64MB.
+//
+// Changes to the classes are applied by a worker thread, which only
+// recomputes the bit of the classes that have changed, then publishes a
+// copy of the table. Readers keep using the table they hold meanwhile.
+class ColorClassifier {
+
+public:
+
+	static const int32_t MAX_CLASSES = 32;
+
+	struct ColorClass {
+		int32_t		colorSpaceCode;		// cv::COLOR_BGR2*
+		cv::Vec3b	lower;				// Inclusive bounds, in that color space
+		cv::Vec3b	upper;
+	};
+
+	// Published, immutable table.
+	struct Table {
+		std::vector<uint32_t>	cells;
+		int32_t					bits;		// Per channel
+		uint32_t				version;	// Increases with each publication
+		uint32_t				classes;	// One bit per class defined
+
+		uint32_t lookup(uchar _b, uchar _g, uchar _r) const {
+			auto shift = 8 - bits;
+			return cells[(uint32_t(_b >> shift) << (2 * bits))
+				| (uint32_t(_g >> shift) << bits)
+				| uint32_t(_r >> shift)];
+		}
+	};
+
+	// Start the worker with the given bits per channel, 4 to 8.
+	void init(int32_t _bits = 6);
+	void shutdown();
+
+	// Define, redefine or remove a class. Updates are coalesced, only the
+	// latest definition of a class matters when the worker gets to it.
+	void setClass(int32_t _index, const ColorClass& _class);
+	void clearClass(int32_t _index);
+	void clearAll();
+
+	// Latest published table, never null once initialized.
+	std::shared_ptr<const Table> getTable() const;
+
+	// Label each pixel of a BGR(A), or RGB(A) if _isRGB, image with the
+	// classes it belongs to, and write the pixels with at least one class
+	// into _display, same layout, black elsewhere.
+	static void classify(const Table& _table, const cv::Mat& _image, bool _isRGB,
+		cv::Mat& _labels, cv::Mat& _display);
+
+	ColorClassifier();
+	~ColorClassifier();
+
+	ColorClassifier(const ColorClassifier&) = delete;
+	ColorClassifier& operator=(const ColorClassifier&) = delete;
+
+private:
+
+	void run();
+
+	// Colors at the center of every cell, in the given color space
+	const cv::Mat& getCellColors(int32_t _colorSpaceCode);
+
+	void updateClass(int32_t _index, const ColorClass* _class);
+
+	// Table of the worker's current cells, to publish
+	std::shared_ptr<Table> makeTable() const;
+
+	// Worker's state
+	std::vector<uint32_t>		m_cells;
+	cv::Mat						m_cellCenters;				// BGR
+	std::map<int32_t, cv::Mat>	m_cellColors;				// Per color space
+	int32_t						m_bits;
+	uint32_t					m_version;
+	uint32_t					m_classes;
+
+	// Updates the worker has yet to apply
+	std::mutex					m_pendingMutex;
+	std::condition_variable		m_pendingChanged;
+	ColorClass					m_pending[MAX_CLASSES];
+	uint32_t					m_pendingDirty;
+	uint32_t					m_pendingDefined;
+	bool						m_closing;
+
+	mutable std::mutex			m_tableMutex;
+	std::shared_ptr<const Table>	m_table;
+
+	std::thread					m_worker;
+};
+
+#endif // COLOR_CLASSIFIER_H_HEADER_GUARD
@@ -0,0 +1,506 @@
+#include "color_kernels.h"
+#include "thread_scratch.h"
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+// The color space conversions below replicate, bit for bit, the 8-bit
+// fixed-point paths of cv::cvtColor. Since OpenCV is free to change them
+// between versions, FrameProcessor verifies each conversion against the
+// library it is linked with, and only uses the fused kernel where they match.
+
+namespace {
+
+	std::atomic<bool> s_useSimd(true);
+
+	inline int32_t descale(int32_t _value, int32_t _shift) {
+		return (_value + (1 << (_shift - 1))) >> _shift;
+	}
+
+	inline uchar saturate(int32_t _value) {
+		return (uchar)(_value < 0 ? 0 : _value > 255 ? 255 : _value);
+	}
+
+	// BGR to YCrCb, see RGB2YCrCb_i<uchar>
+	const int32_t YCC_SHIFT = 14;
+	const int32_t YCC_B2Y = 1868;
+	const int32_t YCC_G2Y = 9617;
+	const int32_t YCC_R2Y = 4899;
+	const int32_t YCC_CR = 11682;
+	const int32_t YCC_CB = 9241;
+	const int32_t YCC_DELTA = 128 << YCC_SHIFT;
+
+	// BGR to HSV, see RGB2HSV_b
+	const int32_t HSV_SHIFT = 12;
+
+	struct HSVTables {
+		int32_t sdiv[256];
+		int32_t hdiv[256];
+
+		HSVTables() {
+			sdiv[0] = hdiv[0] = 0;
+			for (int32_t i = 1; i < 256; ++i) {
+				sdiv[i] = cv::saturate_cast<int32_t>((255 << HSV_SHIFT) / (1. * i));
+				hdiv[i] = cv::saturate_cast<int32_t>((180 << HSV_SHIFT) / (6. * i));
+			}
+		}
+	};
+
+	// BGR to Lab, see RGB2Lab_b
+	const int32_t LAB_SHIFT = 12;
+	const int32_t GAMMA_SHIFT = 3;
+	const int32_t LAB_SHIFT2 = LAB_SHIFT + GAMMA_SHIFT;
+	const int32_t LAB_CBRT_TAB_SIZE = 256 * 3 / 2 * (1 << GAMMA_SHIFT);
+
+	struct LabTables {
+		uint16_t	gamma[256];
+		uint16_t	cbrt[LAB_CBRT_TAB_SIZE];
+		int32_t		coeffs[9];		// X, Y and Z rows, B G R columns
+
+		LabTables() {
+			for (int32_t i = 0; i < 256; ++i) {
+				float x = i * (1.f / 255.f);
+				gamma[i] = cv::saturate_cast<uint16_t>(255.f * (1 << GAMMA_SHIFT) * (x <= 0.04045f
+					? x * (1.f / 12.92f)
+					: (float)std::pow((double)(x + 0.055) * (1. / 1.055), 2.4)));
+			}
+
+			for (int32_t i = 0; i < LAB_CBRT_TAB_SIZE; ++i) {
+				float x = i * (1.f / (255.f * (1 << GAMMA_SHIFT)));
+				cbrt[i] = cv::saturate_cast<uint16_t>((1 << LAB_SHIFT2) * (x < 0.008856f
+					? x * 7.787f + 0.13793103448275862f
+					: std::cbrt(x)));
+			}
+
+			// sRGB to XYZ, normalized by the D65 white point
+			static const float sRGB2XYZ[] = {
+				0.412453f, 0.357580f, 0.180423f,
+				0.212671f, 0.715160f, 0.072169f,
+				0.019334f, 0.119193f, 0.950227f
+			};
+
+			static const float whitePoint[] = { 0.950456f, 1.f, 1.088754f };
+
+			for (int32_t i = 0; i < 3; ++i) {
+				double scale = (1 << LAB_SHIFT) / whitePoint[i];
+				coeffs[i * 3 + 0] = cvRound(sRGB2XYZ[i * 3 + 2] * scale);
+				coeffs[i * 3 + 1] = cvRound(sRGB2XYZ[i * 3 + 1] * scale);
+				coeffs[i * 3 + 2] = cvRound(sRGB2XYZ[i * 3 + 0] * scale);
+			}
+		}
+	};
+
+	const HSVTables& hsvTables() {
+		static const HSVTables tables;
+		return tables;
+	}
+
+	const LabTables& labTables() {
+		static const LabTables tables;
+		return tables;
+	}
+
+	void rowToRGB(const uchar* _bgr, uchar* _dst, int32_t _width) {
+		int32_t x = 0;
+#if CV_SIMD128
+		if (s_useSimd.load(std::memory_order::memory_order_relaxed)) {
+			for (; x <= _width - 16; x += 16) {
+				cv::v_uint8x16 b, g, r;
+				cv::v_load_deinterleave(_bgr + x * 3, b, g, r);
+				cv::v_store_interleave(_dst + x * 3, r, g, b);
+			}
+		}
+#endif
+		for (; x < _width; ++x) {
+			const uchar* s = _bgr + x * 3;
+			uchar* d = _dst + x * 3;
+			d[0] = s[2];
+			d[1] = s[1];
+			d[2] = s[0];
+		}
+	}
+
+#if CV_SIMD128
+	// Y, Cr and Cb of 8 pixels, as 16-bit values.
+	inline void ycrcb8(const cv::v_int16x8& _b, const cv::v_int16x8& _g, const cv::v_int16x8& _r,
+		cv::v_int16x8& _y, cv::v_int16x8& _cr, cv::v_int16x8& _cb) {
+		const cv::v_int16x8 coeffsBG(
+			YCC_B2Y, YCC_G2Y, YCC_B2Y, YCC_G2Y, YCC_B2Y, YCC_G2Y, YCC_B2Y, YCC_G2Y);
+		const cv::v_int16x8 coeffsR1(
+			YCC_R2Y, 1 << (YCC_SHIFT - 1), YCC_R2Y, 1 << (YCC_SHIFT - 1),
+			YCC_R2Y, 1 << (YCC_SHIFT - 1), YCC_R2Y, 1 << (YCC_SHIFT - 1));
+		const cv::v_int16x8 one = cv::v_setall_s16(1);
+		const cv::v_int32x4 delta = cv::v_setall_s32(YCC_DELTA + (1 << (YCC_SHIFT - 1)));
+
+		// Y = B*B2Y + G*G2Y + R*R2Y + round, as two pairwise dot products
+		cv::v_int16x8 bg0, bg1, r10, r11;
+		cv::v_zip(_b, _g, bg0, bg1);
+		cv::v_zip(_r, one, r10, r11);
+
+		cv::v_int32x4 y0 = cv::v_dotprod(bg0, coeffsBG) + cv::v_dotprod(r10, coeffsR1);
+		cv::v_int32x4 y1 = cv::v_dotprod(bg1, coeffsBG) + cv::v_dotprod(r11, coeffsR1);
+		_y = cv::v_pack(cv::v_shr<YCC_SHIFT>(y0), cv::v_shr<YCC_SHIFT>(y1));
+
+		cv::v_int32x4 cr0, cr1, cb0, cb1;
+		cv::v_mul_expand(_r - _y, cv::v_setall_s16(YCC_CR), cr0, cr1);
+		cv::v_mul_expand(_b - _y, cv::v_setall_s16(YCC_CB), cb0, cb1);
+		_cr = cv::v_pack(cv::v_shr<YCC_SHIFT>(cr0 + delta), cv::v_shr<YCC_SHIFT>(cr1 + delta));
+		_cb = cv::v_pack(cv::v_shr<YCC_SHIFT>(cb0 + delta), cv::v_shr<YCC_SHIFT>(cb1 + delta));
+	}
+#endif
+
+	void rowToYCrCb(const uchar* _bgr, uchar* _dst, int32_t _width) {
+		int32_t x = 0;
+#if CV_SIMD128
+		if (s_useSimd.load(std::memory_order::memory_order_relaxed)) {
+			for (; x <= _width - 16; x += 16) {
+				cv::v_uint8x16 b, g, r;
+				cv::v_load_deinterleave(_bgr + x * 3, b, g, r);
+
+				cv::v_uint16x8 b0, b1, g0, g1, r0, r1;
+				cv::v_expand(b, b0, b1);
+				cv::v_expand(g, g0, g1);
+				cv::v_expand(r, r0, r1);
+
+				cv::v_int16x8 y0, y1, cr0, cr1, cb0, cb1;
+				ycrcb8(cv::v_reinterpret_as_s16(b0), cv::v_reinterpret_as_s16(g0),
+					cv::v_reinterpret_as_s16(r0), y0, cr0, cb0);
+				ycrcb8(cv::v_reinterpret_as_s16(b1), cv::v_reinterpret_as_s16(g1),
+					cv::v_reinterpret_as_s16(r1), y1, cr1, cb1);
+
+				cv::v_store_interleave(_dst + x * 3,
+					cv::v_pack_u(y0, y1), cv::v_pack_u(cr0, cr1), cv::v_pack_u(cb0, cb1));
+			}
+		}
+#endif
+		for (; x < _width; ++x) {
+			const uchar* s = _bgr + x * 3;
+			uchar* d = _dst + x * 3;
+			int32_t y = descale(s[0] * YCC_B2Y + s[1] * YCC_G2Y + s[2] * YCC_R2Y, YCC_SHIFT);
+			d[0] = saturate(y);
+			d[1] = saturate(descale((s[2] - y) * YCC_CR + YCC_DELTA, YCC_SHIFT));
+			d[2] = saturate(descale((s[0] - y) * YCC_CB + YCC_DELTA, YCC_SHIFT));
+		}
+	}
+
+	// Scalar only, as is rowToLab: both look a table up per pixel and
+	// channel, divisions here, gamma and cube roots there. 128-bit SIMD has
+	// no gather, SSE and NEON would load the lanes one by one, and dividing
+	// instead would not round as the tables of cvtColor do.
+	void rowToHSV(const uchar* _bgr, uchar* _dst, int32_t _width) {
+		const auto& tables = hsvTables();
+		const int32_t round = 1 << (HSV_SHIFT - 1);
+
+		for (int32_t x = 0; x < _width; ++x) {
+			const uchar* s = _bgr + x * 3;
+			uchar* d = _dst + x * 3;
+			int32_t b = s[0], g = s[1], r = s[2];
+
+			int32_t v = std::max(std::max(b, g), r);
+			int32_t vmin = std::min(std::min(b, g), r);
+			int32_t diff = v - vmin;
+			int32_t vr = v == r ? -1 : 0;
+			int32_t vg = v == g ? -1 : 0;
+
+			int32_t sat = (diff * tables.sdiv[v] + round) >> HSV_SHIFT;
+			int32_t hue = (vr & (g - b)) + (~vr & ((vg & (b - r + 2 * diff)) + ((~vg) & (r - g + 4 * diff))));
+			hue = (hue * tables.hdiv[diff] + round) >> HSV_SHIFT;
+			hue += hue < 0 ? 180 : 0;
+
+			d[0] = saturate(hue);
+			d[1] = (uchar)sat;
+			d[2] = (uchar)v;
+		}
+	}
+
+	void rowToLab(const uchar* _bgr, uchar* _dst, int32_t _width) {
+		const auto& tables = labTables();
+		const int32_t* c = tables.coeffs;
+		const int32_t lScale = (116 * 255 + 50) / 100;
+		const int32_t lShift = -((16 * 255 * (1 << LAB_SHIFT2) + 50) / 100);
+
+		for (int32_t x = 0; x < _width; ++x) {
+			const uchar* s = _bgr + x * 3;
+			uchar* d = _dst + x * 3;
+			int32_t b = tables.gamma[s[0]], g = tables.gamma[s[1]], r = tables.gamma[s[2]];
+
+			int32_t fX = tables.cbrt[descale(b * c[0] + g * c[1] + r * c[2], LAB_SHIFT)];
+			int32_t fY = tables.cbrt[descale(b * c[3] + g * c[4] + r * c[5], LAB_SHIFT)];
+			int32_t fZ = tables.cbrt[descale(b * c[6] + g * c[7] + r * c[8], LAB_SHIFT)];
+
+			d[0] = saturate(descale(lScale * fY + lShift, LAB_SHIFT2));
+			d[1] = saturate(descale(500 * (fX - fY) + 128 * (1 << LAB_SHIFT2), LAB_SHIFT2));
+			d[2] = saturate(descale(200 * (fY - fZ) + 128 * (1 << LAB_SHIFT2), LAB_SHIFT2));
+		}
+	}
+
+	// Write the three BGRA channel previews out of a color space row
+	void emitChannels(const uchar* _cs, uchar* _c0, uchar* _c1, uchar* _c2, int32_t _width) {
+		int32_t x = 0;
+#if CV_SIMD128
+		if (s_useSimd.load(std::memory_order::memory_order_relaxed)) {
+			const cv::v_uint8x16 alpha = cv::v_setall_u8(255);
+			for (; x <= _width - 16; x += 16) {
+				cv::v_uint8x16 c0, c1, c2;
+				cv::v_load_deinterleave(_cs + x * 3, c0, c1, c2);
+
+				cv::v_store_interleave(_c0 + x * 4, c0, c0, c0, alpha);
+				cv::v_store_interleave(_c1 + x * 4, c1, c1, c1, alpha);
+				cv::v_store_interleave(_c2 + x * 4, c2, c2, c2, alpha);
+			}
+		}
+#endif
+		for (; x < _width; ++x) {
+			const uchar* c = _cs + x * 3;
+			uchar* planes[] = { _c0 + x * 4, _c1 + x * 4, _c2 + x * 4 };
+			for (int32_t i = 0; i < 3; ++i) {
+				planes[i][0] = planes[i][1] = planes[i][2] = c[i];
+				planes[i][3] = 255;
+			}
+		}
+	}
+
+	// Write the three channels of a color space row as coverage, 255 minus
+	// the value, which drawn as A8 over white shows the channel in gray.
+	void emitCoverage(const uchar* _cs, uchar* _c0, uchar* _c1, uchar* _c2, int32_t _width) {
+		int32_t x = 0;
+#if CV_SIMD128
+		if (s_useSimd.load(std::memory_order::memory_order_relaxed)) {
+			for (; x <= _width - 16; x += 16) {
+				cv::v_uint8x16 c0, c1, c2;
+				cv::v_load_deinterleave(_cs + x * 3, c0, c1, c2);
+
+				cv::v_store(_c0 + x, ~c0);
+				cv::v_store(_c1 + x, ~c1);
+				cv::v_store(_c2 + x, ~c2);
+			}
+		}
+#endif
+		for (; x < _width; ++x) {
+			const uchar* c = _cs + x * 3;
+			_c0[x] = uchar(255 - c[0]);
+			_c1[x] = uchar(255 - c[1]);
+			_c2[x] = uchar(255 - c[2]);
+		}
+	}
+
+	// Average _scale x _scale blocks of pixels, starting at row _y, into a
+	// BGR row of _width pixels. _sums holds _width * 3 values.
+	void downscaleRow(const cv::Mat& _image, bool _isRGB, int32_t _y, int32_t _scale,
+		uint32_t* _sums, uchar* _bgr, int32_t _width) {
+		const int32_t channels = _image.channels();
+		const int32_t blue = _isRGB ? 2 : 0;
+		const int32_t red = 2 - blue;
+
+		std::fill(_sums, _sums + _width * 3, 0u);
+		for (int32_t dy = 0; dy < _scale; ++dy) {
+			const uchar* src = _image.ptr(_y + dy);
+			uint32_t* sum = _sums;
+			for (int32_t x = 0; x < _width; ++x, sum += 3) {
+				for (int32_t dx = 0; dx < _scale; ++dx, src += channels) {
+					sum[0] += src[blue];
+					sum[1] += src[1];
+					sum[2] += src[red];
+				}
+			}
+		}
+
+		// Rounded division by the block area, as a fixed-point multiply
+		// which is exact for the sums blocks of up to 16x16 pixels reach.
+		const uint32_t area = uint32_t(_scale * _scale);
+		const uint64_t reciprocal = ((uint64_t(1) << 32) + area - 1) / area;
+		for (int32_t i = 0; i < _width * 3; ++i) {
+			_bgr[i] = uchar(((_sums[i] + area / 2) * reciprocal) >> 32);
+		}
+	}
+
+	typedef void (*RowConversion)(const uchar*, uchar*, int32_t);
+
+	RowConversion getRowConversion(int32_t _colorSpaceCode) {
+		switch (_colorSpaceCode) {
+			case cv::COLOR_BGR2RGB:		return rowToRGB;
+			case cv::COLOR_BGR2YCrCb:	return rowToYCrCb;
+			case cv::COLOR_BGR2HSV:		return rowToHSV;
+			case cv::COLOR_BGR2Lab:		return rowToLab;
+		}
+
+		return nullptr;
+	}
+
+	class PreviewBody : public cv::ParallelLoopBody {
+
+	public:
+
+		PreviewBody(const cv::Mat& _image, bool _isRGB, int32_t _scale, int32_t _colorSpaceCode,
+			RowConversion _conversion, cv::Mat& _colorSpace, cv::Mat (&_channels)[3])
+			: m_image(_image), m_isRGB(_isRGB), m_scale(_scale), m_colorSpaceCode(_colorSpaceCode)
+			, m_conversion(_conversion), m_colorSpace(_colorSpace), m_channels(_channels) {
+
+		}
+
+		void operator()(const cv::Range& _rows) const override {
+			// Rows of the caller's scratch, rather than an allocation per call
+			const int32_t width = m_colorSpace.cols;
+			cv::Mat sumsRow = scratch::get(scratch::PreviewSums, cv::Size(width * 3, 1), CV_32SC1);
+			cv::Mat bgrRow = scratch::get(scratch::PreviewRow, cv::Size(width, 1), CV_8UC3);
+			uint32_t* sums = sumsRow.ptr<uint32_t>();
+			uchar* bgr = bgrRow.ptr();
+
+			for (int32_t y = _rows.start; y < _rows.end; ++y) {
+				uchar* cs = m_colorSpace.ptr(y);
+
+				// The averaged row is still in L1 when converted
+				downscaleRow(m_image, m_isRGB, y * m_scale, m_scale, sums, bgr, width);
+				if (m_conversion) {
+					m_conversion(bgr, cs, width);
+				}
+				else {
+					cv::Mat src(1, width, CV_8UC3, bgr);
+					cv::Mat dst(1, width, CV_8UC3, cs);
+					cv::cvtColor(src, dst, m_colorSpaceCode);
+				}
+
+				if (m_channels[0].type() == CV_8UC1) {
+					emitCoverage(cs, m_channels[0].ptr(y), m_channels[1].ptr(y), m_channels[2].ptr(y), width);
+				}
+				else {
+					emitChannels(cs, m_channels[0].ptr(y), m_channels[1].ptr(y), m_channels[2].ptr(y), width);
+				}
+			}
+		}
+
+	private:
+
+		const cv::Mat&	m_image;
+		bool			m_isRGB;
+		int32_t			m_scale;
+		int32_t			m_colorSpaceCode;
+		RowConversion	m_conversion;
+		cv::Mat&		m_colorSpace;
+		cv::Mat			(&m_channels)[3];
+	};
+}
+
+namespace kernels {
+
+	bool isFusedConversion(int32_t _colorSpaceCode) {
+		return getRowConversion(_colorSpaceCode) != nullptr;
+	}
+
+	void convertSplitPreview(const cv::Mat& _image, bool _isRGB, int32_t _scale, int32_t _colorSpaceCode,
+		bool _useFused, cv::Mat& _colorSpace, cv::Mat (&_channels)[3], int32_t _channelType) {
+		CV_Assert((_image.type() == CV_8UC3 || _image.type() == CV_8UC4) && _scale >= 1 && _scale <= 16);
+		CV_Assert(_channelType == CV_8UC4 || _channelType == CV_8UC1);
+
+		cv::Size size(_image.cols / _scale, _image.rows / _scale);
+		_colorSpace.create(size, CV_8UC3);
+		for (auto& channel : _channels) {
+			channel.create(size, _channelType);
+		}
+
+		auto conversion = _useFused ? getRowConversion(_colorSpaceCode) : nullptr;
+		cv::parallel_for_(cv::Range(0, size.height),
+			PreviewBody(_image, _isRGB, _scale, _colorSpaceCode, conversion, _colorSpace, _channels));
+	}
+
+	uint64_t verifyFusedConversion(const cv::Mat& _bgr, int32_t _colorSpaceCode, int32_t _scale) {
+		CV_Assert(_bgr.type() == CV_8UC3 && isFusedConversion(_colorSpaceCode) && _scale >= 1 && _scale <= 16);
+
+		auto mismatches = [](const cv::Mat& _a, const cv::Mat& _b) {
+			cv::Mat diff;
+			cv::compare(_a, _b, diff, cv::CMP_NE);
+			return (uint64_t)cv::countNonZero(diff.reshape(1));
+		};
+
+		// Layouts of the display image, as converted from the camera frame
+		struct Layout {
+			int32_t	fromBGR;		// Negative for the camera frame as is
+			bool	isRGB;
+		};
+
+		static const Layout layouts[] = {
+			{ -1,					false	},
+			{ cv::COLOR_BGR2RGB,	true	},
+			{ cv::COLOR_BGR2BGRA,	false	},
+			{ cv::COLOR_BGR2RGBA,	true	},
+		};
+
+		// At full scale every color of the image is converted as is, at
+		// _scale the averages of its blocks are
+		uint64_t count = 0;
+		std::vector<int32_t> scales(1, 1);
+		if (_scale > 1) {
+			scales.push_back(_scale);
+		}
+
+		for (int32_t scale : scales) {
+			const cv::Size size(_bgr.cols / scale, _bgr.rows / scale);
+			const cv::Mat bgr = _bgr(cv::Rect(0, 0, size.width * scale, size.height * scale));
+
+			cv::Mat reduced, colorSpace, planes[3], channels[2][3];
+			cv::resize(bgr, reduced, size, 0, 0, cv::INTER_AREA);
+			cv::cvtColor(reduced, colorSpace, _colorSpaceCode);
+			cv::split(colorSpace, planes);
+			for (int32_t c = 0; c < 3; ++c) {
+				cv::cvtColor(planes[c], channels[0][c], cv::COLOR_GRAY2BGRA);
+				cv::bitwise_not(planes[c], channels[1][c]);
+			}
+
+			for (const auto& layout : layouts) {
+				cv::Mat display = bgr;
+				if (layout.fromBGR >= 0) {
+					cv::cvtColor(bgr, display, layout.fromBGR);
+				}
+
+				for (int32_t type = 0; type < 2; ++type) {
+					cv::Mat fusedColorSpace, fusedChannels[3];
+					convertSplitPreview(display, layout.isRGB, scale, _colorSpaceCode, true,
+						fusedColorSpace, fusedChannels, type == 0 ? CV_8UC4 : CV_8UC1);
+
+					count += mismatches(fusedColorSpace, colorSpace);
+					for (int32_t c = 0; c < 3; ++c) {
+						count += mismatches(fusedChannels[c], channels[type][c]);
+					}
+				}
+			}
+		}
+
+		return count;
+	}
+
+	cv::Mat makeColorSweep(int32_t _redStep) {
+		_redStep = std::max(1, std::min(_redStep, 256));
+		int32_t reds = (256 + _redStep - 1) / _redStep;
+
+		cv::Mat sweep(256 * reds, 256, CV_8UC3);
+		for (int32_t y = 0; y < sweep.rows; ++y) {
+			uchar* p = sweep.ptr(y);
+			uchar g = uchar(y & 0xff);
+			uchar r = uchar((y >> 8) * _redStep);
+			for (int32_t b = 0; b < 256; ++b) {
+				p[b * 3 + 0] = uchar(b);
+				p[b * 3 + 1] = g;
+				p[b * 3 + 2] = r;
+			}
+		}
+
+		return sweep;
+	}
+
+	void setUseSimd(bool _onOff) {
+		s_useSimd.store(_onOff, std::memory_order::memory_order_relaxed);
+	}
+
+	bool useSimd() {
+#if CV_SIMD128
+		return s_useSimd.load(std::memory_order::memory_order_relaxed);
+#else
+		return false;
+#endif
+	}
+}
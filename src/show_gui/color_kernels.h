@@ -0,0 +1,49 @@
+#ifndef COLOR_KERNELS_H_HEADER_GUARD
+#define COLOR_KERNELS_H_HEADER_GUARD
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+
+namespace kernels {
+
+	// Whether the fused kernel implements the given cv::COLOR_BGR2* code.
+	// Supported are BGR2RGB, BGR2HSV, BGR2YCrCb and BGR2Lab.
+	bool isFusedConversion(int32_t _colorSpaceCode);
+
+	// Reduce the display image, BGR(A) or RGB(A) if _isRGB, by an integer
+	// _scale, averaging blocks of _scale x _scale pixels, and write in the
+	// same sweep the reduced frame in the requested color space and its
+	// channels. Partial blocks on the right and bottom edges are left out.
+	// The color space conversion is the fused one if _useFused, cvtColor's
+	// otherwise. Channels are either expanded to gray BGRA with CV_8UC4, or
+	// written as coverage, 255 minus the value, with CV_8UC1.
+	//
+	// The display image is not written by this sweep: cvtColor converts it
+	// from the camera frame in the convert stage. Previews are computed in a
+	// later stage, once the camera frame is back in the ring, and again out
+	// of the display image alone whenever only the color space changes. The
+	// sweep reads the display image once more, and writes 1/_scale^2 of it.
+	void convertSplitPreview(const cv::Mat& _image, bool _isRGB, int32_t _scale, int32_t _colorSpaceCode,
+		bool _useFused, cv::Mat& _colorSpace, cv::Mat (&_channels)[3], int32_t _channelType);
+
+	// Run the fused convertSplitPreview on the given BGR image in every
+	// display layout, BGR, RGB, BGRA and RGBA, into both channel types, at
+	// full scale and at _scale. Return the number of output bytes which
+	// differ from OpenCV's own sequence: cv::resize with INTER_AREA, then
+	// cvtColor, split, and GRAY2BGRA or bitwise_not for each channel.
+	// INTER_AREA rounds block averages as the kernel does where _scale is
+	// 2 or odd.
+	uint64_t verifyFusedConversion(const cv::Mat& _bgr, int32_t _colorSpaceCode, int32_t _scale);
+
+	// BGR image holding every blue and green value, for each red value
+	// in steps of _redStep. A step of 1 enumerates all 2^24 colors.
+	cv::Mat makeColorSweep(int32_t _redStep);
+
+	// Enable or disable the SIMD code paths, mostly for comparison
+	// against the scalar fallback. Enabled by default where available.
+	void setUseSimd(bool _onOff);
+	bool useSimd();
+}
+
+#endif // COLOR_KERNELS_H_HEADER_GUARD
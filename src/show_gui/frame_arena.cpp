@@ -0,0 +1,206 @@
+#include "frame_arena.h"
+#include "memory_profiler.h"
+
+#include <bx/bx.h>
+
+#include <new>
+
+#if BX_PLATFORM_LINUX
+#	include <sys/mman.h>
+#endif
+
+namespace {
+
+	const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+	// Steps of a matrix with tightly packed rows, as OpenCV's standard
+	// allocator lays them out. Returns the number of bytes it takes.
+	size_t computeSteps(int _dims, const int* _sizes, size_t _elemSize, size_t* _step) {
+		size_t total = _elemSize;
+		for (int i = _dims - 1; i >= 0; --i) {
+			if (_step) {
+				_step[i] = total;
+			}
+
+			total *= _sizes[i];
+		}
+
+		return total;
+	}
+}
+
+cv::Mat FrameArena::create(int32_t _rows, int32_t _cols, int32_t _type) {
+	cv::Mat mat;
+	bind(mat);
+	mat.create(_rows, _cols, _type);
+	return mat;
+}
+
+bool FrameArena::reset() {
+	if (m_live.load(std::memory_order::memory_order_acquire) != 0) {
+		return false;
+	}
+
+	// Grow once to what the frames have needed, rather than by steps
+	if (m_demand > m_capacity) {
+		reserve(m_demand);
+	}
+
+	m_used = 0;
+	m_demand = 0;
+	return true;
+}
+
+FrameArena::Stats FrameArena::getStats() const {
+	return {
+		m_allocations.load(std::memory_order::memory_order_relaxed),
+		m_overflows.load(std::memory_order::memory_order_relaxed),
+		m_reserved.load(std::memory_order::memory_order_relaxed)
+	};
+}
+
+cv::UMatData* FrameArena::allocate(int _dims, const int* _sizes, int _type,
+	void* _data, size_t* _step, int _flags, cv::UMatUsageFlags _usageFlags) const {
+	auto* heap = cv::Mat::getStdAllocator();
+	if (_data) {
+		// User data only needs a header, which the heap provides
+		return heap->allocate(_dims, _sizes, _type, _data, _step, _flags, _usageFlags);
+	}
+
+	// The header goes in front of the data, both on their own cache lines
+	const size_t total = computeSteps(_dims, _sizes, CV_ELEM_SIZE(_type), _step);
+	const size_t header = cv::alignSize(sizeof(cv::UMatData), int(ALIGNMENT));
+	const size_t size = header + cv::alignSize(total, int(ALIGNMENT));
+
+	m_demand += size;
+	if (m_used + size > m_capacity) {
+		m_overflows.fetch_add(1, std::memory_order::memory_order_relaxed);
+		memprof::countAllocation(total);
+		return heap->allocate(_dims, _sizes, _type, nullptr, _step, _flags, _usageFlags);
+	}
+
+	uint8_t* block = m_block + m_used;
+	m_used += size;
+
+	auto* u = new (block) cv::UMatData(this);
+	u->data = u->origdata = block + header;
+	u->size = total;
+
+	m_live.fetch_add(1, std::memory_order::memory_order_relaxed);
+	m_allocations.fetch_add(1, std::memory_order::memory_order_relaxed);
+	return u;
+}
+
+bool FrameArena::allocate(cv::UMatData* _data, int /*_accessFlags*/, cv::UMatUsageFlags /*_usageFlags*/) const {
+	return _data != nullptr;
+}
+
+void FrameArena::deallocate(cv::UMatData* _data) const {
+	if (!_data) {
+		return;
+	}
+
+	CV_Assert(_data->urefcount == 0 && _data->refcount == 0);
+
+	// The memory itself is only given back by reset()
+	_data->~UMatData();
+	m_live.fetch_sub(1, std::memory_order::memory_order_release);
+}
+
+FrameArena::FrameArena()
+	: m_block(nullptr)
+	, m_capacity(0)
+	, m_isMapped(false)
+	, m_useHugePages(false)
+	, m_used(0)
+	, m_demand(0)
+	, m_live(0)
+	, m_allocations(0)
+	, m_overflows(0)
+	, m_reserved(0) {
+
+}
+
+FrameArena::~FrameArena() {
+	// Matrices still alive would point into the block
+	CV_DbgAssert(m_live.load(std::memory_order::memory_order_acquire) == 0);
+	releaseBlock();
+}
+
+void FrameArena::reserve(size_t _size) {
+	releaseBlock();
+
+#if BX_PLATFORM_LINUX
+	if (m_useHugePages) {
+		// Reserved huge pages if the system has any, transparent ones otherwise
+		size_t size = cv::alignSize(_size, int(HUGE_PAGE_SIZE));
+		void* block = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (block == MAP_FAILED) {
+			block = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (block != MAP_FAILED) {
+				madvise(block, size, MADV_HUGEPAGE);
+			}
+		}
+
+		if (block != MAP_FAILED) {
+			m_block = static_cast<uint8_t*>(block);
+			m_capacity = size;
+			m_isMapped = true;
+			m_reserved.store(m_capacity, std::memory_order::memory_order_relaxed);
+			return;
+		}
+	}
+#endif
+
+	// Aligned by hand, the allocation start is kept just before the block
+	size_t size = cv::alignSize(_size, int(ALIGNMENT));
+	auto* memory = static_cast<uint8_t*>(cv::fastMalloc(size + 2 * ALIGNMENT));
+	m_block = cv::alignPtr(memory + ALIGNMENT, int(ALIGNMENT));
+	reinterpret_cast<uint8_t**>(m_block)[-1] = memory;
+	m_capacity = size;
+	m_isMapped = false;
+	m_reserved.store(m_capacity, std::memory_order::memory_order_relaxed);
+}
+
+void FrameArena::releaseBlock() {
+	if (!m_block) {
+		return;
+	}
+
+#if BX_PLATFORM_LINUX
+	if (m_isMapped) {
+		munmap(m_block, m_capacity);
+	}
+	else
+#endif
+	{
+		cv::fastFree(reinterpret_cast<uint8_t**>(m_block)[-1]);
+	}
+
+	m_block = nullptr;
+	m_capacity = 0;
+	m_reserved.store(0, std::memory_order::memory_order_relaxed);
+}
+
+cv::UMatData* CountingMatAllocator::allocate(int _dims, const int* _sizes, int _type,
+	void* _data, size_t* _step, int _flags, cv::UMatUsageFlags _usageFlags) const {
+	auto* u = cv::Mat::getStdAllocator()->allocate(_dims, _sizes, _type, _data, _step, _flags, _usageFlags);
+	if (u && !_data) {
+		m_allocations.fetch_add(1, std::memory_order::memory_order_relaxed);
+		m_bytes.fetch_add(u->size, std::memory_order::memory_order_relaxed);
+		memprof::countAllocation(u->size);
+	}
+
+	// Owned by the standard allocator from now on, which releases it
+	return u;
+}
+
+bool CountingMatAllocator::allocate(cv::UMatData* _data, int _accessFlags, cv::UMatUsageFlags _usageFlags) const {
+	return cv::Mat::getStdAllocator()->allocate(_data, _accessFlags, _usageFlags);
+}
+
+void CountingMatAllocator::deallocate(cv::UMatData* _data) const {
+	cv::Mat::getStdAllocator()->deallocate(_data);
+}
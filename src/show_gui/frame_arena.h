@@ -0,0 +1,112 @@
+#ifndef FRAME_ARENA_H_HEADER_GUARD
+#define FRAME_ARENA_H_HEADER_GUARD
+
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bump allocator for the temporaries of a frame, as a cv::MatAllocator.
+//
+// Matrices bound to the arena are carved out of a single block, aligned on
+// cache lines, and are all forgotten at once by reset() when the frame is
+// done with. Allocations which do not fit fall back to the heap, and the
+// block grows to the peak demand at the next reset, so that the steady
+// state does not allocate at all.
+//
+// An arena belongs to one thread at a time: whoever holds the frame it is
+// scoped to. Only the statistics may be read from other threads.
+class FrameArena : public cv::MatAllocator {
+
+public:
+
+	static const size_t ALIGNMENT = 64;
+
+	struct Stats {
+		uint64_t	allocations;	// Served by the arena
+		uint64_t	overflows;		// Which fell back to the heap
+		size_t		reserved;		// Bytes of the block
+	};
+
+	// Back the block with huge pages where the system provides them,
+	// from the next time it is (re)allocated.
+	void setHugePages(bool _useHugePages) {
+		m_useHugePages = _useHugePages;
+	}
+
+	// Make _mat allocate out of the arena next time it is created
+	void bind(cv::Mat& _mat) {
+		_mat.allocator = this;
+	}
+
+	// Matrix allocated out of the arena
+	cv::Mat create(int32_t _rows, int32_t _cols, int32_t _type);
+
+	// Forget every allocation, growing the block if it has overflowed.
+	// Returns false, and keeps the allocations, while any matrix allocated
+	// out of the arena is still alive.
+	bool reset();
+
+	Stats getStats() const;
+
+	cv::UMatData* allocate(int _dims, const int* _sizes, int _type,
+		void* _data, size_t* _step, int _flags, cv::UMatUsageFlags _usageFlags) const override;
+	bool allocate(cv::UMatData* _data, int _accessFlags, cv::UMatUsageFlags _usageFlags) const override;
+	void deallocate(cv::UMatData* _data) const override;
+
+	FrameArena();
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+	~FrameArena();
+
+private:
+
+	void reserve(size_t _size);
+	void releaseBlock();
+
+	uint8_t*						m_block;
+	size_t							m_capacity;
+	bool							m_isMapped;		// mmap'ed rather than malloc'ed
+	bool							m_useHugePages;
+
+	mutable size_t					m_used;
+	mutable size_t					m_demand;		// Since the last reset, overflows included
+	mutable std::atomic<int32_t>	m_live;
+
+	mutable std::atomic<uint64_t>	m_allocations;
+	mutable std::atomic<uint64_t>	m_overflows;
+	std::atomic<size_t>				m_reserved;
+};
+
+// OpenCV's standard allocator, counting what it allocates. Installed as
+// the default allocator, it tells how many matrices still come from the
+// heap rather than from an arena or a pool.
+class CountingMatAllocator : public cv::MatAllocator {
+
+public:
+
+	uint64_t getAllocations() const {
+		return m_allocations.load(std::memory_order::memory_order_relaxed);
+	}
+
+	uint64_t getBytes() const {
+		return m_bytes.load(std::memory_order::memory_order_relaxed);
+	}
+
+	cv::UMatData* allocate(int _dims, const int* _sizes, int _type,
+		void* _data, size_t* _step, int _flags, cv::UMatUsageFlags _usageFlags) const override;
+	bool allocate(cv::UMatData* _data, int _accessFlags, cv::UMatUsageFlags _usageFlags) const override;
+	void deallocate(cv::UMatData* _data) const override;
+
+	CountingMatAllocator() : m_allocations(0), m_bytes(0) {
+
+	}
+
+private:
+
+	mutable std::atomic<uint64_t>	m_allocations;
+	mutable std::atomic<uint64_t>	m_bytes;
+};
+
+#endif // FRAME_ARENA_H_HEADER_GUARD
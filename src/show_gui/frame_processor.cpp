@@ -0,0 +1,870 @@
+#include "frame_processor.h"
+#include "color_kernels.h"
+#include "trace.h"
+#include "memory_profiler.h"
+#include "thread_scratch.h"
+
+#include <opencv2/core/ocl.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+bool FrameProcessor::init(FrameProvider* _frameProvider, ColorClassifier* _classifier,
+	StageProfiler* _profiler, bool _isMultiThreaded,
+	int32_t _tileThreshold,
+	const DisplayFormat& _displayFormat,
+	int32_t _atlasType,
+	bool _useHugePages,
+	bool _tryOpenCL) {
+	m_frameProvider = _frameProvider;
+	m_classifier = _classifier;
+	m_profiler = _profiler;
+
+	// Verified by the first processor, rather than on its first frame
+	getFusedCodes();
+
+	m_detector.setThreshold(_tileThreshold);
+	m_displayFormat = _displayFormat;
+	m_atlasType = _atlasType;
+	m_convertCarry.valid = false;
+	m_maskCarry.valid = false;
+	m_previewCarry.valid = false;
+
+	m_settings = { cv::COLOR_BGR2RGB, false, 0 };
+	m_displayedFrame = nullptr;
+	m_lastSequence = 0;
+	m_lastSettings = m_settings;
+	m_lastResultId = 0;
+	m_closing.store(false, std::memory_order::memory_order_relaxed);
+
+	for (auto& frame : m_frames) {
+		frame.arena.setHugePages(_useHugePages);
+		m_freeFrames.push(&frame);
+	}
+
+	// Whichever path processes a frame of the source faster
+	m_pathTimes = benchmarkPaths(m_frameProvider->getCameraInfo().frameSize, _tryOpenCL);
+	m_useOpenCL = m_pathTimes.openCL >= 0 && m_pathTimes.openCL < m_pathTimes.cpu;
+
+	m_isMultiThreaded = _isMultiThreaded;
+	if (m_isMultiThreaded && m_useOpenCL) {
+		m_workers.emplace_back([this] {
+			trace::setThreadName("pipeline capture");
+			runCapture();
+		});
+
+		m_workers.emplace_back([this] {
+			trace::setThreadName("pipeline opencl");
+			runStage(m_convertQueue, m_readyQueue, &FrameProcessor::processOpenCL);
+		});
+	}
+	else if (m_isMultiThreaded && m_bandPool) {
+		m_workers.emplace_back([this] {
+			trace::setThreadName("pipeline capture");
+			runCapture();
+		});
+
+		m_workers.emplace_back([this] {
+			trace::setThreadName("pipeline bands");
+			runStage(m_convertQueue, m_readyQueue, &FrameProcessor::processBlocks);
+		});
+	}
+	else if (m_isMultiThreaded) {
+		m_workers.emplace_back([this] {
+			trace::setThreadName("pipeline capture");
+			runCapture();
+		});
+
+		m_workers.emplace_back([this] {
+			trace::setThreadName("pipeline convert");
+			runStage(m_convertQueue, m_maskQueue, &FrameProcessor::convert);
+		});
+
+		m_workers.emplace_back([this] {
+			trace::setThreadName("pipeline mask");
+			runStage(m_maskQueue, m_uploadQueue, &FrameProcessor::mask);
+		});
+
+		m_workers.emplace_back([this] {
+			trace::setThreadName("pipeline preview");
+			runStage(m_uploadQueue, m_readyQueue, &FrameProcessor::prepareUpload);
+		});
+	}
+
+	return true;
+}
+
+void FrameProcessor::setBandPool(TaskPool* _pool, bool _isTiled) {
+	m_bandPool = _pool;
+	m_bandCacheSize = TaskPool::getL2CacheSize();
+	m_isTiled = _isTiled;
+}
+
+void FrameProcessor::schedule(FrameScheduler* _scheduler, int32_t _budgetFPS, DropPolicy _dropPolicy) {
+	m_scheduler = _scheduler;
+	m_budgetPeriod = _budgetFPS > 0 ? 1000000000 / _budgetFPS : 0;
+	m_dropPolicy = _dropPolicy;
+	m_nextRun = 0;
+	m_job = m_scheduler->add([this](int64_t _now) {
+		return this->runScheduled(_now);
+	});
+
+	m_frameProvider->setFrameCallback([this] {
+		m_scheduler->wake(m_job);
+	});
+}
+
+void FrameProcessor::shutdown() {
+	m_closing.store(true, std::memory_order::memory_order_relaxed);
+	m_freeFrames.close();
+	m_convertQueue.close();
+	m_maskQueue.close();
+	m_uploadQueue.close();
+	m_readyQueue.close();
+
+	for (auto& worker : m_workers) {
+		worker.join();
+	}
+
+	m_workers.clear();
+
+	// Unpin any camera frame still held, before the ring goes away,
+	// and give the upload buffers back to the pool.
+	m_convertCarry.reset();
+	m_maskCarry.reset();
+	m_previewCarry.reset();
+	for (auto& frame : m_frames) {
+		frame.source = FrameRing::View();
+		frame.imageUpload.reset();
+		frame.displayUpload.reset();
+		frame.atlasUpload.reset();
+	}
+}
+
+void FrameProcessor::setSettings(const FrameSettings& _settings) {
+	{
+		std::lock_guard<std::mutex> lock(m_settingsMutex);
+		if (m_settings == _settings) {
+			return;
+		}
+
+		m_settings = _settings;
+	}
+
+	if (m_scheduler) {
+		m_scheduler->wake(m_job);
+	}
+	else if (m_isMultiThreaded) {
+		m_frameProvider->interruptWait();
+	}
+}
+
+const ProcessedFrame* FrameProcessor::getProcessedFrame() {
+	if (m_isMultiThreaded || m_scheduler) {
+		// Skip to the newest ready frame, recycling the stale ones
+		ProcessedFrame* frame = nullptr;
+		while (m_readyQueue.tryPop(frame)) {
+			if (m_displayedFrame) {
+				m_freeFrames.push(m_displayedFrame);
+			}
+
+			m_displayedFrame = frame;
+		}
+	}
+	else {
+		ProcessedFrame* frame = nullptr;
+		m_freeFrames.tryPop(frame);
+		if (frame && capture(*frame)) {
+			process(*frame);
+
+			if (m_displayedFrame) {
+				m_freeFrames.push(m_displayedFrame);
+			}
+
+			m_displayedFrame = frame;
+		}
+		else if (frame) {
+			m_freeFrames.push(frame);
+		}
+	}
+
+	return m_displayedFrame;
+}
+
+FrameArena::Stats FrameProcessor::getArenaStats() const {
+	FrameArena::Stats total = { 0, 0, 0 };
+	for (const auto& frame : m_frames) {
+		auto stats = frame.arena.getStats();
+		total.allocations += stats.allocations;
+		total.overflows += stats.overflows;
+		total.reserved += stats.reserved;
+	}
+
+	return total;
+}
+
+FrameProcessor::FrameProcessor()
+	: m_freeFrames(NUM_OF_POOLED_FRAMES)
+	, m_convertQueue(1)
+	, m_maskQueue(1)
+	, m_uploadQueue(1)
+	, m_readyQueue(1)
+	, m_frameProvider(nullptr)
+	, m_classifier(nullptr)
+	, m_profiler(nullptr)
+	, m_displayedFrame(nullptr)
+	, m_lastSequence(0)
+	, m_lastResultId(0)
+	, m_closing(false)
+	, m_scheduler(nullptr)
+	, m_job(-1)
+	, m_budgetPeriod(0)
+	, m_nextRun(0)
+	, m_dropPolicy(DropPolicy::Latest)
+	, m_droppedFrames(0)
+	, m_processedFrames(0)
+	, m_maskTableVersion(0)
+	, m_maskCarried(false)
+	, m_previewCarried(false)
+	, m_bandPool(nullptr)
+	, m_bandCacheSize(0)
+	, m_isTiled(false)
+	, m_atlasType(CV_8UC4)
+	, m_pathTimes({ -1, -1 })
+	, m_useOpenCL(false)
+	, m_isMultiThreaded(false) {
+
+}
+
+bool FrameProcessor::capture(ProcessedFrame& _frame) {
+	{
+		std::lock_guard<std::mutex> lock(m_settingsMutex);
+		_frame.settings = m_settings;
+	}
+
+	_frame.source = m_frameProvider->getCameraFrame(getCameraOffset());
+	if (_frame.source.empty()
+		|| (_frame.source.sequence() == m_lastSequence && _frame.settings == m_lastSettings)) {
+		_frame.source = FrameRing::View();
+		return false;
+	}
+
+	if (m_lastSequence > 0 && _frame.source.sequence() > m_lastSequence + 1) {
+		m_droppedFrames.fetch_add(uint64_t(_frame.source.sequence() - m_lastSequence - 1),
+			std::memory_order::memory_order_relaxed);
+	}
+
+	m_processedFrames.fetch_add(1, std::memory_order::memory_order_relaxed);
+
+	// The temporaries of the previous use of the frame go back to its arena
+	_frame.labels.release();
+	_frame.colorSpacePreview.release();
+	_frame.arena.reset();
+
+	m_lastSequence = _frame.source.sequence();
+	m_lastSettings = _frame.settings;
+	_frame.resultId = ++m_lastResultId;
+	_frame.sequence = _frame.source.sequence();
+	_frame.captureTime = _frame.source.timestamp();
+	_frame.sourceType = _frame.source.image().type();
+	return true;
+}
+
+void FrameProcessor::process(ProcessedFrame& _frame) {
+	if (m_useOpenCL) {
+		processOpenCL(_frame);
+	}
+	else if (m_bandPool) {
+		processBlocks(_frame);
+	}
+	else {
+		convert(_frame);
+		mask(_frame);
+		prepareUpload(_frame);
+	}
+}
+
+void FrameProcessor::convert(ProcessedFrame& _frame) {
+	cv::Mat bgr = beginConvert(_frame);
+	if (!m_convertRects.empty()) {
+		ScopedStageTimer timer(m_profiler, Stage::Convert, _frame.sequence);
+		convertBlock(_frame, bgr, cv::Rect(cv::Point(), bgr.size()));
+	}
+
+	endConvert(_frame, bgr);
+}
+
+void FrameProcessor::mask(ProcessedFrame& _frame) {
+	if (beginMask(_frame)) {
+		ScopedStageTimer timer(m_profiler, Stage::Mask, _frame.sequence);
+		maskBlock(_frame, cv::Rect(cv::Point(), _frame.image.size()));
+	}
+
+	endMask(_frame);
+}
+
+void FrameProcessor::prepareUpload(ProcessedFrame& _frame) {
+	if (beginPreview(_frame)) {
+		ScopedStageTimer timer(m_profiler, Stage::Preview, _frame.sequence);
+		previewBlock(_frame, cv::Rect(cv::Point(), _frame.image.size()));
+	}
+
+	endPreview(_frame);
+}
+
+void FrameProcessor::processBlocks(ProcessedFrame& _frame) {
+	cv::Mat bgr = beginConvert(_frame);
+	const bool masks = beginMask(_frame);
+	const bool previews = beginPreview(_frame);
+
+	if (!m_convertRects.empty() || masks || previews) {
+		ScopedStageTimer timer(m_profiler, Stage::Bands, _frame.sequence);
+		getBlocks(_frame.image.size(), m_blocks);
+		m_bandPool->parallelFor(int32_t(m_blocks.size()), [&](int32_t _block) {
+			// Copies and allocations of the workers are the stage's too
+			auto previousStage = StageProfiler::enterStage(Stage::Bands);
+			const cv::Rect& block = m_blocks[_block];
+			convertBlock(_frame, bgr, block);
+			if (masks) {
+				maskBlock(_frame, block);
+			}
+
+			if (previews) {
+				previewBlock(_frame, block);
+			}
+
+			StageProfiler::leaveStage(previousStage);
+		});
+	}
+
+	endConvert(_frame, bgr);
+	endMask(_frame);
+	endPreview(_frame);
+}
+
+void FrameProcessor::processOpenCL(ProcessedFrame& _frame) {
+	cv::Mat bgr = beginConvert(_frame);
+	const bool converts = !m_convertRects.empty();
+	const bool masks = beginMask(_frame);
+	const bool previews = beginPreview(_frame);
+
+	if (converts || masks || previews) {
+		ScopedStageTimer timer(m_profiler, Stage::OpenCL, _frame.sequence);
+		m_umatPipeline.process(bgr, m_displayFormat.fromBGR, _frame.settings.colorSpaceCode,
+			m_maskTable.get(), PREVIEW_SCALE,
+			converts ? &_frame.image : nullptr,
+			masks ? &_frame.display : nullptr,
+			previews ? &_frame.channelsAtlas : nullptr);
+	}
+
+	endConvert(_frame, bgr);
+	endMask(_frame);
+	endPreview(_frame);
+}
+
+cv::Mat FrameProcessor::beginConvert(ProcessedFrame& _frame) {
+	// Make sure we are in the right format, convertTo would
+	// deep copy the frame even when no conversion is needed.
+	cv::Mat bgr = _frame.source.image();
+	if (_frame.sourceType != CV_8UC3) {
+		cv::Mat converted;
+		_frame.arena.bind(converted);
+		_frame.source.image().convertTo(converted, CV_8UC3);
+		bgr = converted;
+	}
+
+	// The image does not depend on the settings, tiles can be carried over
+	// from the previous frame as long as it has the same size.
+	bool carry = m_convertCarry.valid && m_convertCarry.size == bgr.size();
+
+	{
+		ScopedStageTimer timer(m_profiler, Stage::Detect, _frame.sequence);
+		TaskPool* pool = m_bandPool && m_bandPool->getNumberOfWorkers() > 0 ? m_bandPool : nullptr;
+		_frame.numOfChangedTiles = m_detector.detect(bgr, !carry, _frame.changedTiles, pool);
+	}
+
+	_frame.tileGrid = m_detector.getGrid();
+	const auto& grid = _frame.tileGrid;
+
+	m_convertRects.clear();
+	m_convertCopyRects.clear();
+	if (_frame.numOfChangedTiles == 0) {
+		// Nothing to convert, the previous image is still current
+		shareUpload(m_convertCarry.uploads[0], _frame.imageUpload, _frame.image, m_displayFormat.type);
+	}
+	else {
+		// The image is uploaded, used for picking, masking and the previews
+		bindUpload(_frame.imageUpload, _frame.image, bgr.size(), m_displayFormat.type);
+
+		if (_frame.numOfChangedTiles != grid.getNumberOfTiles()) {
+			m_convertPrevious = m_convertCarry.uploads[0]->asMat(m_displayFormat.type);
+			grid.getRects(_frame.changedTiles, false, m_convertCopyRects);
+		}
+
+		grid.getRects(_frame.changedTiles, true, m_convertRects);
+	}
+
+	return bgr;
+}
+
+void FrameProcessor::convertBlock(ProcessedFrame& _frame, const cv::Mat& _bgr, const cv::Rect& _block) {
+	copyRects(m_convertCopyRects, _block, m_convertPrevious, _frame.image);
+	for (const auto& rect : m_convertRects) {
+		cv::Rect clipped = rect & _block;
+		if (!clipped.empty()) {
+			cv::Mat image = _frame.image(clipped);
+			cv::cvtColor(_bgr(clipped), image, m_displayFormat.fromBGR);
+		}
+	}
+}
+
+void FrameProcessor::endConvert(ProcessedFrame& _frame, cv::Mat& _bgr) {
+	m_convertCarry.valid = true;
+	m_convertCarry.size = _bgr.size();
+	m_convertCarry.uploads[0] = _frame.imageUpload;
+	m_convertPrevious.release();
+
+	// Done with the camera frame, let the ring have it back
+	_bgr.release();
+	_frame.source = FrameRing::View();
+}
+
+bool FrameProcessor::beginMask(ProcessedFrame& _frame) {
+	// Hold on to the table, the classifier may publish a new one meanwhile
+	m_maskTable.reset();
+	if (_frame.settings.applyMask) {
+		m_maskTable = m_classifier->getTable();
+	}
+
+	// Masked tiles can only be carried over from a frame masked with the
+	// same table, which is not necessarily the one its settings named.
+	m_maskTableVersion = m_maskTable ? m_maskTable->version : 0;
+	m_maskCarried = m_maskCarry.valid
+		&& m_maskCarry.applyMask == _frame.settings.applyMask
+		&& m_maskCarry.tableVersion == m_maskTableVersion
+		&& m_maskCarry.size == _frame.image.size();
+
+	if (!_frame.settings.applyMask) {
+		_frame.display = _frame.image;
+		_frame.displayUpload = _frame.imageUpload;
+		return false;
+	}
+
+	if (m_maskCarried && _frame.numOfChangedTiles == 0) {
+		shareUpload(m_maskCarry.uploads[0], _frame.displayUpload, _frame.display, m_displayFormat.type);
+		return false;
+	}
+
+	// Label the pixels with a lookup each, whatever the color spaces the
+	// classes have been picked in, and mask the original camera frame. The
+	// destination gets its own buffer, the image is used for picking.
+	bindUpload(_frame.displayUpload, _frame.display, _frame.image.size(), m_displayFormat.type);
+	if (!m_isTiled && !m_useOpenCL) {
+		_frame.arena.bind(_frame.labels);
+		_frame.labels.create(_frame.image.size(), CV_32SC1);
+	}
+
+	const auto& grid = _frame.tileGrid;
+	m_maskCopyRects.clear();
+	if (m_maskCarried) {
+		if (_frame.numOfChangedTiles != grid.getNumberOfTiles()) {
+			m_maskPrevious = m_maskCarry.uploads[0]->asMat(m_displayFormat.type);
+			grid.getRects(_frame.changedTiles, false, m_maskCopyRects);
+		}
+
+		grid.getRects(_frame.changedTiles, true, m_maskRects);
+	}
+	else {
+		m_maskRects.assign(1, cv::Rect(cv::Point(), _frame.image.size()));
+	}
+
+	return true;
+}
+
+void FrameProcessor::maskBlock(ProcessedFrame& _frame, const cv::Rect& _block) {
+	copyRects(m_maskCopyRects, _block, m_maskPrevious, _frame.display);
+	for (const auto& rect : m_maskRects) {
+		cv::Rect clipped = rect & _block;
+		if (clipped.empty()) {
+			continue;
+		}
+
+		// Tiled, labels only live as long as the block needs them
+		cv::Mat labels = m_isTiled
+			? scratch::get(scratch::Labels, clipped.size(), CV_32SC1)
+			: _frame.labels(clipped);
+		cv::Mat display = _frame.display(clipped);
+		ColorClassifier::classify(*m_maskTable, _frame.image(clipped), m_displayFormat.isRGB, labels, display);
+	}
+}
+
+void FrameProcessor::endMask(ProcessedFrame& _frame) {
+	stampTiles(_frame, m_maskCarried, m_maskCarry.tiles, _frame.displayTiles);
+
+	m_maskCarry.valid = true;
+	m_maskCarry.applyMask = _frame.settings.applyMask;
+	m_maskCarry.tableVersion = m_maskTableVersion;
+	m_maskCarry.size = _frame.image.size();
+	m_maskCarry.uploads[0] = _frame.displayUpload;
+	m_maskCarry.tiles = _frame.displayTiles;
+	m_maskTable.reset();
+	m_maskPrevious.release();
+}
+
+bool FrameProcessor::beginPreview(ProcessedFrame& _frame) {
+	m_previewCarried = m_previewCarry.valid
+		&& m_previewCarry.colorSpaceCode == _frame.settings.colorSpaceCode
+		&& m_previewCarry.size == _frame.image.size();
+
+	const auto& grid = _frame.tileGrid;
+	cv::Size previewSize(_frame.image.cols / PREVIEW_SCALE, _frame.image.rows / PREVIEW_SCALE);
+	cv::Size atlasSize(previewSize.width * NUM_OF_PREVIEWS, previewSize.height);
+
+	if (m_previewCarried && _frame.numOfChangedTiles == 0) {
+		shareUpload(m_previewCarry.uploads[0], _frame.atlasUpload, _frame.channelsAtlas, m_atlasType);
+		setPreviews(_frame.channelsAtlas, previewSize, _frame.channelPreviews);
+		return false;
+	}
+
+	bindUpload(_frame.atlasUpload, _frame.channelsAtlas, atlasSize, m_atlasType);
+	setPreviews(_frame.channelsAtlas, previewSize, _frame.channelPreviews);
+	if (!m_isTiled && !m_useOpenCL) {
+		_frame.arena.bind(_frame.colorSpacePreview);
+		_frame.colorSpacePreview.create(previewSize);
+	}
+
+	m_previewCopyRects.clear();
+	if (m_previewCarried && _frame.numOfChangedTiles != grid.getNumberOfTiles()) {
+		setPreviews(m_previewCarry.uploads[0]->asMat(m_atlasType), previewSize, m_previewPrevious);
+		grid.getRects(_frame.changedTiles, false, m_previewCopyRects, PREVIEW_SCALE);
+	}
+
+	if (m_previewCarried) {
+		grid.getRects(_frame.changedTiles, true, m_previewRects, PREVIEW_SCALE);
+	}
+	else {
+		m_previewRects.assign(1, cv::Rect(cv::Point(), previewSize));
+	}
+
+	_frame.isFused = isFused(_frame.settings.colorSpaceCode);
+	return true;
+}
+
+void FrameProcessor::previewBlock(ProcessedFrame& _frame, const cv::Rect& _block) {
+	const cv::Rect block(_block.x / PREVIEW_SCALE, _block.y / PREVIEW_SCALE,
+		(_block.x + _block.width) / PREVIEW_SCALE - _block.x / PREVIEW_SCALE,
+		(_block.y + _block.height) / PREVIEW_SCALE - _block.y / PREVIEW_SCALE);
+
+	for (auto i = 0; i < NUM_OF_PREVIEWS; ++i) {
+		copyRects(m_previewCopyRects, block, m_previewPrevious[i], _frame.channelPreviews[i]);
+	}
+
+	// Tiles are multiples of the scale, each preview pixel averages
+	// the same pixels whether computed in a tile or not.
+	for (const auto& rect : m_previewRects) {
+		cv::Rect clipped = rect & block;
+		if (clipped.empty()) {
+			continue;
+		}
+
+		cv::Rect source(clipped.x * PREVIEW_SCALE, clipped.y * PREVIEW_SCALE,
+			clipped.width * PREVIEW_SCALE, clipped.height * PREVIEW_SCALE);
+		cv::Mat colorSpace = m_isTiled
+			? scratch::get(scratch::ColorSpace, clipped.size(), CV_8UC3)
+			: cv::Mat(_frame.colorSpacePreview(clipped));
+		cv::Mat channels[3] = {
+			_frame.channelPreviews[0](clipped), _frame.channelPreviews[1](clipped), _frame.channelPreviews[2](clipped)
+		};
+
+		kernels::convertSplitPreview(_frame.image(source), m_displayFormat.isRGB, PREVIEW_SCALE,
+			_frame.settings.colorSpaceCode, _frame.isFused, colorSpace, channels, m_atlasType);
+	}
+}
+
+void FrameProcessor::endPreview(ProcessedFrame& _frame) {
+	stampTiles(_frame, m_previewCarried, m_previewCarry.tiles, _frame.channelTiles);
+
+	m_previewCarry.valid = true;
+	m_previewCarry.colorSpaceCode = _frame.settings.colorSpaceCode;
+	m_previewCarry.size = _frame.image.size();
+	m_previewCarry.uploads[0] = _frame.atlasUpload;
+	m_previewCarry.tiles = _frame.channelTiles;
+	for (auto& previous : m_previewPrevious) {
+		previous.release();
+	}
+}
+
+void FrameProcessor::copyRects(const std::vector<cv::Rect>& _rects, const cv::Rect& _block,
+	const cv::Mat& _src, cv::Mat& _dst) {
+	for (const auto& rect : _rects) {
+		cv::Rect clipped = rect & _block;
+		if (!clipped.empty()) {
+			cv::Mat dst = _dst(clipped);
+			_src(clipped).copyTo(dst);
+			memprof::countCopy(clipped.area() * _src.elemSize());
+		}
+	}
+}
+
+void FrameProcessor::getBlocks(cv::Size _size, std::vector<cv::Rect>& _blocks) const {
+	const int64_t bytesPerPixel = 3 + 2 * CV_ELEM_SIZE(m_displayFormat.type) + int64_t(sizeof(int32_t));
+	const int64_t pixels = int64_t(m_bandCacheSize / 2) / bytesPerPixel;
+
+	_blocks.clear();
+	if (m_isTiled) {
+		const int32_t tileSize = TileGrid::TILE_SIZE;
+		const int32_t cols = int32_t(std::max(pixels / (tileSize * tileSize), int64_t(1))) * tileSize;
+		for (int32_t y = 0; y < _size.height; y += tileSize) {
+			for (int32_t x = 0; x < _size.width; x += cols) {
+				_blocks.emplace_back(x, y, std::min(cols, _size.width - x), std::min(tileSize, _size.height - y));
+			}
+		}
+	}
+	else {
+		const int64_t numOfThreads = m_bandPool->getNumberOfWorkers() + 1;
+		int64_t rows = pixels / std::max(_size.width, 1);
+		rows = std::min(rows, (_size.height + 4 * numOfThreads - 1) / (4 * numOfThreads));
+		const int32_t bandRows = std::max(int32_t(rows / PREVIEW_SCALE) * PREVIEW_SCALE, PREVIEW_SCALE);
+		for (int32_t y = 0; y < _size.height; y += bandRows) {
+			_blocks.emplace_back(0, y, _size.width, std::min(bandRows, _size.height - y));
+		}
+	}
+}
+
+void FrameProcessor::setPreviews(const cv::Mat& _atlas, cv::Size _previewSize, cv::Mat (&_previews)[NUM_OF_PREVIEWS]) {
+	for (auto i = 0; i < NUM_OF_PREVIEWS; ++i) {
+		_previews[i] = _atlas(cv::Rect(cv::Point(i * _previewSize.width, 0), _previewSize));
+	}
+}
+
+void FrameProcessor::stampTiles(const ProcessedFrame& _frame, bool _carry,
+	const std::vector<uint32_t>& _previous, std::vector<uint32_t>& _tiles) {
+	_tiles.resize(_frame.changedTiles.size());
+	for (size_t i = 0; i < _tiles.size(); ++i) {
+		_tiles[i] = (!_carry || _frame.changedTiles[i]) ? _frame.resultId : _previous[i];
+	}
+}
+
+void FrameProcessor::shareUpload(const UploadBufferRef& _previous, UploadBufferRef& _upload,
+	cv::Mat& _image, int32_t _type) {
+	_upload = _previous;
+	_image = _upload->asMat(_type);
+}
+
+void FrameProcessor::bindUpload(UploadBufferRef& _upload, cv::Mat& _image, cv::Size _size, int32_t _type) {
+	_upload = m_uploadPool.acquire(uint16_t(_size.width), uint16_t(_size.height),
+		uint32_t(CV_ELEM_SIZE(_type)));
+	_image = _upload->asMat(_type);
+}
+
+FrameProcessor::PathTimes FrameProcessor::benchmarkPaths(cv::Size _size, bool _tryOpenCL) {
+	static const int32_t NUM_OF_RUNS = 5;
+
+	PathTimes times = { -1, -1 };
+	if (!_tryOpenCL || !cv::ocl::useOpenCL()) {
+		return times;
+	}
+
+	cv::Mat bgr(_size, CV_8UC3);
+	cv::randu(bgr, cv::Scalar::all(0), cv::Scalar::all(256));
+
+	// A lookup takes as long whatever the table holds, masking only
+	// needs a class to be defined
+	auto table = std::make_shared<ColorClassifier::Table>(*m_classifier->getTable());
+	table->classes = 1;
+
+	const cv::Size previewSize(_size.width / PREVIEW_SCALE, _size.height / PREVIEW_SCALE);
+	std::unique_ptr<ProcessedFrame> frame(new ProcessedFrame());
+	frame->settings = { cv::COLOR_BGR2HSV, true, table->version };
+	frame->isFused = isFused(cv::COLOR_BGR2HSV);
+	frame->image.create(_size, m_displayFormat.type);
+	frame->display.create(_size, m_displayFormat.type);
+	frame->labels.create(_size, CV_32SC1);
+	frame->colorSpacePreview.create(previewSize);
+	frame->channelsAtlas.create(previewSize.height, previewSize.width * NUM_OF_PREVIEWS, m_atlasType);
+	setPreviews(frame->channelsAtlas, previewSize, frame->channelPreviews);
+
+	// What convertBlock, maskBlock and previewBlock do with every tile
+	// changed, which blocks start on multiples of the scale for
+	auto computeBlock = [&](const cv::Rect& _block) {
+		cv::Mat image = frame->image(_block);
+		cv::cvtColor(bgr(_block), image, m_displayFormat.fromBGR);
+
+		cv::Mat labels = m_isTiled
+			? scratch::get(scratch::Labels, _block.size(), CV_32SC1)
+			: frame->labels(_block);
+		cv::Mat display = frame->display(_block);
+		ColorClassifier::classify(*table, image, m_displayFormat.isRGB, labels, display);
+
+		const cv::Rect preview(_block.x / PREVIEW_SCALE, _block.y / PREVIEW_SCALE,
+			(_block.x + _block.width) / PREVIEW_SCALE - _block.x / PREVIEW_SCALE,
+			(_block.y + _block.height) / PREVIEW_SCALE - _block.y / PREVIEW_SCALE);
+		if (preview.empty()) {
+			return;
+		}
+
+		cv::Rect source(preview.x * PREVIEW_SCALE, preview.y * PREVIEW_SCALE,
+			preview.width * PREVIEW_SCALE, preview.height * PREVIEW_SCALE);
+		cv::Mat colorSpace = m_isTiled
+			? scratch::get(scratch::ColorSpace, preview.size(), CV_8UC3)
+			: cv::Mat(frame->colorSpacePreview(preview));
+		cv::Mat channels[3] = {
+			frame->channelPreviews[0](preview), frame->channelPreviews[1](preview), frame->channelPreviews[2](preview)
+		};
+
+		kernels::convertSplitPreview(frame->image(source), m_displayFormat.isRGB, PREVIEW_SCALE,
+			frame->settings.colorSpaceCode, frame->isFused, colorSpace, channels, m_atlasType);
+	};
+
+	std::vector<cv::Rect> blocks;
+	if (m_bandPool) {
+		getBlocks(_size, blocks);
+	}
+	else {
+		blocks.assign(1, cv::Rect(cv::Point(), _size));
+	}
+
+	auto time = [](const std::function<void()>& _run) {
+		_run();
+		int64_t best = INT64_MAX;
+		for (int32_t i = 0; i < NUM_OF_RUNS; ++i) {
+			int64_t start = StageProfiler::now();
+			_run();
+			best = std::min(best, StageProfiler::now() - start);
+		}
+
+		return best;
+	};
+
+	times.cpu = time([&] {
+		if (m_bandPool) {
+			m_bandPool->parallelFor(int32_t(blocks.size()), [&](int32_t _block) {
+				computeBlock(blocks[_block]);
+			});
+		}
+		else {
+			computeBlock(blocks.front());
+		}
+	});
+
+	// A runtime unable to build or run a kernel leaves the CPU path
+	try {
+		times.openCL = time([&] {
+			m_umatPipeline.process(bgr, m_displayFormat.fromBGR, frame->settings.colorSpaceCode,
+				table.get(), PREVIEW_SCALE, &frame->image, &frame->display, &frame->channelsAtlas);
+		});
+	}
+	catch (const cv::Exception& _exception) {
+		std::cout << "OpenCL pipeline failed, processing on the CPU: " << _exception.what() << std::endl;
+	}
+
+	return times;
+}
+
+const std::vector<int32_t>& FrameProcessor::getFusedCodes() {
+	static const std::vector<int32_t> fusedCodes = [] {
+		static const int32_t colorSpaceCodes[] = {
+			cv::COLOR_BGR2RGB, cv::COLOR_BGR2HSV, cv::COLOR_BGR2YCrCb, cv::COLOR_BGR2Lab
+		};
+
+		std::vector<int32_t> codes;
+		cv::Mat sweep = kernels::makeColorSweep(16);
+		for (auto code : colorSpaceCodes) {
+			auto mismatches = kernels::verifyFusedConversion(sweep, code, PREVIEW_SCALE);
+			if (mismatches == 0) {
+				codes.push_back(code);
+			}
+			else {
+				std::cout << "Fused conversion " << code << " differs from OpenCV on "
+					<< mismatches << " bytes, falling back to cvtColor" << std::endl;
+			}
+		}
+
+		return codes;
+	}();
+
+	return fusedCodes;
+}
+
+bool FrameProcessor::isFused(int32_t _colorSpaceCode) {
+	const auto& codes = getFusedCodes();
+	return std::find(codes.begin(), codes.end(), _colorSpaceCode) != codes.end();
+}
+
+int32_t FrameProcessor::getCameraOffset() const {
+	if (m_dropPolicy != DropPolicy::Oldest || m_lastSequence == 0) {
+		return 1;
+	}
+
+	// The provider clamps it to the oldest frame it still holds
+	return std::min(m_lastSequence + 1 - m_frameProvider->getSequence(), 0);
+}
+
+int64_t FrameProcessor::runScheduled(int64_t _now) {
+	if (m_closing.load(std::memory_order::memory_order_relaxed)) {
+		return FrameScheduler::IDLE;
+	}
+
+	if (_now < m_nextRun) {
+		return m_nextRun;
+	}
+
+	// Every frame is held somewhere, which does not last
+	ProcessedFrame* frame = nullptr;
+	if (!m_freeFrames.tryPop(frame)) {
+		return _now + 1000000;
+	}
+
+	if (!capture(*frame)) {
+		m_freeFrames.push(frame);
+		return FrameScheduler::IDLE;
+	}
+
+	process(*frame);
+
+	ProcessedFrame* stale = nullptr;
+	if (m_readyQueue.tryPop(stale)) {
+		m_freeFrames.push(stale);
+		m_droppedFrames.fetch_add(1, std::memory_order::memory_order_relaxed);
+	}
+
+	m_readyQueue.push(frame);
+
+	// Frames captured meanwhile are taken as soon as the budget allows
+	m_nextRun = m_budgetPeriod > 0 ? _now + m_budgetPeriod : 0;
+	if (m_frameProvider->getSequence() > m_lastSequence) {
+		return std::max(m_nextRun, StageProfiler::now());
+	}
+
+	return FrameScheduler::IDLE;
+}
+
+void FrameProcessor::runCapture() {
+	ProcessedFrame* frame = nullptr;
+	while (m_freeFrames.pop(frame)) {
+		// Wait for the camera to produce a new frame
+		while (!capture(*frame)) {
+			m_frameProvider->waitForFrame(m_lastSequence, std::chrono::milliseconds(100));
+			if (m_closing.load(std::memory_order::memory_order_relaxed)) {
+				return;
+			}
+		}
+
+		if (!m_convertQueue.push(frame)) {
+			return;
+		}
+	}
+}
+
+void FrameProcessor::runStage(BoundedQueue<ProcessedFrame*>& _input, BoundedQueue<ProcessedFrame*>& _output,
+	void (FrameProcessor::*_stage)(ProcessedFrame&)) {
+	ProcessedFrame* frame = nullptr;
+	while (_input.pop(frame)) {
+		(this->*_stage)(*frame);
+		if (!_output.push(frame)) {
+			return;
+		}
+	}
+}
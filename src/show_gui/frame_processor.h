@@ -0,0 +1,412 @@
+#ifndef FRAME_PROCESSOR_H_HEADER_GUARD
+#define FRAME_PROCESSOR_H_HEADER_GUARD
+
+#include "frame_provider.h"
+#include "frame_ring.h"
+#include "bounded_queue.h"
+#include "upload_pool.h"
+#include "stage_profiler.h"
+#include "color_classifier.h"
+#include "frame_tiles.h"
+#include "frame_arena.h"
+#include "frame_scheduler.h"
+#include "task_pool.h"
+#include "umat_pipeline.h"
+
+#include <bgfx/bgfx.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+// Layout of the camera frame as displayed and uploaded, in the texture
+// format of the same layout. Camera frames are BGR: BGRA8 only inserts
+// alpha, RGB8 saves a byte per pixel but swaps red and blue. Either way
+// the conversion is part of the copy into the upload buffer.
+struct DisplayFormat {
+	const char*					name;
+	bgfx::TextureFormat::Enum	textureFormat;
+	int32_t						type;			// CV_8UC3 or CV_8UC4
+	int32_t						fromBGR;		// Conversion code out of camera frames
+	bool						isRGB;			// Red first, rather than blue
+};
+
+static const DisplayFormat s_displayFormats[] = {
+	{ "bgra8",	bgfx::TextureFormat::BGRA8,	CV_8UC4,	cv::COLOR_BGR2BGRA,	false	},
+	{ "rgb8",	bgfx::TextureFormat::RGB8,	CV_8UC3,	cv::COLOR_BGR2RGB,	true	},
+	{ "rgba8",	bgfx::TextureFormat::RGBA8,	CV_8UC4,	cv::COLOR_BGR2RGBA,	true	},
+};
+
+// Color space and picking parameters the frames are processed with.
+// The render thread updates them, and each frame entering the pipeline
+// takes a snapshot, so that a frame is processed consistently throughout.
+struct FrameSettings {
+	int32_t		colorSpaceCode;
+	bool		applyMask;			// Whether any color class is defined
+	uint32_t	classifierVersion;	// Table the classes have been published in
+
+	// Whether a frame processed with either settings gives the same result
+	bool operator==(const FrameSettings& _other) const {
+		return colorSpaceCode == _other.colorSpaceCode
+			&& applyMask == _other.applyMask
+			&& (!applyMask || classifierVersion == _other.classifierVersion);
+	}
+
+	bool operator!=(const FrameSettings& _other) const {
+		return !(*this == _other);
+	}
+};
+
+// Camera frames a processor takes next when it falls behind its source,
+// whether because of its budget or because the workers are busy.
+enum class DropPolicy {
+	Latest,		// The newest one, the frames in between are dropped
+	Oldest,		// The oldest one the ring still holds, in capture order
+};
+
+// A camera frame travelling through the processing pipeline,
+// together with everything each stage has produced out of it.
+struct ProcessedFrame {
+	FrameArena			arena;				// Temporaries, until the frame is recycled
+	FrameSettings		settings;
+	FrameRing::View		source;				// Pinned until converted
+	uint32_t			resultId;			// Distinct for each (sequence, settings)
+	int32_t				sequence;
+	int64_t				captureTime;		// StageProfiler::now() at capture
+	int32_t				sourceType;
+	cv::Mat				image;				// Camera frame in the display format
+	cv::Mat				display;			// Same, masked if requested
+	cv::Mat				labels;				// One bit per color class, on masked tiles, untiled
+	cv::Mat3b			colorSpacePreview;	// Reduced frame in the requested color space, untiled,
+	cv::Mat				channelsAtlas;		// and its channels side by side, ready to be
+	cv::Mat				channelPreviews[3];	// uploaded, each within the atlas
+	bool				isFused;			// Previews used the fused conversion
+	UploadBufferRef		imageUpload;		// Upload buffers the images above are
+	UploadBufferRef		displayUpload;		// written into, handed as they are
+	UploadBufferRef		atlasUpload;		// to bgfx when rendering the frame
+	TileGrid			tileGrid;
+	std::vector<uint8_t>	changedTiles;		// Since the previous frame
+	int32_t				numOfChangedTiles;
+	std::vector<uint32_t>	displayTiles;		// Result id each tile of the display and
+	std::vector<uint32_t>	channelTiles;		// channel images has been produced by
+};
+
+// Pipelined frame processing. In multi-threaded mode, capture, convert,
+// mask and channel previews each run on their own worker, connected by bounded
+// queues, so that a frame is processed while the next one is captured and
+// the previous one is rendered. Frames are recycled through a fixed pool,
+// which keeps their buffers allocated from one frame to the next. Images
+// meant for textures are written straight into pooled upload buffers, so
+// pixels reach bgfx without further copies on the render thread.
+// In single-threaded mode the same stages run inline on the caller.
+// Scheduled, they run inline as a job of a scheduler shared with other
+// sources, within a frame budget, in place of workers of their own.
+// With a band pool, convert, mask and previews run as one stage instead,
+// which splits the frame into bands of rows processed in parallel, each
+// one going through the three of them on a core while it is in its cache.
+// Tiled, the blocks are runs of tiles rather than whole rows, so that they
+// fit in the cache of a core at any frame width, and the intermediates no
+// stage reads back live in per-thread scratch instead of frame-sized images.
+//
+// Only the tiles of a frame which have changed since the previous one go
+// through the stages. The other tiles of the images to be uploaded are
+// carried over from the previous frame, or when there is no change at all,
+// its upload buffers are shared as they are. Each tile is stamped with the
+// result it has been produced by, so that the render thread only uploads
+// the tiles which differ from what its textures hold, whatever frames it
+// has skipped in between.
+class FrameProcessor {
+
+	static const int32_t NUM_OF_POOLED_FRAMES = 8;
+
+public:
+
+	// Channel previews are displayed at a third of the frame size, they
+	// are computed and uploaded at that resolution, side by side in an
+	// atlas of NUM_OF_PREVIEWS panels.
+	static const int32_t PREVIEW_SCALE = 3;
+	static const int32_t NUM_OF_PREVIEWS = 3;
+	static_assert(TileGrid::TILE_SIZE % PREVIEW_SCALE == 0, "Tiles must map to whole preview pixels");
+
+	bool init(FrameProvider* _frameProvider, ColorClassifier* _classifier,
+		StageProfiler* _profiler, bool _isMultiThreaded,
+		int32_t _tileThreshold = 0,
+		const DisplayFormat& _displayFormat = s_displayFormats[0],
+		int32_t _atlasType = CV_8UC4,
+		bool _useHugePages = false,
+		bool _tryOpenCL = false);
+
+	// Process frames in bands on _pool, shared with other processors if
+	// need be, rather than stage after stage, or in blocks of tiles if
+	// _isTiled. Call before init.
+	void setBandPool(TaskPool* _pool, bool _isTiled = false);
+
+	bool hasBandPool() const {
+		return m_bandPool != nullptr;
+	}
+
+	bool isTiled() const {
+		return m_isTiled;
+	}
+
+	// Nanoseconds a frame of the source took on either path at startup,
+	// negative for both when OpenCL has not been tried.
+	struct PathTimes {
+		int64_t	cpu;
+		int64_t	openCL;
+	};
+
+	PathTimes getPathTimes() const {
+		return m_pathTimes;
+	}
+
+	// Whether frames are processed on the OpenCL device, which has been
+	// found faster than the CPU at startup.
+	bool usesOpenCL() const {
+		return m_useOpenCL;
+	}
+
+	// Process frames as a job of a shared scheduler, woken up by the
+	// provider's frames, rather than on workers of our own; at most
+	// _budgetFPS of them per second if positive. Call once after an init
+	// in single-threaded mode, with the provider scheduled already.
+	void schedule(FrameScheduler* _scheduler, int32_t _budgetFPS, DropPolicy _dropPolicy);
+
+	void shutdown();
+
+	// Settings for the next frames. If they differ from the current ones,
+	// the latest camera frame is processed again, without waiting for the
+	// camera to produce a new one.
+	void setSettings(const FrameSettings& _settings);
+
+	// Return the most recent processed frame, or nullptr if there is none
+	// yet. The frame belongs to the processor, and it stays valid until the
+	// next call, after which it may be recycled for a new camera frame.
+	const ProcessedFrame* getProcessedFrame();
+
+	uint32_t getNumberOfUploadBuffers() const {
+		return m_uploadPool.getNumberOfBuffers();
+	}
+
+	// Camera frames skipped, or processed but replaced before being displayed
+	uint64_t getNumberOfDroppedFrames() const {
+		return m_droppedFrames.load(std::memory_order::memory_order_relaxed);
+	}
+
+	uint64_t getNumberOfProcessedFrames() const {
+		return m_processedFrames.load(std::memory_order::memory_order_relaxed);
+	}
+
+	bool isScheduled() const {
+		return m_scheduler != nullptr;
+	}
+
+	FrameScheduler::JobStats getJobStats() const {
+		return m_scheduler ? m_scheduler->getStats(m_job) : FrameScheduler::JobStats{ 0, 0, 0 };
+	}
+
+	// Allocations of the arenas of all the pooled frames
+	FrameArena::Stats getArenaStats() const;
+
+	FrameProcessor();
+
+private:
+
+	// Take the latest camera frame, unless it has been processed with
+	// the current settings already, in which case the result is the last
+	// one and still cached in the frame the render thread holds.
+	bool capture(ProcessedFrame& _frame);
+
+	// Run the stages inline
+	void process(ProcessedFrame& _frame);
+
+	// Convert the changed tiles of the camera frame into the display format.
+	void convert(ProcessedFrame& _frame);
+
+	// Mask the camera frame with the picked color classes, if any.
+	void mask(ProcessedFrame& _frame);
+
+	// Compute the channel previews of the changed tiles, at the resolution
+	// they are displayed at, into the atlas they are uploaded with.
+	void prepareUpload(ProcessedFrame& _frame);
+
+	// Convert, mask and preview the frame block by block on the pool, each
+	// block going through the three of them while it is in cache.
+	void processBlocks(ProcessedFrame& _frame);
+
+	// Convert, mask and preview the frame on the OpenCL device, into the
+	// same buffers as the CPU stages. The device computes whole frames,
+	// but the unchanged tiles keep the stamps of the frame they would have
+	// been carried over from, and are not uploaded again.
+	void processOpenCL(ProcessedFrame& _frame);
+
+	// Stages are split into what they do once per frame, before and after,
+	// and what they do within a block of it: copying the unchanged tiles
+	// over from the previous frame, and computing the changed ones, clipped
+	// to the block. Begins tell whether there is anything to compute, and
+	// take the buffers the blocks are written into.
+
+	// Detect the changed tiles, and return the camera frame in BGR.
+	cv::Mat beginConvert(ProcessedFrame& _frame);
+
+	void convertBlock(ProcessedFrame& _frame, const cv::Mat& _bgr, const cv::Rect& _block);
+
+	void endConvert(ProcessedFrame& _frame, cv::Mat& _bgr);
+
+	bool beginMask(ProcessedFrame& _frame);
+
+	void maskBlock(ProcessedFrame& _frame, const cv::Rect& _block);
+
+	void endMask(ProcessedFrame& _frame);
+
+	bool beginPreview(ProcessedFrame& _frame);
+
+	// Blocks start on multiples of the scale, only their ends round down
+	void previewBlock(ProcessedFrame& _frame, const cv::Rect& _block);
+
+	void endPreview(ProcessedFrame& _frame);
+
+	// Copy the parts of _rects within _block from _src into _dst
+	static void copyRects(const std::vector<cv::Rect>& _rects, const cv::Rect& _block,
+		const cv::Mat& _src, cv::Mat& _dst);
+
+	// Blocks the pool processes a frame in, sized for everything the stages
+	// read and write of a block to fit in half of the L2 cache of a core.
+	// Bands are as many whole rows as fit, but few enough for every thread
+	// to get a few. Tiled, blocks are runs of as many tiles as fit along a
+	// row of tiles, which keeps them within the cache whatever the width.
+	// Either way, they start on multiples of the preview scale.
+	void getBlocks(cv::Size _size, std::vector<cv::Rect>& _blocks) const;
+
+	// Point each preview to its panel of the atlas
+	static void setPreviews(const cv::Mat& _atlas, cv::Size _previewSize, cv::Mat (&_previews)[NUM_OF_PREVIEWS]);
+
+	// Stamp the changed tiles with the frame's result id, and the others
+	// with the id they had in the previous frame, if carried over from it.
+	static void stampTiles(const ProcessedFrame& _frame, bool _carry,
+		const std::vector<uint32_t>& _previous, std::vector<uint32_t>& _tiles);
+
+	// Share an upload buffer of the previous frame, unchanged
+	static void shareUpload(const UploadBufferRef& _previous, UploadBufferRef& _upload,
+		cv::Mat& _image, int32_t _type);
+
+	// Point _image to a fresh upload buffer, so that the stage writing
+	// into it prepares the texture upload at the same time. OpenCV keeps
+	// writing into it, as long as the size and type do not change.
+	void bindUpload(UploadBufferRef& _upload, cv::Mat& _image, cv::Size _size, int32_t _type);
+
+	// Time the CPU stages and the OpenCL pipeline on a synthetic frame of
+	// the given size, with every tile changed and one color class, if
+	// _tryOpenCL and OpenCL is in use; both times are negative otherwise.
+	// Each path runs once to warm up, which is when OpenCL builds its
+	// kernels, and the best of a few runs counts. The stages' rectangles
+	// and table are left alone, the blocks are computed here in full.
+	PathTimes benchmarkPaths(cv::Size _size, bool _tryOpenCL);
+
+	// The fused kernel replicates OpenCV's fixed-point conversions, they
+	// are verified against the library we run with before relying on them,
+	// once for all processors.
+	static const std::vector<int32_t>& getFusedCodes();
+
+	static bool isFused(int32_t _colorSpaceCode);
+
+	// Ring offset of the camera frame to take next, positive for the
+	// offset given on the command line.
+	int32_t getCameraOffset() const;
+
+	// Processing job of a scheduled processor. The stages run inline, as
+	// in single-threaded mode, and the result is handed over to the render
+	// thread, replacing the previous one if it has not been taken yet.
+	int64_t runScheduled(int64_t _now);
+
+	void runCapture();
+
+	void runStage(BoundedQueue<ProcessedFrame*>& _input, BoundedQueue<ProcessedFrame*>& _output,
+		void (FrameProcessor::*_stage)(ProcessedFrame&));
+
+	// What a stage has produced for the previous frame, which the
+	// unchanged tiles of the next frame are carried over from.
+	struct CarryOver {
+		bool					valid;
+		int32_t					colorSpaceCode;
+		bool					applyMask;
+		uint32_t				tableVersion;
+		cv::Size				size;
+		UploadBufferRef			uploads[4];
+		std::vector<uint32_t>	tiles;
+
+		void reset() {
+			valid = false;
+			for (auto& upload : uploads) {
+				upload.reset();
+			}
+		}
+	};
+
+	UploadBufferPool					m_uploadPool;		// Outlives the frames
+	ProcessedFrame						m_frames[NUM_OF_POOLED_FRAMES];
+	BoundedQueue<ProcessedFrame*>		m_freeFrames;
+	BoundedQueue<ProcessedFrame*>		m_convertQueue;
+	BoundedQueue<ProcessedFrame*>		m_maskQueue;
+	BoundedQueue<ProcessedFrame*>		m_uploadQueue;
+	BoundedQueue<ProcessedFrame*>		m_readyQueue;
+	std::vector<std::thread>			m_workers;
+
+	FrameProvider*						m_frameProvider;
+	ColorClassifier*					m_classifier;
+	StageProfiler*						m_profiler;
+	ProcessedFrame*						m_displayedFrame;
+	int32_t								m_lastSequence;		// Key of the last result,
+	FrameSettings						m_lastSettings;		// owned by the capture
+	uint32_t							m_lastResultId;
+	std::atomic<bool>					m_closing;
+
+	FrameScheduler*						m_scheduler;
+	int32_t								m_job;
+	int64_t								m_budgetPeriod;		// Nanoseconds, 0 for none
+	int64_t								m_nextRun;			// Owned by the job
+	DropPolicy							m_dropPolicy;
+	std::atomic<uint64_t>				m_droppedFrames;
+	std::atomic<uint64_t>				m_processedFrames;
+
+	std::mutex							m_settingsMutex;
+	FrameSettings						m_settings;
+
+	TileChangeDetector					m_detector;			// Owned by convert,
+	CarryOver							m_convertCarry;		// and each carry over
+	CarryOver							m_maskCarry;		// by its stage
+	CarryOver							m_previewCarry;
+	std::vector<cv::Rect>				m_convertRects;
+	std::vector<cv::Rect>				m_maskRects;
+	std::vector<cv::Rect>				m_previewRects;
+	std::vector<cv::Rect>				m_convertCopyRects;	// Unchanged tiles, copied over
+	std::vector<cv::Rect>				m_maskCopyRects;	// from the previous frame's
+	std::vector<cv::Rect>				m_previewCopyRects;	// images below
+	cv::Mat								m_convertPrevious;
+	cv::Mat								m_maskPrevious;
+	cv::Mat								m_previewPrevious[NUM_OF_PREVIEWS];
+	std::shared_ptr<const ColorClassifier::Table>	m_maskTable;	// Of the frame being masked
+	uint32_t							m_maskTableVersion;
+	bool								m_maskCarried;
+	bool								m_previewCarried;
+
+	TaskPool*							m_bandPool;
+	size_t								m_bandCacheSize;	// Bytes of L2 a block is sized for
+	bool								m_isTiled;
+	std::vector<cv::Rect>				m_blocks;			// Of the frame being processed
+
+	DisplayFormat						m_displayFormat;
+	int32_t								m_atlasType;
+
+	UMatPipeline						m_umatPipeline;		// Owned by whichever stage runs it
+	PathTimes							m_pathTimes;
+	bool								m_useOpenCL;
+	bool								m_isMultiThreaded;
+};
+
+#endif // FRAME_PROCESSOR_H_HEADER_GUARD
@@ -0,0 +1,275 @@
+#include "frame_provider.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <iostream>
+
+bool FrameProvider::init(std::unique_ptr<FrameSource> _source,
+	int32_t _frames, int32_t _offset, bool _isMultiThreaded,
+	StageProfiler* _profiler) {
+	m_profiler = _profiler;
+
+	// Get the maximum number of frames we want to store into the frame's buffer
+	m_numOfFrames = std::clamp(_frames, 1, 64);
+	m_frameOffset = std::clamp(_offset, -(m_numOfFrames -1), 0);
+
+	m_source = std::move(_source);
+	if (!m_source->open()) {
+		std::cerr << "Requested " << m_source->getDescription() << " is not available!" << std::endl;
+		return false;
+	}
+
+	m_cameraInfo = {
+		m_source->getCameraId(),
+		m_source->getFrameSize(),
+		m_source->getFPS()
+	};
+
+	// Slots are allocated once at the negotiated size, the capture
+	// will then decode straight into them without further allocations.
+	m_cameraFrames.init(m_numOfFrames, m_cameraInfo.frameSize, CV_8UC3);
+	m_period = m_cameraInfo.fps > 0 ? 1000000000 / m_cameraInfo.fps : 0;
+
+	m_process.store(true, std::memory_order::memory_order_release);
+	m_capture.store(false, std::memory_order::memory_order_relaxed);
+	m_idleTime.store(0, std::memory_order::memory_order_relaxed);
+	m_busyTime.store(0, std::memory_order::memory_order_relaxed);
+
+	// If multi-threading is enabled, create a
+	// thread and execute here the tick funciton.
+	m_isMultiThreaded = _isMultiThreaded;
+	if (m_isMultiThreaded) {
+		m_captureThread = std::thread([this]{
+			trace::setThreadName("capture");
+			this->run();
+		});
+	}
+
+	return true;
+}
+
+void FrameProvider::schedule(FrameScheduler* _scheduler) {
+	m_scheduler = _scheduler;
+	m_nextTick = 0;
+	m_captureJob = m_scheduler->add([this](int64_t _now) {
+		return this->runScheduled(_now);
+	});
+}
+
+void FrameProvider::run() {
+	typedef std::chrono::steady_clock Clock;
+
+	const auto period = m_cameraInfo.fps > 0
+		? Clock::duration(std::chrono::nanoseconds(1000000000 / m_cameraInfo.fps))
+		: Clock::duration::zero();
+
+	auto nextTick = Clock::now();
+	while (m_process.load(std::memory_order::memory_order_acquire)) {
+		auto idleStart = Clock::now();
+		{
+			std::unique_lock<std::mutex> lock(m_stateMutex);
+			m_stateChanged.wait(lock, [this] {
+				return m_capture.load(std::memory_order::memory_order_relaxed)
+					|| !m_process.load(std::memory_order::memory_order_relaxed);
+			});
+
+			// Do not try to catch up on the time spent parked
+			if (Clock::now() - idleStart > period) {
+				nextTick = Clock::now();
+			}
+
+			// Sleep until the next frame is due, unless asked to stop
+			m_stateChanged.wait_until(lock, nextTick, [this] {
+				return !m_process.load(std::memory_order::memory_order_relaxed);
+			});
+		}
+
+		auto busyStart = Clock::now();
+		m_idleTime.fetch_add(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(busyStart - idleStart).count(),
+			std::memory_order::memory_order_relaxed);
+
+		if (m_process.load(std::memory_order::memory_order_relaxed)) {
+			this->tick();
+		}
+
+		auto busyEnd = Clock::now();
+		m_busyTime.fetch_add(
+			std::chrono::duration_cast<std::chrono::nanoseconds>(busyEnd - busyStart).count(),
+			std::memory_order::memory_order_relaxed);
+
+		// If the camera is slower than what it has negotiated
+		// the grab itself has blocked, and we are already late.
+		nextTick += period;
+		if (nextTick < busyEnd) {
+			nextTick = busyEnd;
+		}
+	}
+}
+
+int64_t FrameProvider::runScheduled(int64_t _now) {
+	if (!m_process.load(std::memory_order::memory_order_acquire)
+		|| !m_capture.load(std::memory_order::memory_order_relaxed)) {
+		return FrameScheduler::IDLE;
+	}
+
+	// Do not try to catch up on the time spent parked
+	if (_now - m_nextTick > m_period) {
+		m_nextTick = _now;
+	}
+
+	this->tick();
+
+	auto end = StageProfiler::now();
+	m_busyTime.fetch_add(end - _now, std::memory_order::memory_order_relaxed);
+
+	// A source late on its own, or waiting for a worker, drops frames
+	// rather than capturing them in a burst.
+	m_nextTick = std::max(m_nextTick + m_period, end);
+	return m_nextTick;
+}
+
+bool FrameProvider::tick() {
+	if (!m_capture.load(std::memory_order::memory_order_relaxed)) {
+		return false;
+	}
+
+	// Grab first, so that the driver queue keeps being drained
+	// even when the back buffer is pinned by a consumer and the
+	// frame has to be dropped.
+	bool grabbed = false;
+	auto sequence = m_cameraFrames.getSequence() + 1;
+	{
+		ScopedStageTimer timer(m_profiler, Stage::Capture, sequence);
+		grabbed = m_source->grab();
+	}
+
+	// The frame is stamped as soon as it is available to us
+	auto captureTime = StageProfiler::now();
+
+	bool written = false;
+	if (grabbed) {
+		// Decode into the back buffer, which in our case
+		// technically is the following available frame in the
+		// buffer. The ring publishes it with release semantic,
+		// hence two threads, querying the buffer before the
+		// next write is issued, will see the same result,
+		// and therefore, they will process the same image.
+		ScopedStageTimer timer(m_profiler, Stage::RingWrite, sequence);
+		written = m_cameraFrames.write([this](cv::Mat& _image) {
+			return m_source->retrieve(_image);
+		}, captureTime);
+	}
+
+	if (written) {
+		// Taking the lock makes sure a waiter cannot miss it
+		{
+			std::lock_guard<std::mutex> lock(m_frameMutex);
+		}
+
+		m_frameReady.notify_all();
+
+		if (m_frameCallback) {
+			m_frameCallback();
+		}
+	}
+
+	return written;
+}
+
+int32_t FrameProvider::waitForFrame(int32_t _sequence, std::chrono::milliseconds _timeout) {
+	std::unique_lock<std::mutex> lock(m_frameMutex);
+	auto interrupts = m_waitInterrupts;
+	m_frameReady.wait_for(lock, _timeout, [this, _sequence, interrupts] {
+		return m_cameraFrames.getSequence() > _sequence
+			|| m_waitInterrupts != interrupts
+			|| !m_process.load(std::memory_order::memory_order_relaxed);
+	});
+
+	return m_cameraFrames.getSequence();
+}
+
+void FrameProvider::interruptWait() {
+	{
+		std::lock_guard<std::mutex> lock(m_frameMutex);
+		++m_waitInterrupts;
+	}
+
+	m_frameReady.notify_all();
+}
+
+void FrameProvider::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(m_stateMutex);
+		m_process.store(false, std::memory_order::memory_order_release);
+	}
+
+	m_stateChanged.notify_all();
+	{
+		std::lock_guard<std::mutex> lock(m_frameMutex);
+	}
+
+	m_frameReady.notify_all();
+	if (m_captureThread.joinable()) {
+		m_captureThread.join();
+	}
+
+	m_cameraFrames.shutdown();
+	if (m_source) {
+		m_source->close();
+	}
+}
+
+void FrameProvider::capture(bool _onOff) {
+	if (m_scheduler) {
+		if (m_capture.load(std::memory_order::memory_order_relaxed) != _onOff) {
+			m_capture.store(_onOff, std::memory_order::memory_order_relaxed);
+			if (_onOff) {
+				m_scheduler->wake(m_captureJob);
+			}
+		}
+	}
+	else if (!m_isMultiThreaded) {
+		m_capture.store(_onOff, std::memory_order::memory_order_relaxed);
+		tick();
+	}
+	else if (m_capture.load(std::memory_order::memory_order_relaxed) != _onOff) {
+		// Only wake the capture thread up on an actual change,
+		// this is called by the render thread on every frame.
+		{
+			std::lock_guard<std::mutex> lock(m_stateMutex);
+			m_capture.store(_onOff, std::memory_order::memory_order_relaxed);
+		}
+
+		m_stateChanged.notify_all();
+	}
+}
+
+FrameProvider::CaptureTimes FrameProvider::getCaptureTimes() const {
+	return {
+		m_idleTime.load(std::memory_order::memory_order_relaxed),
+		m_busyTime.load(std::memory_order::memory_order_relaxed)
+	};
+}
+
+FrameRing::View FrameProvider::getCameraFrame(int32_t _offset) const {
+	// An offset greater than 0 indicates that we want to use
+	// the value passed as argument to the command line.
+	if (_offset > 0) {
+		_offset = m_frameOffset;
+	}
+
+	auto steps = std::clamp(_offset, -(m_numOfFrames -1), 0);
+	return m_cameraFrames.read(steps);
+}
+
+FrameProvider::FrameProvider()
+	: m_waitInterrupts(0)
+	, m_scheduler(nullptr)
+	, m_captureJob(-1)
+	, m_period(0)
+	, m_nextTick(0)
+	, m_profiler(nullptr)
+	, m_numOfFrames(0) {
+
+}
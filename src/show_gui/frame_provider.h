@@ -0,0 +1,155 @@
+#ifndef FRAME_PROVIDER_H_HEADER_GUARD
+#define FRAME_PROVIDER_H_HEADER_GUARD
+
+#include "frame_ring.h"
+#include "frame_source.h"
+#include "stage_profiler.h"
+#include "frame_scheduler.h"
+
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <cstdint>
+
+struct CameraInfo {
+	int32_t     id;
+	cv::Size    frameSize;
+	int32_t     fps;
+};
+
+// Camera frames captured from a source into a ring, which consumers read
+// without copying them. Capture runs on a thread of its own in
+// multi-threaded mode, as a job of a shared scheduler once scheduled, and
+// inline on the render thread otherwise.
+class FrameProvider {
+
+public:
+
+	// Capture frames from the given source, which the provider takes over.
+	bool init(std::unique_ptr<FrameSource> _source,
+		int32_t _frames, int32_t _offset, bool _isMultiThreaded,
+		StageProfiler* _profiler = nullptr);
+
+	// Capture on a shared scheduler rather than on a thread of our own,
+	// in place of multi-threading. Call once after init.
+	void schedule(FrameScheduler* _scheduler);
+
+	// Capture thread's loop. It parks while capture is off, and paces
+	// itself to the negotiated frame-rate while it is on, so that it
+	// never spins on a core when there is nothing to be captured.
+	void run();
+
+	// Capture job of a scheduled provider, the counterpart of run(). It
+	// is due again one frame period later, and idles while capture is off.
+	int64_t runScheduled(int64_t _now);
+
+	// Called on the capturing thread whenever a frame has been captured
+	void setFrameCallback(std::function<void()> _callback) {
+		m_frameCallback = std::move(_callback);
+	}
+
+	// Retuns whether a new image has been added into the buffer.
+	bool tick();
+
+	// Block until a frame newer than _sequence has been captured, the
+	// timeout expires, the wait is interrupted or the provider shuts down.
+	// Returns the sequence number of the current front buffer.
+	int32_t waitForFrame(int32_t _sequence, std::chrono::milliseconds _timeout);
+
+	// Wake up whoever is waiting for a frame, without a new one,
+	// e.g. because the current frame has to be processed again.
+	void interruptWait();
+
+	// Sequence number of the latest captured frame, 0 if none yet.
+	int32_t getSequence() const {
+		return m_cameraFrames.getSequence();
+	}
+
+	void shutdown();
+
+	void capture(bool _onOff);
+
+	// Nanoseconds the capture thread has spent parked or
+	// pacing itself, and the ones spent capturing frames.
+	struct CaptureTimes {
+		int64_t	idle;
+		int64_t	busy;
+	};
+
+	CaptureTimes getCaptureTimes() const;
+
+	// Return a read-only view of the current front-buffer camera's capture.
+	// No pixel is copied, the slot stays pinned while the view is alive.
+	FrameRing::View getCameraFrame(int32_t _offset = 1) const;
+
+	const CameraInfo& getCameraInfo() const {
+		return m_cameraInfo;
+	}
+
+	bool isMultiThreaded() const {
+		return m_isMultiThreaded;
+	}
+
+	bool isScheduled() const {
+		return m_scheduler != nullptr;
+	}
+
+	std::string getDescription() const {
+		return m_source ? m_source->getDescription() : std::string();
+	}
+
+	int32_t getNumberOfFramesInBuffer() const {
+		return m_numOfFrames;
+	}
+
+	FrameRing::Stats getRingStats() const {
+		return m_cameraFrames.getStats();
+	}
+
+	FrameProvider();
+
+	virtual ~FrameProvider() {
+
+	}
+
+private:
+	
+	std::unique_ptr<FrameSource>	m_source;
+	
+	FrameRing				m_cameraFrames;
+	CameraInfo				m_cameraInfo;
+
+	std::thread				m_captureThread;
+
+	std::mutex				m_stateMutex;
+	std::condition_variable	m_stateChanged;
+	std::atomic<bool>		m_process;
+	std::atomic<bool>		m_capture;
+
+	std::mutex				m_frameMutex;
+	std::condition_variable	m_frameReady;
+	uint32_t				m_waitInterrupts;	// Guarded by m_frameMutex
+
+	std::atomic<int64_t>	m_idleTime;
+	std::atomic<int64_t>	m_busyTime;
+
+	FrameScheduler*			m_scheduler;
+	int32_t					m_captureJob;
+	int64_t					m_period;			// Nanoseconds per frame, 0 unpaced
+	int64_t					m_nextTick;			// Owned by the capture job
+	std::function<void()>	m_frameCallback;
+
+	StageProfiler*			m_profiler;
+	int32_t					m_numOfFrames;
+	int32_t					m_frameOffset;
+	bool					m_isMultiThreaded;
+};
+
+#endif // FRAME_PROVIDER_H_HEADER_GUARD
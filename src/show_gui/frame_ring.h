@@ -0,0 +1,286 @@
+#ifndef FRAME_RING_H_HEADER_GUARD
+#define FRAME_RING_H_HEADER_GUARD
+
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <cstdint>
+
+// Fixed-size ring of preallocated camera frames.
+//
+// The producer decodes straight into the slot buffers, and consumers get
+// a read-only view of a slot instead of a deep copy. A view pins its slot,
+// so the producer will never overwrite pixels somebody is still reading.
+//
+// The handoff is lock-free, single producer and multiple consumers. The
+// ring holds one slot more than the frames it exposes, so the back buffer
+// the producer decodes into is never one a reader can be asked for. Each
+// slot carries a pin count and the sequence number of the frame it holds:
+// a reader pins the slot and then checks the sequence, retrying if the
+// producer has lapped it in between, while the producer drops the frame
+// instead of waiting if the back buffer is still pinned by a slow reader.
+class FrameRing {
+
+	// Pin count value while the producer owns the slot
+	static constexpr int32_t WRITING = -1;
+
+	struct Slot {
+		cv::Mat					image;
+		std::atomic<int32_t>	pins;
+		std::atomic<int32_t>	sequence;
+		int64_t					timestamp;	// Published along with the pixels
+	};
+
+public:
+
+	// Refcounted, read-only view of a ring slot. The pixels stay valid
+	// for as long as the view is alive; Mat headers taken from image()
+	// must not outlive the view they were taken from.
+	class View {
+
+	public:
+
+		const cv::Mat& image() const {
+			return m_image;
+		}
+
+		bool empty() const {
+			return m_image.empty();
+		}
+
+		// Sequence number of the frame, 0 for an empty view.
+		// Frames are numbered from 1 in the order they were captured.
+		int32_t sequence() const {
+			return m_sequence;
+		}
+
+		// Capture time the producer has written the frame with
+		int64_t timestamp() const {
+			return m_timestamp;
+		}
+
+		View() : m_slot(nullptr), m_sequence(0), m_timestamp(0) {
+
+		}
+
+		View(View&& _other)
+			: m_slot(_other.m_slot)
+			, m_image(std::move(_other.m_image))
+			, m_sequence(_other.m_sequence)
+			, m_timestamp(_other.m_timestamp) {
+			_other.m_slot = nullptr;
+			_other.m_sequence = 0;
+		}
+
+		View& operator=(View&& _other) {
+			if (this != &_other) {
+				unpin();
+				m_slot = _other.m_slot;
+				m_image = std::move(_other.m_image);
+				m_sequence = _other.m_sequence;
+				m_timestamp = _other.m_timestamp;
+				_other.m_slot = nullptr;
+				_other.m_sequence = 0;
+			}
+
+			return *this;
+		}
+
+		View(const View&) = delete;
+		View& operator=(const View&) = delete;
+
+		~View() {
+			unpin();
+		}
+
+	private:
+
+		friend class FrameRing;
+
+		View(Slot* _slot, int32_t _sequence)
+			: m_slot(_slot)
+			, m_image(_slot->image)
+			, m_sequence(_sequence)
+			, m_timestamp(_slot->timestamp) {
+
+		}
+
+		void unpin() {
+			if (m_slot) {
+				m_image.release();
+				m_slot->pins.fetch_sub(1, std::memory_order::memory_order_release);
+				m_slot = nullptr;
+			}
+		}
+
+		Slot*		m_slot;
+		cv::Mat		m_image;
+		int32_t		m_sequence;
+		int64_t		m_timestamp;
+	};
+
+	struct Stats {
+		uint64_t	framesWritten;
+		uint64_t	framesDropped;
+		uint64_t	reallocations;
+		uint64_t	readRetries;
+	};
+
+	// Preallocate _frames slots of the given size and type, plus the back
+	// buffer, so that steady-state capture never has to touch the heap.
+	void init(int32_t _frames, const cv::Size& _frameSize, int32_t _type) {
+		m_numOfFrames = _frames;
+		m_numOfSlots = _frames + 1;
+		m_slots = new Slot[m_numOfSlots];
+		for (int32_t i = 0; i < m_numOfSlots; ++i) {
+			m_slots[i].image.create(_frameSize, _type);
+			m_slots[i].pins.store(0, std::memory_order::memory_order_relaxed);
+			m_slots[i].sequence.store(0, std::memory_order::memory_order_relaxed);
+			m_slots[i].timestamp = 0;
+		}
+
+		m_framesWritten.store(0, std::memory_order::memory_order_relaxed);
+		m_framesDropped.store(0, std::memory_order::memory_order_relaxed);
+		m_reallocations.store(0, std::memory_order::memory_order_relaxed);
+		m_readRetries.store(0, std::memory_order::memory_order_relaxed);
+		m_indexCounter.store(0, std::memory_order::memory_order_release);
+	}
+
+	void shutdown() {
+		delete[] m_slots;
+		m_slots = nullptr;
+	}
+
+	// Fill the back slot in place through _fill(cv::Mat&), which returns
+	// false if no image could be produced. If a consumer still holds a view
+	// on the back slot the frame is dropped rather than stalling the producer.
+	// The frame carries _timestamp along, typically its capture time.
+	// Returns whether a new frame has been published.
+	template<typename Fill>
+	bool write(Fill&& _fill, int64_t _timestamp = 0) {
+		// Only the producer moves the counter, relaxed is enough here.
+		auto counter = m_indexCounter.load(std::memory_order::memory_order_relaxed);
+		auto sequence = counter + 1;
+		auto& slot = m_slots[computeBufferIndex(sequence)];
+
+		// Take the slot over only if nobody has it pinned, readers
+		// which are late to the party will then fail to pin it.
+		int32_t unpinned = 0;
+		if (!slot.pins.compare_exchange_strong(unpinned, WRITING,
+			std::memory_order::memory_order_acquire,
+			std::memory_order::memory_order_relaxed)) {
+			m_framesDropped.fetch_add(1, std::memory_order::memory_order_relaxed);
+			return false;
+		}
+
+		const uchar* data = slot.image.data;
+		bool filled = _fill(slot.image);
+		if (filled) {
+			// The source handed back a different size or type,
+			// the slot has been reallocated to accommodate it.
+			if (slot.image.data != data) {
+				m_reallocations.fetch_add(1, std::memory_order::memory_order_relaxed);
+			}
+
+			slot.sequence.store(sequence, std::memory_order::memory_order_relaxed);
+			slot.timestamp = _timestamp;
+		}
+
+		// Hand the slot back to the readers, the release order makes
+		// the new pixels and sequence visible to whoever pins it next.
+		slot.pins.store(0, std::memory_order::memory_order_release);
+		if (!filled) {
+			return false;
+		}
+
+		// Publish the new front buffer
+		m_indexCounter.store(sequence, std::memory_order::memory_order_release);
+		m_framesWritten.fetch_add(1, std::memory_order::memory_order_relaxed);
+		return true;
+	}
+
+	// Return a view of the frame _offset steps behind the front buffer,
+	// or an empty view if no such frame has been captured yet.
+	View read(int32_t _offset) const {
+		while (true) {
+			auto counter = m_indexCounter.load(std::memory_order::memory_order_acquire);
+			auto sequence = counter + _offset;
+			if (sequence < 1) {
+				return View();
+			}
+
+			auto& slot = m_slots[computeBufferIndex(sequence)];
+			if (pin(slot)) {
+				// The producer may have lapped us between loading the
+				// counter and pinning, in which case the slot now holds
+				// a newer frame than the one the offset asked for.
+				if (slot.sequence.load(std::memory_order::memory_order_relaxed) == sequence) {
+					return View(&slot, sequence);
+				}
+
+				slot.pins.fetch_sub(1, std::memory_order::memory_order_release);
+			}
+
+			m_readRetries.fetch_add(1, std::memory_order::memory_order_relaxed);
+		}
+	}
+
+	// Sequence number of the front buffer, 0 if nothing has been captured.
+	int32_t getSequence() const {
+		return m_indexCounter.load(std::memory_order::memory_order_acquire);
+	}
+
+	int32_t getNumberOfFrames() const {
+		return m_numOfFrames;
+	}
+
+	Stats getStats() const {
+		return {
+			m_framesWritten.load(std::memory_order::memory_order_relaxed),
+			m_framesDropped.load(std::memory_order::memory_order_relaxed),
+			m_reallocations.load(std::memory_order::memory_order_relaxed),
+			m_readRetries.load(std::memory_order::memory_order_relaxed)
+		};
+	}
+
+	FrameRing() : m_slots(nullptr), m_numOfFrames(0), m_numOfSlots(0) {
+
+	}
+
+	~FrameRing() {
+		shutdown();
+	}
+
+private:
+
+	Slot*					m_slots;
+	int32_t					m_numOfFrames;
+	int32_t					m_numOfSlots;
+
+	std::atomic<int32_t>	m_indexCounter;
+
+	std::atomic<uint64_t>			m_framesWritten;
+	std::atomic<uint64_t>			m_framesDropped;
+	std::atomic<uint64_t>			m_reallocations;
+	mutable std::atomic<uint64_t>	m_readRetries;
+
+	int32_t computeBufferIndex(int32_t _sequence) const {
+		return _sequence % m_numOfSlots;
+	}
+
+	// Increment the pin count, unless the producer owns the slot.
+	static bool pin(Slot& _slot) {
+		auto pins = _slot.pins.load(std::memory_order::memory_order_relaxed);
+		while (pins != WRITING) {
+			if (_slot.pins.compare_exchange_weak(pins, pins + 1,
+				std::memory_order::memory_order_acquire,
+				std::memory_order::memory_order_relaxed)) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+};
+
+#endif // FRAME_RING_H_HEADER_GUARD
@@ -0,0 +1,132 @@
+#include "frame_scheduler.h"
+#include "stage_profiler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+void FrameScheduler::init(int32_t _numOfWorkers) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closing = false;
+	}
+
+	for (int32_t i = 0; i < std::max(_numOfWorkers, 1); ++i) {
+		m_workers.emplace_back([this, i] {
+			// Traces keep the pointer, the name lives as long as the worker
+			std::string name = "scheduler " + std::to_string(i);
+			trace::setThreadName(name.c_str());
+			run();
+		});
+	}
+}
+
+void FrameScheduler::shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closing = true;
+	}
+
+	m_changed.notify_all();
+	for (auto& worker : m_workers) {
+		worker.join();
+	}
+
+	m_workers.clear();
+}
+
+int32_t FrameScheduler::add(Job _job, int64_t _due) {
+	int32_t id;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		id = int32_t(m_jobs.size());
+		m_jobs.push_back({ std::move(_job), _due, 0, false, false, { 0, 0, 0 } });
+	}
+
+	m_changed.notify_all();
+	return id;
+}
+
+void FrameScheduler::wake(int32_t _job) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto& entry = m_jobs[_job];
+		if (entry.isRunning) {
+			entry.isWoken = true;
+			return;
+		}
+
+		entry.due = std::min(entry.due, StageProfiler::now());
+	}
+
+	m_changed.notify_one();
+}
+
+FrameScheduler::JobStats FrameScheduler::getStats(int32_t _job) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_jobs[_job].stats;
+}
+
+int32_t FrameScheduler::getDefaultNumberOfWorkers() {
+	return std::max(int32_t(std::thread::hardware_concurrency()) - 1, 1);
+}
+
+void FrameScheduler::run() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_closing) {
+		Entry* next = nullptr;
+		for (auto& entry : m_jobs) {
+			if (entry.isRunning || entry.due == IDLE) {
+				continue;
+			}
+
+			if (!next || entry.due < next->due
+				|| (entry.due == next->due && entry.lastRun < next->lastRun)) {
+				next = &entry;
+			}
+		}
+
+		if (!next) {
+			m_changed.wait(lock);
+			continue;
+		}
+
+		// Wait for it to be due, or for anything to change meanwhile
+		int64_t now = StageProfiler::now();
+		if (next->due > now) {
+			m_changed.wait_for(lock, std::chrono::nanoseconds(next->due - now));
+			continue;
+		}
+
+		next->isRunning = true;
+		next->isWoken = false;
+		++next->stats.runs;
+		next->stats.lateness += now - next->due;
+
+		lock.unlock();
+		int64_t due = next->job(now);
+		int64_t end = StageProfiler::now();
+		lock.lock();
+
+		next->isRunning = false;
+		next->lastRun = end;
+		next->stats.busy += end - now;
+		next->due = next->isWoken ? std::min(due, end) : due;
+
+		// Another worker may be waiting for this very job
+		if (next->due != IDLE) {
+			m_changed.notify_all();
+		}
+	}
+}
+
+FrameScheduler::FrameScheduler() : m_closing(false) {
+
+}
+
+FrameScheduler::~FrameScheduler() {
+	if (!m_workers.empty()) {
+		shutdown();
+	}
+}
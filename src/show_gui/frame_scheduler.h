@@ -0,0 +1,83 @@
+#ifndef FRAME_SCHEDULER_H_HEADER_GUARD
+#define FRAME_SCHEDULER_H_HEADER_GUARD
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+// Fixed pool of workers running the recurring jobs of many frame sources,
+// typically the capture and the processing of each camera, so that the
+// number of threads depends on the pool and not on the sources.
+//
+// A job runs on one worker at a time, and returns when it is due next: a
+// frame period later, once its budget allows, or not until it is woken up.
+// Due jobs run earliest deadline first, and among equals the one which has
+// waited the longest, so that when the workers cannot keep up every source
+// falls behind by as much and none of them starves.
+class FrameScheduler {
+
+public:
+
+	// Run a job at _now, StageProfiler::now() nanoseconds, and return
+	// when it is due again on the same clock, or IDLE.
+	typedef std::function<int64_t(int64_t _now)> Job;
+
+	// Not due until woken up
+	static const int64_t IDLE = INT64_MAX;
+
+	struct JobStats {
+		uint64_t	runs;
+		int64_t		lateness;	// Nanoseconds between due and run, summed
+		int64_t		busy;		// Nanoseconds running
+	};
+
+	void init(int32_t _numOfWorkers);
+
+	// Wait for the running jobs to return, and run no more of them
+	void shutdown();
+
+	// Add a job, due at _due, and return its id. Jobs can be added
+	// before or after init, and stay until shutdown.
+	int32_t add(Job _job, int64_t _due = IDLE);
+
+	// Make the job due now. A job woken up while it runs is run again as
+	// soon as it returns, so that no wake up gets lost.
+	void wake(int32_t _job);
+
+	JobStats getStats(int32_t _job) const;
+
+	int32_t getNumberOfWorkers() const {
+		return int32_t(m_workers.size());
+	}
+
+	// One per core, but one for the render thread
+	static int32_t getDefaultNumberOfWorkers();
+
+	FrameScheduler();
+	~FrameScheduler();
+
+private:
+
+	void run();
+
+	struct Entry {
+		Job			job;
+		int64_t		due;
+		int64_t		lastRun;
+		bool		isRunning;
+		bool		isWoken;		// While running
+		JobStats	stats;
+	};
+
+	mutable std::mutex			m_mutex;
+	std::condition_variable		m_changed;
+	std::deque<Entry>			m_jobs;			// Guarded by m_mutex, and stable
+	std::vector<std::thread>	m_workers;
+	bool						m_closing;
+};
+
+#endif // FRAME_SCHEDULER_H_HEADER_GUARD
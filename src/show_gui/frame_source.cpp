@@ -0,0 +1,412 @@
+#include "frame_source.h"
+#include "memory_profiler.h"
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+	bool isDirectory(const std::string& _path) {
+		struct stat info;
+		return stat(_path.c_str(), &info) == 0 && (info.st_mode & S_IFDIR);
+	}
+
+	bool isImageFile(const std::string& _path) {
+		static const char* extensions[] = {
+			".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".ppm", ".pgm", ".webp"
+		};
+
+		auto dot = _path.find_last_of('.');
+		if (dot == std::string::npos) {
+			return false;
+		}
+
+		std::string extension = _path.substr(dot);
+		std::transform(extension.begin(), extension.end(), extension.begin(),
+			[](char _c) { return char(std::tolower(_c)); });
+
+		for (auto e : extensions) {
+			if (extension == e) {
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// Moving color gradient, so that consecutive frames differ
+	// and every stage of the pipeline has real work to do.
+	void drawTestPattern(cv::Mat& _image, int32_t _frame) {
+		for (int32_t y = 0; y < _image.rows; ++y) {
+			auto* p = _image.ptr<cv::Vec3b>(y);
+			for (int32_t x = 0; x < _image.cols; ++x) {
+				p[x] = cv::Vec3b(
+					uchar(x + _frame),
+					uchar(y + 2 * _frame),
+					uchar((x + y) / 2 - _frame));
+			}
+		}
+	}
+}
+
+CameraSource::CameraSource(int32_t _cameraId, cv::Size _frameSize, int32_t _fps)
+	: m_cameraId(_cameraId)
+	, m_frameSize(_frameSize)
+	, m_fps(_fps) {
+
+}
+
+bool CameraSource::open() {
+	if (!m_videoCapture.open(m_cameraId)) {
+		return false;
+	}
+
+	if (m_frameSize.area() > 0) {
+		m_videoCapture.set(CV_CAP_PROP_FRAME_WIDTH, (double)m_frameSize.width);
+		m_videoCapture.set(CV_CAP_PROP_FRAME_HEIGHT, (double)m_frameSize.height);
+	}
+
+	if (m_fps > 0) {
+		m_videoCapture.set(CV_CAP_PROP_FPS, (double)m_fps);
+	}
+
+	// What the camera has actually agreed on
+	m_frameSize = cv::Size(
+		(int32_t)m_videoCapture.get(CV_CAP_PROP_FRAME_WIDTH),
+		(int32_t)m_videoCapture.get(CV_CAP_PROP_FRAME_HEIGHT));
+	m_fps = (int32_t)m_videoCapture.get(CV_CAP_PROP_FPS);
+	return true;
+}
+
+void CameraSource::close() {
+	m_videoCapture.release();
+}
+
+bool CameraSource::grab() {
+	return m_videoCapture.isOpened() && m_videoCapture.grab();
+}
+
+bool CameraSource::retrieve(cv::Mat& _image) {
+	return m_videoCapture.retrieve(_image);
+}
+
+cv::Size CameraSource::getFrameSize() const {
+	return m_frameSize;
+}
+
+int32_t CameraSource::getFPS() const {
+	return m_fps;
+}
+
+int32_t CameraSource::getCameraId() const {
+	return m_cameraId;
+}
+
+std::string CameraSource::getDescription() const {
+	return "camera " + std::to_string(m_cameraId);
+}
+
+VideoFileSource::VideoFileSource(const std::string& _path, int32_t _fps, bool _loop)
+	: m_path(_path)
+	, m_fps(_fps)
+	, m_loop(_loop) {
+
+}
+
+bool VideoFileSource::open() {
+	if (!m_videoCapture.open(m_path)) {
+		return false;
+	}
+
+	m_frameSize = cv::Size(
+		(int32_t)m_videoCapture.get(CV_CAP_PROP_FRAME_WIDTH),
+		(int32_t)m_videoCapture.get(CV_CAP_PROP_FRAME_HEIGHT));
+
+	if (m_fps <= 0) {
+		m_fps = (int32_t)m_videoCapture.get(CV_CAP_PROP_FPS);
+	}
+
+	return true;
+}
+
+void VideoFileSource::close() {
+	m_videoCapture.release();
+}
+
+bool VideoFileSource::grab() {
+	if (!m_videoCapture.isOpened()) {
+		return false;
+	}
+
+	if (m_videoCapture.grab()) {
+		return true;
+	}
+
+	// Rewind once the video is over
+	if (m_loop) {
+		m_videoCapture.set(CV_CAP_PROP_POS_FRAMES, 0.0);
+		return m_videoCapture.grab();
+	}
+
+	return false;
+}
+
+bool VideoFileSource::retrieve(cv::Mat& _image) {
+	return m_videoCapture.retrieve(_image);
+}
+
+cv::Size VideoFileSource::getFrameSize() const {
+	return m_frameSize;
+}
+
+int32_t VideoFileSource::getFPS() const {
+	return m_fps;
+}
+
+std::string VideoFileSource::getDescription() const {
+	return "video " + m_path;
+}
+
+ImageSequenceSource::ImageSequenceSource(const std::string& _directory, int32_t _fps, bool _loop)
+	: m_directory(_directory)
+	, m_fps(_fps)
+	, m_current(-1)
+	, m_loop(_loop) {
+
+}
+
+bool ImageSequenceSource::open() {
+	// cv::glob returns the files sorted by name
+	std::vector<cv::String> files;
+	cv::glob(m_directory, files, false);
+
+	m_files.clear();
+	for (const auto& file : files) {
+		if (isImageFile(file)) {
+			m_files.push_back(file);
+		}
+	}
+
+	if (m_files.empty()) {
+		return false;
+	}
+
+	// The first image sets the size of the whole sequence
+	cv::Mat first = cv::imread(m_files.front(), cv::IMREAD_COLOR);
+	if (first.empty()) {
+		return false;
+	}
+
+	m_frameSize = first.size();
+	m_current = -1;
+	return true;
+}
+
+void ImageSequenceSource::close() {
+	m_files.clear();
+}
+
+bool ImageSequenceSource::grab() {
+	if (m_files.empty()) {
+		return false;
+	}
+
+	++m_current;
+	if (m_current >= (int32_t)m_files.size()) {
+		if (!m_loop) {
+			return false;
+		}
+
+		m_current = 0;
+	}
+
+	return true;
+}
+
+bool ImageSequenceSource::retrieve(cv::Mat& _image) {
+	if (m_current < 0 || m_current >= (int32_t)m_files.size()) {
+		return false;
+	}
+
+	cv::Mat image = cv::imread(m_files[m_current], cv::IMREAD_COLOR);
+	if (image.empty()) {
+		return false;
+	}
+
+	// Frames of a sequence must all have the same size
+	if (image.size() != m_frameSize) {
+		cv::resize(image, _image, m_frameSize);
+	}
+	else {
+		image.copyTo(_image);
+		memprof::countCopy(image.total() * image.elemSize());
+	}
+
+	return true;
+}
+
+cv::Size ImageSequenceSource::getFrameSize() const {
+	return m_frameSize;
+}
+
+int32_t ImageSequenceSource::getFPS() const {
+	return m_fps;
+}
+
+std::string ImageSequenceSource::getDescription() const {
+	return "images " + m_directory;
+}
+
+SyntheticSource::SyntheticSource(cv::Size _frameSize, int32_t _fps)
+	: m_frameSize(_frameSize)
+	, m_fps(_fps)
+	, m_frame(-1) {
+
+}
+
+bool SyntheticSource::open() {
+	m_frame = -1;
+	return m_frameSize.area() > 0;
+}
+
+void SyntheticSource::close() {
+
+}
+
+bool SyntheticSource::grab() {
+	++m_frame;
+	return true;
+}
+
+bool SyntheticSource::retrieve(cv::Mat& _image) {
+	_image.create(m_frameSize, CV_8UC3);
+	drawTestPattern(_image, m_frame);
+	return true;
+}
+
+cv::Size SyntheticSource::getFrameSize() const {
+	return m_frameSize;
+}
+
+int32_t SyntheticSource::getFPS() const {
+	return m_fps;
+}
+
+std::string SyntheticSource::getDescription() const {
+	return "synthetic " + std::to_string(m_frameSize.width) + "x" + std::to_string(m_frameSize.height);
+}
+
+PrefetchSource::PrefetchSource(std::unique_ptr<FrameSource> _source, int32_t _frames)
+	: m_source(std::move(_source))
+	, m_frames(std::max(_frames, 1))
+	, m_freeFrames(m_frames.size())
+	, m_readyFrames(m_frames.size())
+	, m_current(nullptr) {
+
+}
+
+PrefetchSource::~PrefetchSource() {
+	close();
+}
+
+bool PrefetchSource::open() {
+	if (!m_source->open()) {
+		return false;
+	}
+
+	for (auto& frame : m_frames) {
+		m_freeFrames.push(&frame);
+	}
+
+	m_thread = std::thread([this] {
+		run();
+	});
+
+	return true;
+}
+
+void PrefetchSource::close() {
+	m_freeFrames.close();
+	m_readyFrames.close();
+	if (m_thread.joinable()) {
+		m_thread.join();
+		m_source->close();
+	}
+}
+
+bool PrefetchSource::grab() {
+	// The previous frame has been retrieved, or skipped, by now
+	if (m_current) {
+		m_freeFrames.push(m_current);
+		m_current = nullptr;
+	}
+
+	return m_readyFrames.pop(m_current);
+}
+
+bool PrefetchSource::retrieve(cv::Mat& _image) {
+	if (!m_current) {
+		return false;
+	}
+
+	m_current->copyTo(_image);
+	memprof::countCopy(m_current->total() * m_current->elemSize());
+	return true;
+}
+
+cv::Size PrefetchSource::getFrameSize() const {
+	return m_source->getFrameSize();
+}
+
+int32_t PrefetchSource::getFPS() const {
+	return m_source->getFPS();
+}
+
+int32_t PrefetchSource::getCameraId() const {
+	return m_source->getCameraId();
+}
+
+std::string PrefetchSource::getDescription() const {
+	return m_source->getDescription() + " (prefetched)";
+}
+
+void PrefetchSource::run() {
+	cv::Mat* frame = nullptr;
+	while (m_freeFrames.pop(frame)) {
+		if (!m_source->read(*frame) || !m_readyFrames.push(frame)) {
+			break;
+		}
+	}
+
+	// Readers drain what is left, and then see the end of the stream
+	m_readyFrames.close();
+}
+
+std::unique_ptr<FrameSource> createFrameSource(const std::string& _input,
+	int32_t _cameraId, cv::Size _frameSize, int32_t _fps, bool _prefetch) {
+	if (_input.empty()) {
+		return std::unique_ptr<FrameSource>(new CameraSource(_cameraId, _frameSize, _fps));
+	}
+
+	std::unique_ptr<FrameSource> source;
+	if (_input == "synthetic") {
+		source.reset(new SyntheticSource(_frameSize, _fps));
+	}
+	else if (isDirectory(_input)) {
+		source.reset(new ImageSequenceSource(_input, _fps));
+	}
+	else {
+		source.reset(new VideoFileSource(_input, _fps));
+	}
+
+	if (!_prefetch) {
+		return source;
+	}
+
+	return std::unique_ptr<FrameSource>(new PrefetchSource(std::move(source)));
+}
@@ -0,0 +1,192 @@
+#ifndef FRAME_SOURCE_H_HEADER_GUARD
+#define FRAME_SOURCE_H_HEADER_GUARD
+
+#include "bounded_queue.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+// Where frames come from. Reading is split into grab and retrieve, like
+// cv::VideoCapture does, so that a frame can be consumed without being
+// decoded when there is nowhere to store it. Sources do not pace
+// themselves, whoever reads from them does, at getFPS() if positive.
+class FrameSource {
+
+public:
+
+	// Open the source, negotiating the requested frame size and rate
+	// where the source lets us choose them.
+	virtual bool open() = 0;
+	virtual void close() = 0;
+
+	// Move to the next frame, return false if there is none.
+	virtual bool grab() = 0;
+
+	// Decode the grabbed frame as 8-bit BGR into _image. The buffer of
+	// _image is reused whenever it has the right size and type already.
+	virtual bool retrieve(cv::Mat& _image) = 0;
+
+	bool read(cv::Mat& _image) {
+		return grab() && retrieve(_image);
+	}
+
+	virtual cv::Size getFrameSize() const = 0;
+	virtual int32_t getFPS() const = 0;
+
+	// Camera id, or -1 for sources other than cameras
+	virtual int32_t getCameraId() const {
+		return -1;
+	}
+
+	virtual std::string getDescription() const = 0;
+
+	virtual ~FrameSource() {
+
+	}
+};
+
+// Live camera, frames are buffered by the driver already.
+class CameraSource : public FrameSource {
+
+public:
+
+	// An empty size, or a non-positive fps, keeps the camera's defaults.
+	CameraSource(int32_t _cameraId, cv::Size _frameSize = cv::Size(), int32_t _fps = 0);
+
+	bool open() override;
+	void close() override;
+	bool grab() override;
+	bool retrieve(cv::Mat& _image) override;
+	cv::Size getFrameSize() const override;
+	int32_t getFPS() const override;
+	int32_t getCameraId() const override;
+	std::string getDescription() const override;
+
+private:
+
+	cv::VideoCapture	m_videoCapture;
+	int32_t				m_cameraId;
+	cv::Size			m_frameSize;
+	int32_t				m_fps;
+};
+
+// Video file, optionally replayed in a loop. Frames are played at the
+// given rate, or at the file's own one if that is not positive.
+class VideoFileSource : public FrameSource {
+
+public:
+
+	VideoFileSource(const std::string& _path, int32_t _fps = 0, bool _loop = true);
+
+	bool open() override;
+	void close() override;
+	bool grab() override;
+	bool retrieve(cv::Mat& _image) override;
+	cv::Size getFrameSize() const override;
+	int32_t getFPS() const override;
+	std::string getDescription() const override;
+
+private:
+
+	cv::VideoCapture	m_videoCapture;
+	std::string			m_path;
+	cv::Size			m_frameSize;
+	int32_t				m_fps;
+	bool				m_loop;
+};
+
+// Images of a directory, in file name order, optionally in a loop.
+// Each image is decoded on retrieve, and must all have the same size.
+class ImageSequenceSource : public FrameSource {
+
+public:
+
+	ImageSequenceSource(const std::string& _directory, int32_t _fps, bool _loop = true);
+
+	bool open() override;
+	void close() override;
+	bool grab() override;
+	bool retrieve(cv::Mat& _image) override;
+	cv::Size getFrameSize() const override;
+	int32_t getFPS() const override;
+	std::string getDescription() const override;
+
+private:
+
+	std::vector<cv::String>	m_files;
+	std::string				m_directory;
+	cv::Size				m_frameSize;
+	int32_t					m_fps;
+	int32_t					m_current;
+	bool					m_loop;
+};
+
+// Procedural test pattern at any size and rate. The pattern moves from
+// one frame to the next, so that every frame has real work to be done.
+class SyntheticSource : public FrameSource {
+
+public:
+
+	SyntheticSource(cv::Size _frameSize, int32_t _fps);
+
+	bool open() override;
+	void close() override;
+	bool grab() override;
+	bool retrieve(cv::Mat& _image) override;
+	cv::Size getFrameSize() const override;
+	int32_t getFPS() const override;
+	std::string getDescription() const override;
+
+private:
+
+	cv::Size	m_frameSize;
+	int32_t		m_fps;
+	int32_t		m_frame;
+};
+
+// Decode the frames of another source ahead of time on a background
+// thread, so that file decoding or pattern generation is not paid by the
+// thread reading frames. Up to _frames frames are kept ready; retrieve
+// copies the prefetched frame out, since its buffer is recycled.
+class PrefetchSource : public FrameSource {
+
+public:
+
+	PrefetchSource(std::unique_ptr<FrameSource> _source, int32_t _frames = 4);
+	~PrefetchSource();
+
+	bool open() override;
+	void close() override;
+	bool grab() override;
+	bool retrieve(cv::Mat& _image) override;
+	cv::Size getFrameSize() const override;
+	int32_t getFPS() const override;
+	int32_t getCameraId() const override;
+	std::string getDescription() const override;
+
+private:
+
+	void run();
+
+	std::unique_ptr<FrameSource>	m_source;
+	std::vector<cv::Mat>			m_frames;
+	BoundedQueue<cv::Mat*>			m_freeFrames;
+	BoundedQueue<cv::Mat*>			m_readyFrames;
+	cv::Mat*						m_current;
+	std::thread						m_thread;
+};
+
+// Source for the given input: a camera if the input is empty, a test
+// pattern for "synthetic", the images of a directory, or a video file.
+// All but cameras are prefetched on a background thread, unless whoever
+// reads from the source runs on a bounded pool of threads already.
+std::unique_ptr<FrameSource> createFrameSource(const std::string& _input,
+	int32_t _cameraId, cv::Size _frameSize, int32_t _fps, bool _prefetch = true);
+
+#endif // FRAME_SOURCE_H_HEADER_GUARD
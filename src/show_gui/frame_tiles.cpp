@@ -0,0 +1,157 @@
+#include "frame_tiles.h"
+#include "memory_profiler.h"
+#include "task_pool.h"
+
+#include <opencv2/core/utility.hpp>
+
+#include <algorithm>
+
+namespace {
+
+	class DetectBody : public cv::ParallelLoopBody {
+
+	public:
+
+		DetectBody(const TileGrid& _grid, const cv::Mat& _bgr, cv::Mat& _reference,
+			double _threshold, std::vector<uint8_t>& _changed)
+			: m_grid(_grid), m_bgr(_bgr), m_reference(_reference)
+			, m_threshold(_threshold), m_changed(_changed) {
+
+		}
+
+		void operator()(const cv::Range& _tiles) const override {
+			for (int32_t tile = _tiles.start; tile < _tiles.end; ++tile) {
+				auto rect = m_grid.getTileRect(tile);
+				auto src = m_bgr(rect);
+				auto ref = m_reference(rect);
+
+				// Vectorized by OpenCV, and exact on 8-bit images
+				double sad = cv::norm(src, ref, cv::NORM_L1);
+				bool changed = sad > m_threshold * rect.area() * m_bgr.channels();
+				if (changed) {
+					src.copyTo(ref);
+				}
+
+				m_changed[tile] = changed ? 1 : 0;
+			}
+		}
+
+	private:
+
+		const TileGrid&			m_grid;
+		const cv::Mat&			m_bgr;
+		cv::Mat&				m_reference;
+		double					m_threshold;
+		std::vector<uint8_t>&	m_changed;
+	};
+}
+
+void TileGrid::resize(cv::Size _imageSize) {
+	m_imageSize = _imageSize;
+	m_cols = (_imageSize.width + TILE_SIZE - 1) / TILE_SIZE;
+	m_rows = (_imageSize.height + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+cv::Rect TileGrid::getTileRect(int32_t _tile) const {
+	int32_t x = (_tile % m_cols) * TILE_SIZE;
+	int32_t y = (_tile / m_cols) * TILE_SIZE;
+	return cv::Rect(x, y,
+		std::min(TILE_SIZE, m_imageSize.width - x),
+		std::min(TILE_SIZE, m_imageSize.height - y));
+}
+
+void TileGrid::getRects(const std::vector<uint8_t>& _tiles, bool _flagged,
+	std::vector<cv::Rect>& _rects, int32_t _scale) const {
+	_rects.clear();
+
+	for (int32_t row = 0; row < m_rows; ++row) {
+		const uint8_t* tiles = _tiles.data() + row * m_cols;
+		int32_t y = row * TILE_SIZE;
+		int32_t height = std::min(TILE_SIZE, m_imageSize.height - y);
+
+		for (int32_t col = 0; col < m_cols; ) {
+			if ((tiles[col] != 0) != _flagged) {
+				++col;
+				continue;
+			}
+
+			int32_t first = col;
+			while (col < m_cols && (tiles[col] != 0) == _flagged) {
+				++col;
+			}
+
+			cv::Rect rect(first * TILE_SIZE, y,
+				std::min(col * TILE_SIZE, m_imageSize.width) - first * TILE_SIZE, height);
+
+			// Whole rows stack onto the previous whole rows
+			if (rect.width == m_imageSize.width && !_rects.empty()
+				&& _rects.back().width == m_imageSize.width
+				&& _rects.back().y + _rects.back().height == y) {
+				_rects.back().height += height;
+			}
+			else {
+				_rects.push_back(rect);
+			}
+		}
+	}
+
+	if (_scale > 1) {
+		// Tiles start on multiples of the scale, only their ends round down
+		size_t count = 0;
+		for (const auto& rect : _rects) {
+			cv::Rect scaled(rect.x / _scale, rect.y / _scale,
+				(rect.x + rect.width) / _scale - rect.x / _scale,
+				(rect.y + rect.height) / _scale - rect.y / _scale);
+			if (!scaled.empty()) {
+				_rects[count++] = scaled;
+			}
+		}
+
+		_rects.resize(count);
+	}
+}
+
+int32_t TileChangeDetector::detect(const cv::Mat& _bgr, bool _all, std::vector<uint8_t>& _changed,
+	TaskPool* _pool) {
+	if (_bgr.size() != m_grid.getImageSize()) {
+		m_grid.resize(_bgr.size());
+		_all = true;
+	}
+
+	const int32_t numOfTiles = m_grid.getNumberOfTiles();
+	_changed.resize(numOfTiles);
+
+	if (_all || !isEnabled()) {
+		std::fill(_changed.begin(), _changed.end(), uint8_t(1));
+		if (isEnabled()) {
+			_bgr.copyTo(m_reference);
+			memprof::countCopy(_bgr.total() * _bgr.elemSize());
+		}
+
+		return numOfTiles;
+	}
+
+	DetectBody body(m_grid, _bgr, m_reference, double(m_threshold), _changed);
+	if (_pool) {
+		// A few tasks per thread, for the idle ones to steal
+		const int32_t numOfTasks = std::min(numOfTiles, 4 * (_pool->getNumberOfWorkers() + 1));
+		_pool->parallelFor(numOfTasks, [&](int32_t _task) {
+			body(cv::Range(int32_t(int64_t(numOfTiles) * _task / numOfTasks),
+				int32_t(int64_t(numOfTiles) * (_task + 1) / numOfTasks)));
+		});
+	}
+	else {
+		cv::parallel_for_(cv::Range(0, numOfTiles), body);
+	}
+
+	// Changed tiles are copied by the workers, count them for the caller
+	if (memprof::isEnabled()) {
+		for (int32_t tile = 0; tile < numOfTiles; ++tile) {
+			if (_changed[tile] != 0) {
+				memprof::countCopy(m_grid.getTileRect(tile).area() * _bgr.elemSize());
+			}
+		}
+	}
+
+	return int32_t(std::count(_changed.begin(), _changed.end(), uint8_t(1)));
+}
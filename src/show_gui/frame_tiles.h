@@ -0,0 +1,94 @@
+#ifndef FRAME_TILES_H_HEADER_GUARD
+#define FRAME_TILES_H_HEADER_GUARD
+
+#include <opencv2/core.hpp>
+
+#include <vector>
+#include <cstdint>
+
+class TaskPool;
+
+// Square tiles covering a frame, the ones on the right and bottom edges
+// being cropped to the frame. Tiles are numbered row by row. The size of
+// a tile is a multiple of the scales images of the frame are reduced by,
+// so that tiles map to whole pixels of those images too.
+class TileGrid {
+
+public:
+
+	static const int32_t TILE_SIZE = 48;
+
+	void resize(cv::Size _imageSize);
+
+	cv::Size getImageSize() const {
+		return m_imageSize;
+	}
+
+	int32_t getNumberOfTiles() const {
+		return m_cols * m_rows;
+	}
+
+	cv::Rect getTileRect(int32_t _tile) const;
+
+	// Rectangles covering the tiles whose flag is _flagged, in as few
+	// rectangles as runs of neighbouring tiles allow: consecutive tiles of
+	// a row are merged, and so are consecutive rows which are whole. With
+	// a _scale, the rectangles are in the frame reduced by it, rounded down.
+	void getRects(const std::vector<uint8_t>& _tiles, bool _flagged,
+		std::vector<cv::Rect>& _rects, int32_t _scale = 1) const;
+
+	TileGrid() : m_cols(0), m_rows(0) {
+
+	}
+
+private:
+
+	cv::Size	m_imageSize;
+	int32_t		m_cols;
+	int32_t		m_rows;
+};
+
+// Tells which tiles of a BGR frame have changed since the previous one.
+//
+// Each tile is compared with a reference copy of the frame by the sum of
+// absolute differences, so that sensor noise can be told apart from an
+// actual change by a threshold. Only the tiles deemed changed are copied
+// into the reference, which then holds what the pipeline has processed:
+// small differences never add up over frames unnoticed.
+class TileChangeDetector {
+
+public:
+
+	// Mean absolute difference per channel above which a tile has changed,
+	// 0 for any difference. A negative threshold disables the detection,
+	// every tile of every frame is then reported as changed.
+	void setThreshold(int32_t _threshold) {
+		m_threshold = _threshold;
+	}
+
+	bool isEnabled() const {
+		return m_threshold >= 0;
+	}
+
+	// Flag the changed tiles of _bgr, and return how many there are. With
+	// _all, or when the frame size changes, every tile is flagged. Tiles
+	// are compared on _pool if given, on OpenCV's pool otherwise.
+	int32_t detect(const cv::Mat& _bgr, bool _all, std::vector<uint8_t>& _changed,
+		TaskPool* _pool = nullptr);
+
+	const TileGrid& getGrid() const {
+		return m_grid;
+	}
+
+	TileChangeDetector() : m_threshold(0) {
+
+	}
+
+private:
+
+	TileGrid	m_grid;
+	cv::Mat		m_reference;
+	int32_t		m_threshold;
+};
+
+#endif // FRAME_TILES_H_HEADER_GUARD
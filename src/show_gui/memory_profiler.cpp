@@ -0,0 +1,184 @@
+#include "memory_profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace memprof {
+
+#if ENABLE_MEMORY_PROFILER
+	namespace {
+
+		// Constant initialized, operator new may run before any constructor
+		struct AtomicCounters {
+			std::atomic<uint64_t>	allocations;
+			std::atomic<uint64_t>	allocatedBytes;
+			std::atomic<uint64_t>	copies;
+			std::atomic<uint64_t>	copiedBytes;
+		};
+
+		AtomicCounters s_counters[NUM_OF_SCOPES];
+
+		AtomicCounters& getCurrentCounters() {
+			return s_counters[StageProfiler::getCurrentStage()];
+		}
+	}
+
+	void countAllocation(size_t _bytes) {
+		auto& counters = getCurrentCounters();
+		counters.allocations.fetch_add(1, std::memory_order::memory_order_relaxed);
+		counters.allocatedBytes.fetch_add(_bytes, std::memory_order::memory_order_relaxed);
+	}
+
+	void countCopy(size_t _bytes) {
+		auto& counters = getCurrentCounters();
+		counters.copies.fetch_add(1, std::memory_order::memory_order_relaxed);
+		counters.copiedBytes.fetch_add(_bytes, std::memory_order::memory_order_relaxed);
+	}
+
+	Counters getCounters(int32_t _scope) {
+		const auto& counters = s_counters[_scope];
+		return {
+			counters.allocations.load(std::memory_order::memory_order_relaxed),
+			counters.allocatedBytes.load(std::memory_order::memory_order_relaxed),
+			counters.copies.load(std::memory_order::memory_order_relaxed),
+			counters.copiedBytes.load(std::memory_order::memory_order_relaxed)
+		};
+	}
+#endif
+
+	const char* getScopeName(int32_t _scope) {
+		return _scope < Stage::Count ? StageProfiler::getStageName(Stage::Enum(_scope)) : "other";
+	}
+
+	void FrameSampler::sample() {
+		for (int32_t scope = 0; scope < NUM_OF_SCOPES; ++scope) {
+			auto counters = getCounters(scope);
+			auto& previous = m_previous[scope];
+			auto& frame = m_lastFrame[scope];
+			auto& total = m_total[scope];
+			auto& max = m_max[scope];
+
+			frame = {
+				counters.allocations - previous.allocations,
+				counters.allocatedBytes - previous.allocatedBytes,
+				counters.copies - previous.copies,
+				counters.copiedBytes - previous.copiedBytes
+			};
+
+			previous = counters;
+
+			// The first sample spans the whole initialization, not a frame
+			if (m_frames == 0) {
+				continue;
+			}
+
+			total.allocations += frame.allocations;
+			total.allocatedBytes += frame.allocatedBytes;
+			total.copies += frame.copies;
+			total.copiedBytes += frame.copiedBytes;
+
+			max.allocations = std::max(max.allocations, frame.allocations);
+			max.allocatedBytes = std::max(max.allocatedBytes, frame.allocatedBytes);
+			max.copies = std::max(max.copies, frame.copies);
+			max.copiedBytes = std::max(max.copiedBytes, frame.copiedBytes);
+		}
+
+		++m_frames;
+	}
+
+	bool FrameSampler::writeJson(const char* _path) const {
+		FILE* file = std::fopen(_path, "w");
+		if (!file) {
+			return false;
+		}
+
+		const uint64_t frames = m_frames > 1 ? m_frames - 1 : 0;
+		const double divisor = frames > 0 ? double(frames) : 1.0;
+
+		std::fprintf(file, "{\n\t\"enabled\": %s,\n\t\"frames\": %llu,\n\t\"scopes\": [\n",
+			isEnabled() ? "true" : "false", (unsigned long long)frames);
+
+		for (int32_t scope = 0; scope < NUM_OF_SCOPES; ++scope) {
+			const auto& total = m_total[scope];
+			const auto& max = m_max[scope];
+			std::fprintf(file,
+				"\t\t{ \"name\": \"%s\""
+				", \"allocations\": %llu, \"allocated_bytes\": %llu"
+				", \"copies\": %llu, \"copied_bytes\": %llu"
+				", \"allocations_per_frame\": %.3f, \"allocated_bytes_per_frame\": %.1f"
+				", \"copied_bytes_per_frame\": %.1f"
+				", \"max_allocations_per_frame\": %llu, \"max_copied_bytes_per_frame\": %llu }%s\n",
+				getScopeName(scope),
+				(unsigned long long)total.allocations, (unsigned long long)total.allocatedBytes,
+				(unsigned long long)total.copies, (unsigned long long)total.copiedBytes,
+				total.allocations / divisor, total.allocatedBytes / divisor,
+				total.copiedBytes / divisor,
+				(unsigned long long)max.allocations, (unsigned long long)max.copiedBytes,
+				scope + 1 < NUM_OF_SCOPES ? "," : "");
+		}
+
+		std::fprintf(file, "\t]\n}\n");
+		return std::fclose(file) == 0;
+	}
+
+	FrameSampler::FrameSampler() : m_frames(0) {
+		for (int32_t scope = 0; scope < NUM_OF_SCOPES; ++scope) {
+			m_previous[scope] = m_lastFrame[scope] = m_total[scope] = m_max[scope] = { 0, 0, 0, 0 };
+		}
+	}
+}
+
+#if ENABLE_MEMORY_PROFILER
+
+// Every allocation of the program goes through these, counted against the
+// stage of the calling thread. Aligned allocations keep their defaults.
+void* operator new(size_t _size) {
+	memprof::countAllocation(_size);
+	if (void* ptr = std::malloc(_size != 0 ? _size : 1)) {
+		return ptr;
+	}
+
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t _size) {
+	return operator new(_size);
+}
+
+void* operator new(size_t _size, const std::nothrow_t&) noexcept {
+	memprof::countAllocation(_size);
+	return std::malloc(_size != 0 ? _size : 1);
+}
+
+void* operator new[](size_t _size, const std::nothrow_t& _tag) noexcept {
+	return operator new(_size, _tag);
+}
+
+void operator delete(void* _ptr) noexcept {
+	std::free(_ptr);
+}
+
+void operator delete[](void* _ptr) noexcept {
+	std::free(_ptr);
+}
+
+void operator delete(void* _ptr, size_t /*_size*/) noexcept {
+	std::free(_ptr);
+}
+
+void operator delete[](void* _ptr, size_t /*_size*/) noexcept {
+	std::free(_ptr);
+}
+
+void operator delete(void* _ptr, const std::nothrow_t&) noexcept {
+	std::free(_ptr);
+}
+
+void operator delete[](void* _ptr, const std::nothrow_t&) noexcept {
+	std::free(_ptr);
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef MEMORY_PROFILER_H_HEADER_GUARD
+#define MEMORY_PROFILER_H_HEADER_GUARD
+
+#include "stage_profiler.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Set by the SHOW_GUI_MEMORY_PROFILER CMake option
+#ifndef ENABLE_MEMORY_PROFILER
+#	define ENABLE_MEMORY_PROFILER 0
+#endif
+
+// Heap allocations and memory copies of the capture to display path,
+// broken down by the stage the calling thread is in, as scoped by
+// ScopedStageTimer.
+//
+// Profiling is opt-in at compile time. It replaces the global operator
+// new, which then counts every allocation of the program; matrices, which
+// OpenCV allocates with malloc, are counted by their allocator, and the
+// copies along the pipeline report their sizes. Work which OpenCV hands
+// over to its thread pool falls outside of the stages. Without it, all of
+// this compiles to nothing.
+namespace memprof {
+
+	// Each stage, and everything outside of them last
+	const int32_t NUM_OF_SCOPES = Stage::Count + 1;
+
+	struct Counters {
+		uint64_t	allocations;
+		uint64_t	allocatedBytes;
+		uint64_t	copies;
+		uint64_t	copiedBytes;
+	};
+
+	constexpr bool isEnabled() {
+		return ENABLE_MEMORY_PROFILER != 0;
+	}
+
+	const char* getScopeName(int32_t _scope);
+
+#if ENABLE_MEMORY_PROFILER
+	void countAllocation(size_t _bytes);
+	void countCopy(size_t _bytes);
+
+	// Totals of a scope since the program started
+	Counters getCounters(int32_t _scope);
+#else
+	inline void countAllocation(size_t /*_bytes*/) {
+
+	}
+
+	inline void countCopy(size_t /*_bytes*/) {
+
+	}
+
+	inline Counters getCounters(int32_t /*_scope*/) {
+		return { 0, 0, 0, 0 };
+	}
+#endif
+
+	// Counters per displayed frame, sampled by the render thread.
+	class FrameSampler {
+
+	public:
+
+		// Take the counters accumulated since the previous sample as a frame
+		void sample();
+
+		const Counters& getLastFrame(int32_t _scope) const {
+			return m_lastFrame[_scope];
+		}
+
+		// Write, for every scope, the totals over the sampled frames with
+		// the mean and maximum per frame, as JSON. Returns false on failure.
+		bool writeJson(const char* _path) const;
+
+		FrameSampler();
+
+	private:
+
+		Counters	m_previous[NUM_OF_SCOPES];
+		Counters	m_lastFrame[NUM_OF_SCOPES];
+		Counters	m_total[NUM_OF_SCOPES];
+		Counters	m_max[NUM_OF_SCOPES];
+		uint64_t	m_frames;
+	};
+}
+
+#endif // MEMORY_PROFILER_H_HEADER_GUARD
@@ -0,0 +1,177 @@
+#include "perf_counters.h"
+
+#include <bx/bx.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#if BX_PLATFORM_LINUX
+#	include <linux/perf_event.h>
+#	include <sys/ioctl.h>
+#	include <sys/syscall.h>
+#	include <unistd.h>
+#endif
+
+namespace perf {
+
+	namespace {
+
+		std::atomic<bool>	s_enabled(false);
+		char				s_reason[160] = "Not enabled";	// Written before s_enabled is
+
+#if BX_PLATFORM_LINUX
+		const uint64_t s_configs[Count] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES,
+		};
+
+		int32_t openCounter(uint64_t _config, int32_t _groupFd) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = _config;
+			attr.read_format = PERF_FORMAT_GROUP;
+			attr.disabled = _groupFd < 0 ? 1 : 0;
+
+			// User space only, which perf_event_paranoid up to 2 still allows
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			return int32_t(syscall(__NR_perf_event_open, &attr, 0, -1, _groupFd, PERF_FLAG_FD_CLOEXEC));
+		}
+
+		// Counter group of a thread, cycles leading
+		struct ThreadCounters {
+			int32_t		fds[Count];
+			int32_t		order[Count];	// Counter of each value in a group read
+			int32_t		numOfOpened;
+			int32_t		error;			// errno of the leader, if it failed to open
+			bool		isOpened;
+
+			bool open() {
+				isOpened = true;
+				fds[Cycles] = openCounter(s_configs[Cycles], -1);
+				if (fds[Cycles] < 0) {
+					error = errno;
+					return false;
+				}
+
+				order[numOfOpened++] = Cycles;
+				for (int32_t counter = Cycles + 1; counter < Count; ++counter) {
+					fds[counter] = openCounter(s_configs[counter], fds[Cycles]);
+					if (fds[counter] >= 0) {
+						order[numOfOpened++] = counter;
+					}
+				}
+
+				ioctl(fds[Cycles], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+				ioctl(fds[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+				return true;
+			}
+
+			bool read(Sample& _sample) {
+				if (!isOpened && !open()) {
+					return false;
+				}
+
+				if (fds[Cycles] < 0) {
+					return false;
+				}
+
+				// Group reads give the number of values, then the values
+				uint64_t values[1 + Count];
+				auto size = ::read(fds[Cycles], values, sizeof(uint64_t) * (1 + numOfOpened));
+				if (size <= 0 || int32_t(values[0]) != numOfOpened) {
+					return false;
+				}
+
+				_sample.valid = 0;
+				for (int32_t i = 0; i < numOfOpened; ++i) {
+					_sample.values[order[i]] = values[1 + i];
+					_sample.valid |= 1u << order[i];
+				}
+
+				return true;
+			}
+
+			ThreadCounters() : numOfOpened(0), error(0), isOpened(false) {
+				for (auto& fd : fds) {
+					fd = -1;
+				}
+			}
+
+			~ThreadCounters() {
+				for (auto fd : fds) {
+					if (fd >= 0) {
+						close(fd);
+					}
+				}
+			}
+		};
+
+		thread_local ThreadCounters t_counters;
+#endif
+	}
+
+	bool enable() {
+#if BX_PLATFORM_LINUX
+		Sample sample;
+		if (!t_counters.read(sample)) {
+			int32_t error = t_counters.error;
+			const char* hint = "";
+			if (error == EACCES || error == EPERM) {
+				hint = ", see /proc/sys/kernel/perf_event_paranoid";
+			}
+			else if (error == ENOENT || error == EOPNOTSUPP || error == ENODEV) {
+				hint = ", no hardware counters here";
+			}
+			else if (error == ENOSYS) {
+				hint = ", the system call is filtered out";
+			}
+
+			std::snprintf(s_reason, sizeof(s_reason), "perf_event_open: %s%s",
+				error != 0 ? std::strerror(error) : "cannot read counters", hint);
+			return false;
+		}
+
+		s_reason[0] = '\0';
+		s_enabled.store(true, std::memory_order::memory_order_release);
+		return true;
+#else
+		std::snprintf(s_reason, sizeof(s_reason), "Only available on Linux");
+		return false;
+#endif
+	}
+
+	bool isEnabled() {
+		return s_enabled.load(std::memory_order::memory_order_relaxed);
+	}
+
+	const char* getUnavailableReason() {
+		return s_reason;
+	}
+
+	bool read(Sample& _sample) {
+#if BX_PLATFORM_LINUX
+		return isEnabled() && t_counters.read(_sample);
+#else
+		BX_UNUSED(_sample);
+		return false;
+#endif
+	}
+
+	Sample subtract(const Sample& _end, const Sample& _start) {
+		Sample difference;
+		difference.valid = _end.valid & _start.valid;
+		for (int32_t counter = 0; counter < Count; ++counter) {
+			difference.values[counter] = _end.values[counter] - _start.values[counter];
+		}
+
+		return difference;
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef PERF_COUNTERS_H_HEADER_GUARD
+#define PERF_COUNTERS_H_HEADER_GUARD
+
+#include <cstdint>
+
+// Hardware performance counters of the calling thread, read through Linux
+// perf_event_open. Each thread opens its own counter group the first time
+// it reads it, so that counts are those of the thread only.
+//
+// Counters are often unavailable: other platforms, perf_event_paranoid,
+// containers and virtual machines without a PMU, seccomp filters. The
+// backend then stays disabled and tells why. A counter the hardware does
+// not have is left out of the group, and flagged as invalid in samples.
+namespace perf {
+
+	enum Counter {
+		Cycles,
+		Instructions,
+		CacheMisses,	// Last level cache
+		BranchMisses,
+
+		Count
+	};
+
+	struct Sample {
+		uint64_t	values[Count];
+		uint32_t	valid;			// One bit per counter read
+	};
+
+	// Check that counters can be opened, from the calling thread, and
+	// enable reading them if so. Returns whether they are enabled.
+	bool enable();
+
+	bool isEnabled();
+
+	// Why counters are not enabled, empty if they are
+	const char* getUnavailableReason();
+
+	// Counter values of the calling thread since it first read them.
+	// Returns false if counters are disabled or cannot be read.
+	bool read(Sample& _sample);
+
+	// Difference between two samples of the same thread
+	Sample subtract(const Sample& _end, const Sample& _start);
+}
+
+#endif // PERF_COUNTERS_H_HEADER_GUARD
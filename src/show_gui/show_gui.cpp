@@ -2,7 +2,6 @@
 #include <bx/uint32_t.h>
 #include <bx/string.h>
 #include <bx/crtimpl.h>
-#include <bx/spscqueue.h>
 #include <bgfx/bgfx.h>
 
 #include "entry/entry.h"
@@ -12,6 +11,20 @@
 #include "common.h"
 #include "bgfx_utils.h"
 #include "imgui_ext.h"
+#include "upload_pool.h"
+#include "frame_source.h"
+#include "stage_profiler.h"
+#include "trace.h"
+#include "color_classifier.h"
+#include "frame_tiles.h"
+#include "frame_arena.h"
+#include "memory_profiler.h"
+#include "camera_enumeration.h"
+#include "frame_scheduler.h"
+#include "task_pool.h"
+#include "umat_pipeline.h"
+#include "frame_provider.h"
+#include "frame_processor.h"
 
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
@@ -23,11 +36,20 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <memory>
 #include <atomic>
 #include <thread>
 #include <mutex>
-#include <shared_mutex>
+#include <chrono>
 #include <algorithm>
+#include <functional>
+#include <cmath>
+
+// Set by the show_gui_headless target, built on the entry library's noop
+// platform, which has no window
+#ifndef SHOW_GUI_HEADLESS
+#	define SHOW_GUI_HEADLESS 0
+#endif
 
 namespace {
 
@@ -47,12 +69,6 @@ namespace {
 		return (v < lo) ? lo : (hi < v) ? hi : v;
 	}
 
-	struct CameraInfo {
-		int32_t     id;
-		cv::Size    frameSize;
-		int32_t     fps;
-	};
-
 	struct OCLDevice {
 		int32_t		id;
 		std::string	name;
@@ -61,38 +77,17 @@ namespace {
 		bool		imageSupport;
 	};
 
-	std::vector<CameraInfo> enumerateCameras() {
-		std::vector<CameraInfo> cameras;
-
-		int32_t device_counts = 0;
-		while (true) {
-			cv::VideoCapture camera;
-			if (!camera.open(device_counts)) {
-				break;
-			}
-
-			cameras.push_back({
-				device_counts,
-				cv::Size(
-					(int32_t)camera.get(CV_CAP_PROP_FRAME_WIDTH),
-					(int32_t)camera.get(CV_CAP_PROP_FRAME_HEIGHT)),
-				(int32_t)camera.get(CV_CAP_PROP_FPS)
-			});
-			
-			++device_counts;
-			camera.release();
-		}
-
-		return cameras;
-	}
-
-	void printCameraInfo(const CameraInfo& camera) {
+	void printCameraDescription(const CameraDescription& camera) {
 		std::cout << std::endl
 			<< "Camera id: " << camera.id
-			<< " (" << camera.frameSize.width
-			<< "x" << camera.frameSize.height
-			<< "@" << camera.fps << ")"
+			<< " " << camera.name
+			<< " (" << describeCameraMode(camera.defaultMode) << ")"
+			<< (camera.fromCache ? ", cached" : "")
 			<< std::endl;
+
+		for (const auto& mode : camera.modes) {
+			std::cout << "\t" << describeCameraMode(mode) << std::endl;
+		}
 	}
 
 	std::string cvTypeToString(int type) {
@@ -170,6 +165,9 @@ namespace {
 		ImU32 u32Color = (color[0]) | (color[1] << 8) | (color[2] << 16) | (alpha << 24);
 		return ImGui::ColorConvertU32ToFloat4(u32Color);
 	}
+
+	// Default allocator of the matrices not bound to an arena or a pool
+	CountingMatAllocator s_heapMats;
 }
 
 class FrameOptions {
@@ -181,6 +179,7 @@ public:
 	bool enumCameras;
 	bool enumOCLDevices;
 	bool useMultiThreading;
+	bool headless;
 
 	int32_t clDevice;
 	int32_t numOfFrames;
@@ -191,6 +190,39 @@ public:
 	int32_t frameHeight;
 	int32_t requestedFPS;
 
+	std::string input;
+	int32_t headlessFrames;
+
+	std::string statsCsv;
+	std::string tracePath;
+	std::string memoryJson;
+	bool perfCounters;
+
+	int32_t lutBits;
+	int32_t tileThreshold;
+	std::string textureFormat;
+	bool arenaHugePages;
+	std::string cameraCache;
+	bool refreshCameras;
+	int32_t cameraProbeTimeout;
+
+	// A source of the grid, a camera or any other input, processed at
+	// most at budget frames per second, if positive.
+	struct SourceOptions {
+		std::string	input;
+		int32_t		cameraId;
+		int32_t		budget;
+	};
+
+	std::vector<SourceOptions> sources;
+	int32_t workers;
+	std::string dropPolicy;
+
+	int32_t bandThreads;
+	std::vector<int32_t> affinity;
+	bool tiled;
+	bool keepOpenCVThreads;
+
 	// Parse command line arguments and set relevant properties.
 	// Return false if any argument is invalid, true otherwise.
 	bool init(int _argc, char** _argv) {
@@ -198,11 +230,32 @@ public:
 			"{help usage h| |Program usage}"
 			"{opencv-info v| |OpenCV build info}"
 			"{enumerate-cameras c| |Enumerates available cameras}"
+			"{camera-cache|auto|Cache of the enumerated cameras, 'auto' for the user's cache directory, 'none' for no cache}"
+			"{refresh-cameras| |Probe cameras again rather than using the cache}"
+			"{camera-probe-timeout|3000|Time each camera has to be probed in, in milliseconds}"
 			"{enumerate-ocl-devices l| |Enumerates OpenCL devices}"
-			"{opencl-device d|-1|Whether to use OpenCL device}"
+			"{opencl-device d|-1|OpenCL device, as enumerated, frames are processed on if faster than the CPU, -1 for none}"
 			"{frames-buffer f|2|Number of frames to hold in the buffer}"
 			"{frame-offset o|-1|Offset into the frame's buffer}"
 			"{multi-threaded m| |Enable multi-threading}"
+			"{input i| |Video file or image directory to read frames from, or 'synthetic' for a test pattern}"
+			"{headless| |Run on the Noop renderer without GUI events, and print timings. The window still opens, show_gui_headless runs without a display}"
+			"{headless-frames|600|Number of frames to run in headless mode}"
+			"{stats-csv| |Stream per-stage timing samples to the given CSV file}"
+			"{trace| |Trace from start to exit into the given Chrome trace JSON file}"
+			"{memory-json| |Write per-stage heap allocations and copies per frame at exit into the given JSON file}"
+			"{perf-counters| |Sample hardware counters around each stage, Linux only}"
+			"{lut-bits|6|Bits per channel of the color classes lookup table, 4 to 8}"
+			"{tile-threshold|0|Mean absolute difference per channel above which a tile has changed, negative to process and upload whole frames}"
+			"{texture-format|auto|Format camera frames are uploaded in: auto, bgra8, rgb8 or rgba8}"
+			"{arena-huge-pages| |Back the frame temporaries with huge pages where available}"
+			"{sources| |Comma separated sources to show at once in a grid, each a camera id, 'synthetic', a video file or an image directory, optionally followed by @fps, the most frames per second it is processed at}"
+			"{workers|0|Threads the sources are captured and processed on, 0 for one per core but the render thread's}"
+			"{drop-policy|latest|Frames a source processes once it falls behind: latest, or oldest in capture order}"
+			"{band-threads|-1|Threads frames are processed on in bands of rows besides the caller, -1 for one per core but the caller's, 0 to leave the parallelism to OpenCV}"
+			"{affinity|none|CPUs the band threads are pinned to: none, compact for one each, or a comma separated list of CPUs}"
+			"{tiled| |Process frames in blocks of tiles which fit in a core's cache, with per-thread scratch intermediates, rather than in bands of rows}"
+			"{keep-opencv-threads| |Keep OpenCV's pool along with the band threads: the kernels of a band fork again onto it, but OpenCV calls outside of bands, such as picking, stay parallel}"
 			"{@camera|0|Camera to show}"
 			"{@width|640|Desired frame width}"
 			"{@height|360|Desired frame height}"
@@ -220,8 +273,12 @@ public:
 		printUsage = m_parser->has("usage");
 		cvInfo = m_parser->has("opencv-info");
 		enumCameras = m_parser->has("enumerate-cameras");
+		refreshCameras = m_parser->has("refresh-cameras");
 		enumOCLDevices = m_parser->has("enumerate-ocl-devices");
 		useMultiThreading = m_parser->has("multi-threaded");
+		headless = SHOW_GUI_HEADLESS || m_parser->has("headless");
+		tiled = m_parser->has("tiled");
+		keepOpenCVThreads = m_parser->has("keep-opencv-threads");
 
 		// OpenCL device to use. -1 means no OpenCL process
 		clDevice = m_parser->get<int32_t>("opencl-device");
@@ -236,248 +293,121 @@ public:
 		frameHeight = m_parser->get<int32_t>("@height");
 		requestedFPS = m_parser->get<int32_t>("@fps");
 
-		return true;
-	}
-
-	void printUsageMessage() {
-		m_parser->printMessage();
-	}
-
-	FrameOptions() : m_parser(nullptr) {
-
-	}
-
-	virtual ~FrameOptions() {
-		delete m_parser;
-	}
-
-private:
-
-	cv::CommandLineParser* m_parser;
-};
-
-class FrameProcessor {
-
-public:
-
-	bool init(int32_t _oclDeviceId = -1,
-		int32_t _deviceType = cv::ocl::Device::TYPE_ALL) {
-		m_oclDeviceId = _oclDeviceId;
-
-		if (m_oclDeviceId >= 0) {
-			auto devices = enumerateOpenCLDevices();
-			if (devices.size() > m_oclDeviceId) {
-				m_oclContext = cv::ocl::Context();
-				m_oclContext.create(_deviceType);
-				cv::ocl::Device(m_oclContext.device(m_oclDeviceId));
-			}
-			else {
-				m_oclDeviceId = -1; // Disable OpenCL device
-			}
+		// Frames can come from a video file, a directory of images, or be generated instead
+		input = m_parser->has("input") ? m_parser->get<std::string>("input") : std::string();
+		headlessFrames = std::max(m_parser->get<int32_t>("headless-frames"), 1);
+
+		// Raw per-stage samples for offline analysis
+		statsCsv = m_parser->has("stats-csv") ? m_parser->get<std::string>("stats-csv") : std::string();
+		tracePath = m_parser->has("trace") ? m_parser->get<std::string>("trace") : std::string();
+		memoryJson = m_parser->has("memory-json") ? m_parser->get<std::string>("memory-json") : std::string();
+		perfCounters = m_parser->has("perf-counters");
+
+		lutBits = clamp(m_parser->get<int32_t>("lut-bits"), 4, 8);
+		tileThreshold = m_parser->get<int32_t>("tile-threshold");
+		textureFormat = m_parser->get<std::string>("texture-format");
+		arenaHugePages = m_parser->has("arena-huge-pages");
+
+		// Enumerated cameras are kept from one run to the next
+		cameraCache = m_parser->get<std::string>("camera-cache");
+		if (cameraCache == "auto") {
+			cameraCache = getDefaultCameraCachePath();
 		}
-		
-		// Enable OpenCL if requested
-		cv::ocl::setUseOpenCL(!(m_oclDeviceId < 0));
-		return false;
-	}
-
-	void process() {
-		if (m_oclDeviceId >= 0) {
-			cv::ocl::Device(m_oclContext.device(m_oclDeviceId));
+		else if (cameraCache == "none") {
+			cameraCache.clear();
 		}
-	}
-
-	void push(const cv::Mat& _frame) {
-
-	}
-
-	const cv::Mat& pop() {
-
-	}
-
-private:
-
-	bx::SpScUnboundedQueueT<cv::UMat>	m_framesQueue;
-	cv::ocl::Context					m_oclContext;
-	int32_t 							m_oclDeviceId;
 
-};
-
-class FrameProvider {
-
-public:
-
-	bool init(int32_t _cameraId, int32_t _frameWidth, int32_t _frameHeight, int32_t _fps,
-		int32_t _frames, int32_t _offset, bool _isMultiThreaded) {
-		// Get the maximum number of frames we want to store into the frame's buffer
-		m_numOfFrames = clamp(_frames, 1, 64);
-		m_cameraFrames = new Frame[m_numOfFrames];
-
-		m_frameOffset = clamp(_offset, -(m_numOfFrames -1), 0);
+		cameraProbeTimeout = std::max(m_parser->get<int32_t>("camera-probe-timeout"), 0);
+
+		// Sources shown at once, each one "input[@fps]"
+		sources.clear();
+		std::string sourceList = m_parser->has("sources") ? m_parser->get<std::string>("sources") : std::string();
+		size_t start = 0;
+		while (start < sourceList.size()) {
+			size_t end = std::min(sourceList.find(',', start), sourceList.size());
+			std::string item = sourceList.substr(start, end - start);
+			start = end + 1;
+			if (item.empty()) {
+				continue;
+			}
 
-		// Create a camera info for the given command line's arguments
-		if (!m_videoCapture.open(_cameraId)) {
-			std::cerr << "Requested camera " << _cameraId << " is not available!" << std::endl;
-			return false;
-		}
+			SourceOptions source = { item, 0, 0 };
+			auto at = item.find_last_of('@');
+			if (at != std::string::npos) {
+				source.input = item.substr(0, at);
+				source.budget = std::max(std::atoi(item.c_str() + at + 1), 0);
+			}
 
-		m_videoCapture.set(CV_CAP_PROP_FRAME_WIDTH, (double)_frameWidth);
-		m_videoCapture.set(CV_CAP_PROP_FRAME_HEIGHT, (double)_frameHeight);
-		m_videoCapture.set(CV_CAP_PROP_FPS, (double)_fps);
-		
-		m_cameraInfo = {
-			_cameraId,
-			cv::Size(
-				(int32_t)m_videoCapture.get(CV_CAP_PROP_FRAME_WIDTH),
-				(int32_t)m_videoCapture.get(CV_CAP_PROP_FRAME_HEIGHT)),
-			(int32_t)m_videoCapture.get(CV_CAP_PROP_FPS)
-		};
+			// Cameras are given by their id
+			if (!source.input.empty() && source.input.find_first_not_of("0123456789") == std::string::npos) {
+				source.cameraId = std::atoi(source.input.c_str());
+				source.input.clear();
+			}
 
-		m_process.test_and_set(std::memory_order::memory_order_acq_rel);
-		m_capture.store(false, std::memory_order::memory_order_relaxed);
-		m_indexCounter.store(0, std::memory_order::memory_order_release);
-
-		// If multi-threading is enabled, create a
-		// thread and execute here the tick funciton.
-		m_isMultiThreaded = _isMultiThreaded;
-		if (m_isMultiThreaded) {
-			m_captureThread = std::thread([this]{
-				while(m_process.test_and_set(std::memory_order::memory_order_acq_rel)) {
-					this->tick();
-				}
-			});
+			sources.push_back(source);
 		}
 
-		return true;
-	}
-
-	// Retuns whether a new image has been added into the buffer.
-	bool tick() {
-		if (m_capture.load(std::memory_order::memory_order_relaxed)) {
-			
-			cv::Mat cameraFrame;
-			if (m_videoCapture.isOpened() && m_videoCapture.read(cameraFrame)) {
-				// Write into the back buffer, which in our case
-				// technically is the following available frame in the buffer
-				auto backIndex = computeBufferIndex(m_indexCounter + 1);
-				auto& frame = m_cameraFrames[backIndex];
-				frame.write(cameraFrame);
-
-				// The following operation will not necessarly make
-				// variables visible and consistent to the rest of
-				// the threads, e.g ARM architecture, if it wasn't
-				// for the release memory order.
-				// Being the index an atomic object it guarantees
-				// that two threads, querying the buffer before the
-				// next write is issued, will see the same result,
-				// and therefore, they will process the same image.
-				m_indexCounter.fetch_add(1, std::memory_order::memory_order_release);
-				return true;
-			}
+		// Never more workers than cores, whatever the number of sources
+		const int32_t numOfCores = std::max(int32_t(std::thread::hardware_concurrency()), 1);
+		workers = m_parser->get<int32_t>("workers");
+		workers = workers > 0 ? std::min(workers, numOfCores) : FrameScheduler::getDefaultNumberOfWorkers();
+		if (!useMultiThreading) {
+			workers = 1;
 		}
 
-		return false;
-	}
+		dropPolicy = m_parser->get<std::string>("drop-policy");
 
-	void shutdown() {
-		m_process.clear(std::memory_order::memory_order_release);
-		if (m_captureThread.joinable()) {
-			m_captureThread.join();
+		// Frames are processed in bands on a pool of our own, in place of
+		// OpenCV's, unless sources already spread over the cores.
+		bandThreads = m_parser->get<int32_t>("band-threads");
+		if (bandThreads < 0) {
+			bandThreads = sources.empty() ? TaskPool::getDefaultNumberOfWorkers() : 0;
 		}
 
-		delete[] m_cameraFrames;
-	}
+		bandThreads = std::min(bandThreads, numOfCores);
 
-	void capture(bool _onOff) {
-		m_capture.store(_onOff, std::memory_order::memory_order_relaxed);
-		if (!m_isMultiThreaded) {
-			tick();
+		affinity.clear();
+		std::string affinityList = m_parser->get<std::string>("affinity");
+		if (affinityList == "compact") {
+			// The first CPU is left to the thread which forks
+			auto cpus = TaskPool::getAvailableCpus();
+			for (size_t i = 1; i <= cpus.size(); ++i) {
+				affinity.push_back(cpus[i % cpus.size()]);
+			}
 		}
-	}
+		else if (affinityList != "none") {
+			start = 0;
+			while (start < affinityList.size()) {
+				size_t end = std::min(affinityList.find(',', start), affinityList.size());
+				std::string cpu = affinityList.substr(start, end - start);
+				start = end + 1;
+				if (cpu.empty() || cpu.find_first_not_of("0123456789") != std::string::npos) {
+					std::cout << "Invalid CPU in affinity: '" << cpu << "'" << std::endl;
+					return false;
+				}
 
-	// Return a copy of the current front-buffer camera's capture
-	cv::Mat getCameraFrame(int32_t _offset = 1) const {
-		// An offset greater than 0 indicates that we want to use
-		// the value passed as argument to the command line.
-		if (_offset > 0) {
-			_offset = m_frameOffset;
+				affinity.push_back(std::atoi(cpu.c_str()));
+			}
 		}
 
-		auto steps = clamp(_offset, -(m_numOfFrames -1), 0);
-		auto index = getBufferIndexByOffset(steps);
-		return m_cameraFrames[index].read();
-	}
-
-	const CameraInfo& getCameraInfo() const {
-		return m_cameraInfo;
-	}
-
-	bool isMultiThreaded() const {
-		return m_isMultiThreaded;
+		return true;
 	}
 
-	int32_t getNumberOfFramesInBuffer() const {
-		return m_numOfFrames;
+	void printUsageMessage() {
+		m_parser->printMessage();
 	}
 
-	FrameProvider() : m_cameraFrames(nullptr) {
+	FrameOptions() : m_parser(nullptr) {
 
 	}
 
-	virtual ~FrameProvider() {
-
+	virtual ~FrameOptions() {
+		delete m_parser;
 	}
 
 private:
-	
-	class Frame {
-		cv::Mat				m_imageBGR;
-		std::shared_mutex	m_rwMutex;
-
-	public:
-		cv::Mat read() {
-			m_rwMutex.lock_shared();
-			auto image = m_imageBGR.clone();
-			m_rwMutex.unlock_shared();
-			return image;
-		}
-
-		void write(const cv::Mat& _image) {
-			m_rwMutex.lock();
-			m_imageBGR = _image.clone();
-			m_rwMutex.unlock();
-		}
-	};
-
-	cv::VideoCapture		m_videoCapture;
-	
-	Frame*					m_cameraFrames;
-	CameraInfo				m_cameraInfo;
-
-	std::thread				m_captureThread;
-
-	std::atomic_flag		m_process;
-	std::atomic<bool>		m_capture;
-
-	std::atomic<int32_t>	m_indexCounter;
-	int32_t					m_numOfFrames;
-	int32_t					m_frameOffset;
-	bool					m_isMultiThreaded;
-
-	int32_t computeBufferIndex(int32_t _value) const {
-		return _value % m_numOfFrames;
-	}
 
-	int32_t getBufferIndexByOffset(int32_t _offset) const {
-		auto counter = m_indexCounter.load(std::memory_order::memory_order_acquire);
-		auto index = counter + _offset;
-		if (index >= 0) {
-			return computeBufferIndex(index);
-		}
-		else {
-			return m_numOfFrames + index;
-		}
-	}
+	cv::CommandLineParser* m_parser;
 };
 
 class ShowGUI : public entry::AppI {
@@ -569,7 +499,14 @@ class ShowGUI : public entry::AppI {
 		m_debug  = BGFX_DEBUG_TEXT;
 		m_reset  = BGFX_RESET_VSYNC;
 
-		bgfx::init(args.m_type, args.m_pciId);
+		// Headless runs go through the whole frame, bar the GPU work
+		if (m_frameOptions.headless) {
+			bgfx::init(bgfx::RendererType::Noop);
+		}
+		else {
+			bgfx::init(args.m_type, args.m_pciId);
+		}
+
 		bgfx::reset(m_width, m_height, m_reset);
 
 		// Enable debug text.
@@ -592,6 +529,61 @@ class ShowGUI : public entry::AppI {
 		return EXIT_SUCCESS;
 	}
 
+	static int cmdTrace(CmdContext* /*_context*/, void* /*_userData*/, int _argc, char const* const* _argv)
+	{
+		if (_argc > 1)
+		{
+			if (0 == bx::strCmp(_argv[1], "start")) {
+				trace::start();
+				return EXIT_SUCCESS;
+			}
+			else if (0 == bx::strCmp(_argv[1], "stop")) {
+				return stopTrace(_argc > 2 ? _argv[2] : "show_gui_trace.json")
+					? EXIT_SUCCESS : EXIT_FAILURE;
+			}
+		}
+
+		return EXIT_FAILURE;
+	}
+
+	static bool stopTrace(const char* _path) {
+		auto events = trace::stop(_path);
+		if (events < 0) {
+			std::cerr << "Cannot write trace to " << _path << std::endl;
+			return false;
+		}
+
+		std::cout << "Trace of " << events << " events written to " << _path << std::endl;
+		return true;
+	}
+
+	static int cmdPick(CmdContext* /*_context*/, void* _userData, int _argc, char const* const* _argv)
+	{
+		if (_argc > 1)
+		{
+			auto* _this = static_cast<ShowGUI*>(_userData);
+
+			if (0 == bx::strCmp(_argv[1], "next")) {
+				_this->m_pickedClass = (_this->m_pickedClass + 1) % ColorClassifier::MAX_CLASSES;
+				_this->m_lastPick.colorSpaceCode = -1;
+				return EXIT_SUCCESS;
+			}
+			else if (0 == bx::strCmp(_argv[1], "clear")) {
+				_this->m_colorClassifier.clearAll();
+				_this->m_pickedClass = 0;
+				_this->m_lastPick.colorSpaceCode = -1;
+				return EXIT_SUCCESS;
+			}
+			else if (0 == bx::strCmp(_argv[1], "class") && _argc > 2) {
+				_this->m_pickedClass = clamp(std::atoi(_argv[2]), 0, ColorClassifier::MAX_CLASSES - 1);
+				_this->m_lastPick.colorSpaceCode = -1;
+				return EXIT_SUCCESS;
+			}
+		}
+
+		return EXIT_FAILURE;
+	}
+
 	static int cmdShow(CmdContext* /*_context*/, void* _userData, int _argc, char const* const* _argv)
 	{
 		if (_argc > 1)
@@ -629,11 +621,15 @@ class ShowGUI : public entry::AppI {
 
 	virtual void init(int _argc, char** _argv) override	{
 		setState(NONE);
+		trace::setThreadName("update");
 
 		if (!m_frameOptions.init(_argc, _argv)) {
 			addState(EXIT_REQUEST);
 		}
 
+		// Count the matrices still allocated from the heap
+		cv::Mat::setDefaultAllocator(&s_heapMats);
+
 		// Parse possible exit options
 		{
 			if (m_frameOptions.printUsage) {
@@ -647,18 +643,36 @@ class ShowGUI : public entry::AppI {
 			}
 
 			if (m_frameOptions.enumCameras) {
-				auto cameras = enumerateCameras();
-
-				if (!cameras.empty()) {
+				auto enumeration = enumerateCameras({
+					m_frameOptions.cameraCache,
+					m_frameOptions.cameraProbeTimeout,
+					8,
+					m_frameOptions.refreshCameras
+				});
+
+				if (!enumeration.cameras.empty()) {
 					std::cout << "-- Available cameras --" << std::endl;
-					for (auto camera : cameras) {
-						printCameraInfo(camera);
+					for (const auto& camera : enumeration.cameras) {
+						printCameraDescription(camera);
 					}
+
+					std::cout << std::endl
+						<< enumeration.numOfCached << " from the cache, "
+						<< enumeration.numOfProbed << " probed" << std::endl;
 				}
 				else {
 					std::cout << "!! No camera available !!" << std::endl;
 				}
 
+				for (auto id : enumeration.timedOut) {
+					std::cout << "!! Camera " << id << " did not answer in time, unusable for this run !!" << std::endl;
+				}
+
+				// Not to exit from under a probe which still has a device open
+				for (auto id : waitForCameraProbes(m_frameOptions.cameraProbeTimeout)) {
+					std::cout << "!! Camera " << id << " is still being probed, it may stay open until exit !!" << std::endl;
+				}
+
 				std::cout << std::flush;
 				addState(EXIT_REQUEST);
 			}
@@ -685,51 +699,158 @@ class ShowGUI : public entry::AppI {
 			}
 		}
 
-		if (!m_frameProvider.init(
-			m_frameOptions.cameraId,
-			m_frameOptions.frameWidth,
-			m_frameOptions.frameHeight,
-			m_frameOptions.requestedFPS,
-			m_frameOptions.numOfFrames,
-			m_frameOptions.frameOffset,
-			m_frameOptions.useMultiThreading
-		)) {
-			addState(EXIT_REQUEST);
-			std::exit(EXIT_FAILURE);
+		if (!m_frameOptions.tracePath.empty()) {
+			trace::start();
 		}
 
-		addState(OPENCV_INIT);
+		if (!m_frameOptions.statsCsv.empty()
+			&& !m_stageProfiler.openCsv(m_frameOptions.statsCsv)) {
+			std::cerr << "Cannot write stage timings to " << m_frameOptions.statsCsv << std::endl;
+		}
+
+		// Before the pipeline starts, its threads open their counters on first use
+		if (m_frameOptions.perfCounters && !perf::enable()) {
+			std::cout << "Hardware counters unavailable: " << perf::getUnavailableReason() << std::endl;
+		}
+
+		// Many sources share a scheduler, which bounds the number of threads;
+		// a single one has threads of its own when multi-threaded.
+		std::vector<FrameOptions::SourceOptions> sources = m_frameOptions.sources;
+		const bool isScheduled = !sources.empty();
+		if (!isScheduled) {
+			sources.push_back({ m_frameOptions.input, m_frameOptions.cameraId, 0 });
+		}
+		else {
+			m_scheduler.init(m_frameOptions.workers);
+		}
 
+		for (const auto& options : sources) {
+			std::unique_ptr<SourceView> source(new SourceView());
+			if (!source->provider.init(
+				createFrameSource(
+					options.input,
+					options.cameraId,
+					cv::Size(m_frameOptions.frameWidth, m_frameOptions.frameHeight),
+					m_frameOptions.requestedFPS,
+					!isScheduled),
+				m_frameOptions.numOfFrames,
+				m_frameOptions.frameOffset,
+				m_frameOptions.useMultiThreading && !isScheduled,
+				&m_stageProfiler
+			)) {
+				addState(EXIT_REQUEST);
+				std::exit(EXIT_FAILURE);
+			}
+
+			if (isScheduled) {
+				source->provider.schedule(&m_scheduler);
+			}
+
+			source->budget = options.budget;
+			m_sources.push_back(std::move(source));
+		}
+
+		m_selectedSource = 0;
+
+		m_colorClassifier.init(m_frameOptions.lutBits);
+
+		// The renderer decides on the format channel previews are packed in
 		initBgfx(_argc, _argv);
 		addState(BGFX_INIT);
 
 		initGUI(_argc, _argv);
 		addState(GUI_INIT);
 
-		auto cameraInfo = m_frameProvider.getCameraInfo();
-
-		// Create the texture to hold camera input image
-		m_texRGBA = bgfx::createTexture2D(
-			cameraInfo.frameSize.width,						// width
-			cameraInfo.frameSize.height,					// height
-			false, 											// no mip-maps
-			1,												// number of layers
-			bgfx::TextureFormat::Enum::RGBA8,				// format
-			BGFX_TEXTURE_U_CLAMP | BGFX_TEXTURE_V_CLAMP,	// flags
-			nullptr											// mutable
-		);
+		// A8 takes a byte per preview pixel. Since it samples as black with
+		// the value as alpha, previews are stored as coverage and drawn over
+		// white. Renderers without A8 fall back to gray RGBA.
+		m_isAtlasCoverage = isTextureFormatSupported(bgfx::TextureFormat::A8);
+		m_displayFormat = chooseDisplayFormat(m_frameOptions.textureFormat);
+
+		// OpenCV's pool makes way for the band pool, before processors use
+		// it, unless asked to stay. Either way the choice is process-wide.
+		m_bandPool.init(m_frameOptions.bandThreads, m_frameOptions.affinity, !m_frameOptions.keepOpenCVThreads);
+
+		// Processors try OpenCL against the CPU on the device requested, if any
+		if (UMatPipeline::selectDevice(m_frameOptions.clDevice)) {
+			m_openCLDevice = UMatPipeline::getDeviceName();
+		}
+		else if (m_frameOptions.clDevice >= 0) {
+			std::cout << "OpenCL device " << m_frameOptions.clDevice << " is not available" << std::endl;
+		}
+
+		const DropPolicy dropPolicy = m_frameOptions.dropPolicy == "oldest" ? DropPolicy::Oldest : DropPolicy::Latest;
+		for (auto& source : m_sources) {
+			// Tiles go through the pool even without workers, on the caller
+			if (m_bandPool.getNumberOfWorkers() > 0 || m_frameOptions.tiled) {
+				source->processor.setBandPool(&m_bandPool, m_frameOptions.tiled);
+			}
+
+			source->processor.init(
+				&source->provider,
+				&m_colorClassifier,
+				&m_stageProfiler,
+				m_frameOptions.useMultiThreading && !isScheduled,
+				m_frameOptions.tileThreshold,
+				m_displayFormat,
+				m_isAtlasCoverage ? CV_8UC1 : CV_8UC4,
+				m_frameOptions.arenaHugePages,
+				!m_openCLDevice.empty()
+			);
+
+			if (!m_openCLDevice.empty()) {
+				auto paths = source->processor.getPathTimes();
+				std::cout << source->provider.getDescription() << ": CPU " << paths.cpu * 1e-6
+					<< " [ms], OpenCL " << paths.openCL * 1e-6 << " [ms] per frame, processing on "
+					<< (source->processor.usesOpenCL() ? "OpenCL" : "the CPU") << std::endl;
+			}
+		}
+
+		// Only once every processor has timed its paths, on a band pool
+		// none of them uses yet
+		if (isScheduled) {
+			for (auto& source : m_sources) {
+				source->processor.schedule(&m_scheduler, source->budget, dropPolicy);
+			}
+		}
+
+		addState(OPENCV_INIT);
 
-		// Create textures for displaing the channels separately
-		for (auto& tex : m_texChannels) {
-			tex = bgfx::createTexture2D(
-				cameraInfo.frameSize.width,					// width
+		m_stageProfiler.setFramePixels(int64_t(m_sources.front()->provider.getCameraInfo().frameSize.area()));
+
+		for (auto& source : m_sources) {
+			auto cameraInfo = source->provider.getCameraInfo();
+
+			// Create the texture to hold camera input image
+			source->texFrame = bgfx::createTexture2D(
+				cameraInfo.frameSize.width,						// width
 				cameraInfo.frameSize.height,					// height
 				false, 											// no mip-maps
 				1,												// number of layers
-				bgfx::TextureFormat::Enum::RGBA8,				// format
+				m_displayFormat.textureFormat,					// format
 				BGFX_TEXTURE_U_CLAMP | BGFX_TEXTURE_V_CLAMP,	// flags
 				nullptr											// mutable
 			);
+
+			// Create the atlas for displaying the channels separately, side by
+			// side at the reduced resolution they are displayed at. Point
+			// sampling keeps the panels from bleeding into each other.
+			source->texAtlas = bgfx::createTexture2D(
+				cameraInfo.frameSize.width / FrameProcessor::PREVIEW_SCALE
+					* FrameProcessor::NUM_OF_PREVIEWS,								// width
+				cameraInfo.frameSize.height / FrameProcessor::PREVIEW_SCALE,		// height
+				false, 																// no mip-maps
+				1,																	// number of layers
+				m_isAtlasCoverage
+					? bgfx::TextureFormat::Enum::A8
+					: bgfx::TextureFormat::Enum::RGBA8,								// format
+				BGFX_TEXTURE_U_CLAMP | BGFX_TEXTURE_V_CLAMP
+					| BGFX_TEXTURE_MIN_POINT | BGFX_TEXTURE_MAG_POINT,				// flags
+				nullptr																// mutable
+			);
+
+			source->uploadedSequence = 0;
+			source->uploadedResultId = 0;
 		}
 
 		static const InputBinding bindings[] =
@@ -741,6 +862,10 @@ class ShowGUI : public entry::AppI {
 			{ entry::Key::KeyY,	entry::Modifier::None,  		1, NULL, "show ycrcb" 	},
 			{ entry::Key::KeyH,	entry::Modifier::None,  		1, NULL, "show hsv" 	},
 			{ entry::Key::KeyL,	entry::Modifier::None,  		1, NULL, "show lab"		},
+			{ entry::Key::KeyP,	entry::Modifier::None,  		1, NULL, "pick next"	},
+			{ entry::Key::KeyC,	entry::Modifier::None,  		1, NULL, "pick clear"	},
+			{ entry::Key::KeyT,	entry::Modifier::None,  		1, NULL, "trace start"	},
+			{ entry::Key::KeyT,	entry::Modifier::LeftCtrl,  	1, NULL, "trace stop"	},
 
 			INPUT_BINDING_END
 		};
@@ -748,6 +873,8 @@ class ShowGUI : public entry::AppI {
 		// Add bindings and commands
 		cmdAdd("quit", cmdQuit, this);
 		cmdAdd("show", cmdShow, this);
+		cmdAdd("trace", cmdTrace, this);
+		cmdAdd("pick", cmdPick, this);
 
 		inputAddBindings("showgui_bindings", bindings);
 
@@ -756,69 +883,363 @@ class ShowGUI : public entry::AppI {
 		addState(COLOR_SPACE_RGB);
 
 		bx::memSet(&m_selectedColor, 0x0, sizeof(m_selectedColor));
+		m_uploadedSequence = 0;
+		m_pickedClass = 0;
+		m_lastPick = { -1, cv::Vec3b(), cv::Vec3b() };
 		m_timeOffset = bx::getHPCounter();
+
+		m_headlessUpdateTimes.clear();
+		m_headlessUpdateTimes.reserve(m_frameOptions.headlessFrames);
+		m_headlessUploads = 0;
+		m_headlessUploadedTiles = 0;
+		m_headlessTiles = 0;
+		m_headlessHeapFreeFrames = 0;
+		m_uploadedTiles = 0;
+
+		m_updateArena.setHugePages(m_frameOptions.arenaHugePages);
+		m_lastAllocations = {};
+		m_frameAllocations = {};
 	}
 
 	virtual int shutdown() override	{
+		if (m_frameOptions.headless && !m_headlessUpdateTimes.empty()) {
+			printHeadlessStats();
+		}
+
 		if (hasState(GUI_INIT)) {
 			imguiDestroy();
 		}
 		
 		if (hasState(BGFX_INIT)) {
-			bgfx::destroyTexture(m_texRGBA);
-			for (auto tex : m_texChannels) {
-				bgfx::destroyTexture(tex);
+			for (auto& source : m_sources) {
+				bgfx::destroyTexture(source->texFrame);
+				bgfx::destroyTexture(source->texAtlas);
 			}
 
 			bgfx::shutdown();
 		}
 
 		if (hasState(OPENCV_INIT)) {
-			m_frameProvider.shutdown();
+			// Jobs first, they run the providers and processors
+			m_scheduler.shutdown();
+			for (auto& source : m_sources) {
+				source->processor.shutdown();
+			}
+
+			for (auto& source : m_sources) {
+				source->provider.shutdown();
+			}
+
+			m_bandPool.shutdown();
+			m_colorClassifier.shutdown();
 		}
 
-		return EXIT_SUCCESS;
-	}
+		m_stageProfiler.closeCsv();
+		cv::Mat::setDefaultAllocator(nullptr);
 
-	static void updateImageToTexture(const cv::Mat& image, bgfx::TextureHandle texture) {
-		size_t imageSize = image.total() * image.elemSize();
-		size_t imagePitch = image.cols * image.elemSize();
-	
-		// !!ATTENTION!!: Not thread-safe!
-		static std::vector<uint8_t> pixels;
-		pixels.resize(imageSize);
-		
-		// If the grabbed frame is continuous in memory,
-		// then copying pixels is straight forward.
-		if (image.isContinuous()) {
-			bx::memCopy(pixels.data(), image.data, imageSize);
-		} else {
-			// We need to copy one row at a time otherwise.
-			auto *p = pixels.data();
-			for(int32_t i  = 0; i < image.rows; i++){
-				bx::memCopy(p, image.ptr(i), imagePitch);
-				p += imagePitch;
+		if (!m_frameOptions.memoryJson.empty()) {
+			if (!memprof::isEnabled()) {
+				std::cerr << "Memory profiling is not compiled in, see SHOW_GUI_MEMORY_PROFILER" << std::endl;
+			}
+
+			if (!m_memorySampler.writeJson(m_frameOptions.memoryJson.c_str())) {
+				std::cerr << "Cannot write memory statistics to " << m_frameOptions.memoryJson << std::endl;
 			}
 		}
-		
-		// Data will be free by bgfx once it has finished with it
-		auto* imageMem = bgfx::copy(pixels.data(), uint32_t(imageSize));
-		
-		// Copy camera frame into the texture
+
+		if (!m_frameOptions.tracePath.empty() && trace::isEnabled()) {
+			stopTrace(m_frameOptions.tracePath.c_str());
+		}
+
+		return EXIT_SUCCESS;
+	}
+
+	static void updateImageToTexture(const UploadBufferRef& _upload, bgfx::TextureHandle texture) {
+		// The pipeline has written pixels straight into the upload buffer,
+		// bgfx references them, and gives the buffer back to its pool once
+		// it has finished with it. The renderer still copies them over.
+		memprof::countCopy(_upload->size());
+		bgfx::updateTexture2D(
+			texture,			// texture handle
+			0, 0, 				// mip, layer
+			0, 0,				// start x, y
+			_upload->width(),	// width
+			_upload->height(),	// height
+			_upload->makeRef(),	// memory
+			_upload->pitch()	// pitch
+		);
+	}
+
+	static void updateImageToTexture(const UploadBufferRef& _upload, bgfx::TextureHandle texture, const cv::Rect& _rect) {
+		// Rows of the rectangle are read with the pitch of the whole image
+		memprof::countCopy(_rect.area() * (_upload->pitch() / _upload->width()));
 		bgfx::updateTexture2D(
-			texture,	// texture handle
-			0, 0, 		// mip, layer
-			0, 0,		// start x, y
-			image.cols,	// width
-			image.rows,	// height
-			imageMem,	// memory
-			imagePitch	// pitch
+			texture,					// texture handle
+			0, 0, 						// mip, layer
+			uint16_t(_rect.x),			// start x
+			uint16_t(_rect.y),			// start y
+			uint16_t(_rect.width),		// width
+			uint16_t(_rect.height),		// height
+			_upload->makeRef(_rect),	// memory
+			_upload->pitch()			// pitch
 		);
 	}
 
+	// Upload the tiles of an image whose stamps differ from the stamps of
+	// what the texture holds, or the whole image when most of its tiles
+	// have changed. The image is made of _panels side by side, each one
+	// being the frame reduced by _scale. Returns the number of tiles uploaded.
+	uint32_t uploadTiles(const TileGrid& _grid, const std::vector<uint32_t>& _stamps,
+		std::vector<uint32_t>& _uploadedStamps, const UploadBufferRef& _upload,
+		bgfx::TextureHandle _texture, int32_t _scale, int32_t _panels) {
+		const int32_t numOfTiles = _grid.getNumberOfTiles();
+		int32_t numOfChanged = numOfTiles;
+
+		if (_uploadedStamps.size() == _stamps.size()) {
+			m_uploadTiles.resize(numOfTiles);
+			numOfChanged = 0;
+			for (int32_t i = 0; i < numOfTiles; ++i) {
+				m_uploadTiles[i] = _stamps[i] != _uploadedStamps[i] ? 1 : 0;
+				numOfChanged += m_uploadTiles[i];
+			}
+		}
+
+		// Past half of the tiles, the calls cost more than the bytes saved
+		if (numOfChanged * 2 > numOfTiles) {
+			updateImageToTexture(_upload, _texture);
+		}
+		else if (numOfChanged > 0) {
+			const int32_t panelWidth = _upload->width() / _panels;
+			_grid.getRects(m_uploadTiles, true, m_uploadRects, _scale);
+			for (int32_t i = 0; i < _panels; ++i) {
+				for (const auto& rect : m_uploadRects) {
+					updateImageToTexture(_upload, _texture, rect + cv::Point(i * panelWidth, 0));
+				}
+			}
+		}
+
+		_uploadedStamps = _stamps;
+		return uint32_t(numOfChanged * _panels);
+	}
+
+	// Return false once the application has to exit.
+	bool processEvents() {
+		// There are no events to wait for without a window, a headless
+		// run lasts for the requested number of frames instead.
+		if (m_frameOptions.headless) {
+			return m_headlessUpdateTimes.size() < size_t(m_frameOptions.headlessFrames);
+		}
+
+		return !entry::processEvents(m_width, m_height, m_debug, m_reset, &m_mouseState);
+	}
+
+	void printHeadlessStats() {
+		std::vector<int64_t> times = m_headlessUpdateTimes;
+		std::sort(times.begin(), times.end());
+
+		int64_t total = 0;
+		for (auto t : times) {
+			total += t;
+		}
+
+		const double toMs = 1000.0/double(bx::getHPFrequency());
+		auto percentile = [&times, toMs](double _p) {
+			auto index = std::min(size_t(_p * times.size()), times.size() - 1);
+			return double(times[index])*toMs;
+		};
+
+		auto cameraInfo = m_sources[m_selectedSource]->provider.getCameraInfo();
+		std::cout << "-- Headless run --" << std::endl
+			<< "Frames: " << times.size()
+			<< " (" << m_headlessUploads << " uploaded, "
+			<< cameraInfo.frameSize.width << "x" << cameraInfo.frameSize.height << ")" << std::endl
+			<< "Update time [ms]:"
+			<< " mean " << double(total)*toMs / times.size()
+			<< " p50 " << percentile(.5)
+			<< " p95 " << percentile(.95)
+			<< " p99 " << percentile(.99)
+			<< " max " << double(times.back())*toMs << std::endl
+			<< "Throughput: " << times.size() / (double(total)*toMs*1e-3) << " fps" << std::endl
+			<< "Uploaded tiles: " << m_headlessUploadedTiles << " of " << m_headlessTiles
+			<< " (" << (m_headlessTiles > 0 ? 100.0 * m_headlessUploadedTiles / m_headlessTiles : 0.0) << "%)" << std::endl
+			<< "Frames without heap Mat allocations: " << m_headlessHeapFreeFrames << " of " << times.size()
+			<< " (" << m_lastAllocations.heapMats << " heap, " << m_lastAllocations.arenaMats << " arena, "
+			<< m_lastAllocations.overflows << " overflowed in total)" << std::endl;
+
+		if (m_scheduler.getNumberOfWorkers() > 0) {
+			std::cout << "Sources: " << m_sources.size() << " on "
+				<< m_scheduler.getNumberOfWorkers() << " workers" << std::endl;
+			for (const auto& source : m_sources) {
+				auto job = source->processor.getJobStats();
+				std::cout << "  " << source->provider.getDescription()
+					<< ": " << source->processor.getNumberOfProcessedFrames() << " processed, "
+					<< source->processor.getNumberOfDroppedFrames() << " dropped, "
+					<< "lateness mean " << (job.runs > 0 ? job.lateness * 1e-6 / job.runs : 0.0) << " [ms]"
+					<< std::endl;
+			}
+		}
+
+		for (const auto& source : m_sources) {
+			if (source->processor.usesOpenCL()) {
+				std::cout << "OpenCL: " << source->provider.getDescription() << " on " << m_openCLDevice << std::endl;
+			}
+		}
+
+		if (m_bandPool.getNumberOfWorkers() > 0) {
+			auto bands = m_bandPool.getStats();
+			std::cout << "Bands: " << m_bandPool.getNumberOfWorkers() << " workers and the caller, "
+				<< bands.tasks << " tasks in " << bands.forks << " forks, "
+				<< bands.steals << " stolen" << std::endl;
+		}
+
+		for (int32_t stage = 0; stage < Stage::Count; ++stage) {
+			auto percentiles = m_stageProfiler.getPercentiles(Stage::Enum(stage));
+			std::cout << "  " << StageProfiler::getStageName(Stage::Enum(stage)) << " [ms]:"
+				<< " p50 " << percentiles.p50
+				<< " p95 " << percentiles.p95
+				<< " p99 " << percentiles.p99
+				<< " (" << percentiles.samples << " samples)";
+
+			auto counters = m_stageProfiler.getCounterStats(Stage::Enum(stage));
+			if (counters.samples > 0) {
+				std::cout << " IPC " << counters.ipc
+					<< " LLC misses/px " << counters.cacheMissesPerPixel
+					<< " branch misses/px " << counters.branchMissesPerPixel;
+			}
+
+			std::cout << std::endl;
+		}
+
+		if (m_frameOptions.perfCounters && !perf::isEnabled()) {
+			std::cout << "Hardware counters unavailable: " << perf::getUnavailableReason() << std::endl;
+		}
+	}
+
+	// Matrices allocated during the last update, whichever thread did
+	void updateAllocationStats() {
+		FrameArena::Stats frameArenas = { 0, 0, 0 };
+		for (const auto& source : m_sources) {
+			auto stats = source->processor.getArenaStats();
+			frameArenas.allocations += stats.allocations;
+			frameArenas.overflows += stats.overflows;
+			frameArenas.reserved += stats.reserved;
+		}
+
+		auto updateArena = m_updateArena.getStats();
+
+		AllocationStats total = {
+			s_heapMats.getAllocations(),
+			frameArenas.allocations + updateArena.allocations,
+			frameArenas.overflows + updateArena.overflows,
+			frameArenas.reserved + updateArena.reserved
+		};
+
+		m_frameAllocations = {
+			total.heapMats - m_lastAllocations.heapMats,
+			total.arenaMats - m_lastAllocations.arenaMats,
+			total.overflows - m_lastAllocations.overflows,
+			total.reserved
+		};
+
+		m_lastAllocations = total;
+	}
+
+	// Rolling percentiles of every stage, below the other debug text, with
+	// the hardware counters over the same window, and the allocations and
+	// copies of the last frame, for whichever of those are enabled.
+	void printStageStats(uint16_t _row) {
+		const bool showCounters = perf::isEnabled();
+		const int32_t size = 256;
+		char line[size];
+		int32_t length = bx::snprintf(line, size, "%-12s %8s %8s %8s [ms]", "Stage", "p50", "p95", "p99");
+		if (showCounters) {
+			length += bx::snprintf(line + length, size - length, " %6s %8s %8s", "IPC", "LLC/px", "brm/px");
+		}
+
+		if (memprof::isEnabled()) {
+			bx::snprintf(line + length, size - length, " %8s %10s %8s %10s [KB]",
+				"allocs", "allocated", "copies", "copied");
+		}
+
+		bgfx::dbgTextPrintf(0, _row, 0x0f, "%s", line);
+
+		for (int32_t stage = 0; stage < Stage::Count; ++stage) {
+			auto percentiles = m_stageProfiler.getPercentiles(Stage::Enum(stage));
+			length = bx::snprintf(line, size, "%-12s %8.3f %8.3f %8.3f     ",
+				StageProfiler::getStageName(Stage::Enum(stage)),
+				percentiles.p50, percentiles.p95, percentiles.p99);
+
+			if (showCounters) {
+				auto counters = m_stageProfiler.getCounterStats(Stage::Enum(stage));
+				length += formatCounter(line + length, size - length, 6, 2, counters.ipc);
+				length += formatCounter(line + length, size - length, 8, 4, counters.cacheMissesPerPixel);
+				length += formatCounter(line + length, size - length, 8, 4, counters.branchMissesPerPixel);
+			}
+
+			if (memprof::isEnabled()) {
+				const auto& memory = m_memorySampler.getLastFrame(stage);
+				bx::snprintf(line + length, size - length, " %8llu %10.1f %8llu %10.1f",
+					(unsigned long long)memory.allocations, memory.allocatedBytes / 1024.0,
+					(unsigned long long)memory.copies, memory.copiedBytes / 1024.0);
+			}
+
+			bgfx::dbgTextPrintf(0, uint16_t(_row + 1 + stage), 0x0f, "%s", line);
+		}
+	}
+
+	// Counter statistic in its column, a dash when it is unavailable
+	static int32_t formatCounter(char* _buffer, int32_t _size, int32_t _width, int32_t _precision, double _value) {
+		if (_value < 0.0) {
+			return bx::snprintf(_buffer, _size, " %*s", _width, "-");
+		}
+
+		return bx::snprintf(_buffer, _size, " %*.*f", _width, _precision, _value);
+	}
+
+	// Every source side by side, with how it keeps up. Clicking one shows
+	// it in the camera window.
+	void showSourceGrid() {
+		const int32_t columns = int32_t(std::ceil(std::sqrt(double(m_sources.size()))));
+		const float thumbnailWidth = 240.0f;
+
+		if (ImGui::Begin("Sources", nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
+			for (int32_t i = 0; i < int32_t(m_sources.size()); ++i) {
+				auto& source = *m_sources[i];
+				auto cameraInfo = source.provider.getCameraInfo();
+				ImVec2 size(thumbnailWidth,
+					thumbnailWidth * cameraInfo.frameSize.height / std::max(cameraInfo.frameSize.width, 1));
+
+				ImGui::BeginGroup();
+				if (source.uploadedResultId != 0) {
+					ImGui::Image((ImTextureID)(uintptr_t)source.texFrame.idx, size);
+				}
+				else {
+					ImGui::Dummy(size);
+				}
+
+				if (ImGui::IsItemClicked()) {
+					m_selectedSource = i;
+				}
+
+				ImGui::Text("%s%s", i == m_selectedSource ? "> " : "", source.provider.getDescription().c_str());
+				ImGui::Text("%llu processed, %llu dropped",
+					(unsigned long long)source.processor.getNumberOfProcessedFrames(),
+					(unsigned long long)source.processor.getNumberOfDroppedFrames());
+				ImGui::EndGroup();
+
+				if ((i + 1) % columns != 0 && i + 1 < int32_t(m_sources.size())) {
+					ImGui::SameLine();
+				}
+			}
+		}
+
+		ImGui::End();
+	}
+
 	virtual bool update() override	{
-		if (!hasState(EXIT_REQUEST) &&
-			!entry::processEvents(m_width, m_height, m_debug, m_reset, &m_mouseState) ) {
+		if (!hasState(EXIT_REQUEST) && processEvents()) {
+			trace::Scope traceUpdate("update");
+
 			int64_t now = bx::getHPCounter();
 			static int64_t last = now;
 			const int64_t frameTime = now - last;
@@ -841,93 +1262,151 @@ class ShowGUI : public entry::AppI {
 			bgfx::dbgTextPrintf(0, 3, 0x8f, "Frame time: % 7.3f[ms]", double(frameTime)*toMs);	
 			
 			const bgfx::Stats* stats = bgfx::getStats();
+			printStageStats(12);
+
+			// Below the header and the row of each stage
+			const uint16_t statsRow = uint16_t(13 + Stage::Count);
+
+			if (trace::isEnabled()) {
+				bgfx::dbgTextPrintf(0, 11, 0x4f, "Tracing... (Ctrl+T to stop)");
+			}
+
 			bgfx::dbgTextPrintf(0, 5, 0x0f, "Backbuffer %dW x %dH in pixels, debug text %dW x %dH in characters.",
 					stats->width, stats->height, stats->textWidth, stats->textHeight);
 			
+			auto& selected = *m_sources[m_selectedSource];
+
+			// The capture thread parks while the camera is not shown
+			if (m_scheduler.getNumberOfWorkers() > 0) {
+				auto job = selected.processor.getJobStats();
+				bgfx::dbgTextPrintf(0, 4, 0x0f, "Scheduler: %d sources on %d workers, selected processed %llu dropped %llu lateness %.3f[ms]",
+					int32_t(m_sources.size()), m_scheduler.getNumberOfWorkers(),
+					(unsigned long long)selected.processor.getNumberOfProcessedFrames(),
+					(unsigned long long)selected.processor.getNumberOfDroppedFrames(),
+					job.runs > 0 ? job.lateness * 1e-6 / job.runs : 0.0);
+			}
+			else if (selected.provider.isMultiThreaded()) {
+				auto captureTimes = selected.provider.getCaptureTimes();
+				auto captureTotal = captureTimes.idle + captureTimes.busy;
+				bgfx::dbgTextPrintf(0, 4, 0x0f, "Capture thread idle: %.1f[s] busy: %.1f[s] (%.1f%% busy)",
+					captureTimes.idle * 1e-9, captureTimes.busy * 1e-9,
+					captureTotal > 0 ? 100.0 * captureTimes.busy / captureTotal : 0.0);
+			}
+
 			// Get the current camera frame and show on the GUIs windows
+			int64_t uploadedCaptureTime = 0;
 			bool showGUI = hasState(SHOW_CAMERA);
-			m_frameProvider.capture(showGUI);
+			for (auto& source : m_sources) {
+				source->provider.capture(showGUI);
+			}
+
 			if (showGUI) {
-				cv::Mat cameraFrame = m_frameProvider.getCameraFrame();
-				if (!cameraFrame.empty()) {
+				// Frames come out of the pipeline already processed, with
+				// the settings the previous updates have requested. Every
+				// source is asked, so that its stale frames get recycled,
+				// and the others only upload what the grid shows of them.
+				const ProcessedFrame* processedFrame = nullptr;
+				for (auto& source : m_sources) {
+					const ProcessedFrame* frame = source->processor.getProcessedFrame();
+					if (source.get() == &selected) {
+						processedFrame = frame;
+					}
+					else if (frame && frame->resultId != source->uploadedResultId) {
+						ScopedStageTimer timer(&m_stageProfiler, Stage::Upload, frame->sequence);
+						uploadTiles(frame->tileGrid, frame->displayTiles, source->displayTiles,
+							frame->displayUpload, source->texFrame, 1, 1);
+						source->uploadedSequence = frame->sequence;
+						source->uploadedResultId = frame->resultId;
+					}
+				}
+
+				if (processedFrame) {
+					const cv::Mat& cameraFrame = processedFrame->display;
+					const cv::Mat& imageFrame = processedFrame->image;
 				
-					auto imageFrameType = cameraFrame.type();
-					auto cameraInfo = m_frameProvider.getCameraInfo();
+					auto imageFrameType = processedFrame->sourceType;
+					auto cameraInfo = selected.provider.getCameraInfo();
 					
 					bgfx::dbgTextPrintf(0, 6, 0x0f, "Video Capture %dx%d @%d fps (%s)",
 						cameraInfo.frameSize.width, cameraInfo.frameSize.height, cameraInfo.fps,
-						m_frameProvider.isMultiThreaded() ? "multi-threaded" : "single-thread");
+						selected.provider.isScheduled() ? "scheduled"
+							: selected.provider.isMultiThreaded() ? "multi-threaded" : "single-thread");
 					
-					bgfx::dbgTextPrintf(0, 7, 0x0f, "Camera Frame %dx%d (type: %s frames: %d)",
+					auto ringStats = selected.provider.getRingStats();
+					bgfx::dbgTextPrintf(0, 7, 0x0f, "Camera Frame %dx%d (type: %s texture: %s frames: %d dropped: %llu reallocs: %llu upload buffers: %u)",
 						cameraFrame.cols, cameraFrame.rows,
 						cvTypeToString(imageFrameType).c_str(),
-						m_frameProvider.getNumberOfFramesInBuffer());
-					
-					cv::Mat3b colorSpaceFrame;
-					cv::Mat frameChannels[3];
+						m_displayFormat.name,
+						selected.provider.getNumberOfFramesInBuffer(),
+						(unsigned long long)ringStats.framesDropped,
+						(unsigned long long)ringStats.reallocations,
+						selected.processor.getNumberOfUploadBuffers());
 					
-					int32_t colorSpaceCode = cv::COLOR_BGR2RGB;
+					// Color space the displayed frame has been processed in
 					int32_t	rgbToColorSpace = 0;
 					std::string colorSpaceString = "RGB";
-					{
-						// Pick the requested color space
-						if (hasState(COLOR_SPACE_HSV)) {
-							colorSpaceCode = cv::COLOR_BGR2HSV;
+					switch (processedFrame->settings.colorSpaceCode) {
+						case cv::COLOR_BGR2HSV:
 							rgbToColorSpace = cv::COLOR_HSV2RGB;
 							colorSpaceString = "HSV";
-						}
-						else if (hasState(COLOR_SPACE_YCrCb)) {
-							colorSpaceCode = cv::COLOR_BGR2YCrCb;
+							break;
+						case cv::COLOR_BGR2YCrCb:
 							rgbToColorSpace = cv::COLOR_YCrCb2RGB;
 							colorSpaceString = "YCrCb";
-						}
-						else if (hasState(COLOR_SPACE_Lab)) {
-							colorSpaceCode = cv::COLOR_BGR2Lab;
+							break;
+						case cv::COLOR_BGR2Lab:
 							rgbToColorSpace = cv::COLOR_Lab2RGB;
 							colorSpaceString = "Lab";
-						}
-						
-						bgfx::dbgTextPrintf(0, 8, 0x0f, "Channels Color Space: %s",
-							colorSpaceString.c_str());
-						
-						// Make sure we are in the right format and convert to Mat
-						cv::Mat bgr, colorSpaceImage;
-						cameraFrame.convertTo(bgr, CV_8UC3);
-						
-						// Convert camera input to the requested color space
-						cv::cvtColor(bgr, colorSpaceImage, colorSpaceCode);
-						
-						// Separate the color space channels
-						std::vector<cv::Mat> channels;
-						cv::split(colorSpaceImage, channels);
-						
-						// Convert bgr to rgba and back to Mat
-						// that is image data can be transferred to GPU
-						cv::Mat rgba;
-						cv::cvtColor(bgr, rgba, cv::COLOR_BGR2RGBA);
-						
-						cameraFrame = rgba;//.getMat(cv::ACCESS_READ).clone();
-						for (auto i = 0; i < channels.size(); ++i) {
-							// Convert single channel image into RGBA.
-							// This is a required step because ImGUI is not capable
-							// of showing only one channel as grayscale image, nor has
-							// the ability to show an image with a custom shader.
-							cv::Mat grayRGBA;
-							cv::cvtColor(channels[i], grayRGBA, cv::COLOR_GRAY2BGRA);
-							
-							// Convert to Mat to access data from the CPU
-							frameChannels[i] = grayRGBA;//.getMat(cv::ACCESS_READ).clone();
-						}
-						
-						// Merge channels into a single image
-						//cv::Mat alphaOne = cv::Mat::ones(cameraFrame.rows, cameraFrame.cols, CV_8UC1);
-						cv::Mat grayChannels[] = {
-							channels[0],//.getMat(cv::ACCESS_READ).clone(),
-							channels[1],//.getMat(cv::ACCESS_READ).clone(),
-							channels[2],//.getMat(cv::ACCESS_READ).clone()
-						};
-						
-						cv::merge(grayChannels, 3, colorSpaceFrame);
+							break;
+					}
+					
+					bgfx::dbgTextPrintf(0, 8, 0x0f, "Channels Color Space: %s",
+						colorSpaceString.c_str());
+					
+					// Settings the next frames will be processed with, the
+					// mask applies as long as there is a color class defined.
+					auto classifierTable = m_colorClassifier.getTable();
+					FrameSettings frameSettings = {
+						getColorSpaceCode(),
+						classifierTable->classes != 0,
+						classifierTable->version
+					};
+
+					bgfx::dbgTextPrintf(0, statsRow, 0x0f, "Color classes: %d defined, picking class %d (P: next class, C: clear all)",
+						bx::uint32_cntbits(classifierTable->classes), m_pickedClass);
+
+					auto bands = m_bandPool.getStats();
+					bgfx::dbgTextPrintf(0, statsRow + 1, 0x0f, "Tiles: %d of %d changed, %u uploaded last, %s on %d threads: %llu of %llu tasks stolen",
+						processedFrame->numOfChangedTiles, processedFrame->tileGrid.getNumberOfTiles(),
+						m_uploadedTiles, m_frameOptions.tiled ? "tiles" : "bands", m_bandPool.getNumberOfWorkers() + 1,
+						(unsigned long long)bands.steals, (unsigned long long)bands.tasks);
+
+					auto paths = selected.processor.getPathTimes();
+					if (paths.openCL >= 0) {
+						bgfx::dbgTextPrintf(0, statsRow + 2, 0x0f, "Processing on %s, startup frame: CPU %.3f[ms], OpenCL %.3f[ms] on %s",
+							selected.processor.usesOpenCL() ? "OpenCL" : "the CPU", paths.cpu * 1e-6, paths.openCL * 1e-6,
+							m_openCLDevice.c_str());
+					}
+					else {
+						bgfx::dbgTextPrintf(0, statsRow + 2, 0x0f, "Processing on the CPU");
+					}
+
+					bgfx::dbgTextPrintf(0, statsRow + 3, 0x0f, "Mats last frame: %llu from the heap, %llu from arenas (%llu overflowed), arenas %llu KB",
+						(unsigned long long)m_frameAllocations.heapMats,
+						(unsigned long long)m_frameAllocations.arenaMats,
+						(unsigned long long)m_frameAllocations.overflows,
+						(unsigned long long)(m_frameAllocations.reserved >> 10));
+
+					if (m_frameOptions.perfCounters && !perf::isEnabled()) {
+						bgfx::dbgTextPrintf(0, statsRow + 5, 0x0f, "Hardware counters unavailable: %s",
+							perf::getUnavailableReason());
+					}
+
+					if (memprof::isEnabled()) {
+						const auto& other = m_memorySampler.getLastFrame(Stage::Count);
+						bgfx::dbgTextPrintf(0, statsRow + 4, 0x0f, "Outside stages last frame: %llu allocations (%.1f KB), %llu copies (%.1f KB)",
+							(unsigned long long)other.allocations, other.allocatedBytes / 1024.0,
+							(unsigned long long)other.copies, other.copiedBytes / 1024.0);
 					}
 					
 					// Show camera capture on the GUI
@@ -972,11 +1451,20 @@ class ShowGUI : public entry::AppI {
 							cv::Rect imageROI = cv::Rect(0, 0, cameraFrame.cols, cameraFrame.rows);
 							
 							if (imageROI.contains(mouseAtPixel)) {
-								// RGB pixel at requested image coordinates
-								cv::Vec4b pixelColor = cameraFrame.at<cv::Vec4b>(
-									mouseAtPixel.y, mouseAtPixel.x);
-								cv::Vec3b pixelSpace = colorSpaceFrame.at<cv::Vec3b>(
-									mouseAtPixel.y, mouseAtPixel.x);
+								// RGBA pixel at requested image coordinates, whatever
+								// the layout the frame is displayed in.
+								const uchar* pixel = imageFrame.ptr(mouseAtPixel.y)
+									+ mouseAtPixel.x * imageFrame.channels();
+								const int32_t blue = m_displayFormat.isRGB ? 2 : 0;
+								cv::Vec4b pixelColor(pixel[2 - blue], pixel[1], pixel[blue], 0xff);
+
+								// Same pixel in the frame's color space. The pipeline only
+								// converts the tiles which change, convert it on its own.
+								cv::Mat pixelBGR = m_updateArena.create(1, 1, CV_8UC3);
+								cv::Mat pixelConverted = m_updateArena.create(1, 1, CV_8UC3);
+								pixelBGR.at<cv::Vec3b>(0, 0) = cv::Vec3b(pixelColor[2], pixelColor[1], pixelColor[0]);
+								cv::cvtColor(pixelBGR, pixelConverted, processedFrame->settings.colorSpaceCode);
+								cv::Vec3b pixelSpace = pixelConverted.at<cv::Vec3b>(0, 0);
 							
 								bgfx::dbgTextPrintf(0, 9, 0x0f, "Pixel at (%d,%d) RGB=[%d %d %d] %s=[%d %d %d]",
 									mouseAtPixel.x, mouseAtPixel.y,
@@ -986,7 +1474,7 @@ class ShowGUI : public entry::AppI {
 								);
 								
 								int32_t tolerance = 40 + m_mouseState.m_mz;
-								bgfx::dbgTextPrintf(0, 10, 0x0f, "Picking tolerance: %d", tolerance);
+								bgfx::dbgTextPrintf(0, 10, 0x0f, "Picking tolerance: %d (class %d)", tolerance, m_pickedClass);
 							
 								// If mouse right button is pressed, the color
 								// of this pixel is the one we want to filter.
@@ -1007,19 +1495,23 @@ class ShowGUI : public entry::AppI {
 										
 										// To diplay the color correctly we need to convet
 										// back to RGB from the picked color space pixel.
-										if (!hasState(COLOR_SPACE_RGB)) {
+										if (rgbToColorSpace != 0) {
 											// Create a matrix image of one pixel only.
-											cv::Mat3b lowerImage(lowerColor);
-											cv::Mat3b upperImage(upperColor);
+											cv::Mat lowerImage = m_updateArena.create(1, 1, CV_8UC3);
+											cv::Mat upperImage = m_updateArena.create(1, 1, CV_8UC3);
+											cv::Mat lowerRGB = m_updateArena.create(1, 1, CV_8UC3);
+											cv::Mat upperRGB = m_updateArena.create(1, 1, CV_8UC3);
+											lowerImage.at<cv::Vec3b>(0, 0) = lowerColor;
+											upperImage.at<cv::Vec3b>(0, 0) = upperColor;
 											
 											// Convert these 1x1 matrices to RGB space,
 											// but we are already operating in RGB.
-											cv::cvtColor(lowerImage, lowerImage, rgbToColorSpace);
-											cv::cvtColor(upperImage, upperImage, rgbToColorSpace);
+											cv::cvtColor(lowerImage, lowerRGB, rgbToColorSpace);
+											cv::cvtColor(upperImage, upperRGB, rgbToColorSpace);
 											
 											// Read back the pixel in RGB for readibility purpose
-											m_minColor = cvVec3bToImVec4f(lowerImage(0, 0));
-											m_maxColor = cvVec3bToImVec4f(upperImage(0, 0));
+											m_minColor = cvVec3bToImVec4f(lowerRGB.at<cv::Vec3b>(0, 0));
+											m_maxColor = cvVec3bToImVec4f(upperRGB.at<cv::Vec3b>(0, 0));
 										}
 										else {
 											// Read back the pixel in RGB for readibility purpose
@@ -1027,29 +1519,48 @@ class ShowGUI : public entry::AppI {
 											m_maxColor = cvVec3bToImVec4f(upperColor);
 										}
 										
-										// Extract the mask in requested color space
-										cv::Mat maskImage, resultImage;
-										cv::inRange(colorSpaceFrame, lowerColor, upperColor, maskImage);
-										
-										// Apply the mask to the original camera frame in RGBA
-										cv::bitwise_and(cameraFrame, cameraFrame, resultImage, maskImage);
-										//cv::cvtColor(maskImage, cameraFrame, cv::COLOR_GRAY2RGBA);
-										cameraFrame = resultImage;										
+										// Define the class in the color space it has been picked in,
+										// the classifier rebuilds its table in the background.
+										ColorClassifier::ColorClass colorClass = {
+											processedFrame->settings.colorSpaceCode, lowerColor, upperColor
+										};
+
+										if (!isSameClass(colorClass, m_lastPick)) {
+											m_colorClassifier.setClass(m_pickedClass, colorClass);
+											m_lastPick = colorClass;
+										}
 									}
 								}
 							}
 							
-							// Upload image data to textures
-							updateImageToTexture(cameraFrame, m_texRGBA);
-							updateImageToTexture(frameChannels[0], m_texChannels[0]);
-							updateImageToTexture(frameChannels[1], m_texChannels[1]);
-							updateImageToTexture(frameChannels[2], m_texChannels[2]);
+							// Upload image data to textures, if the pipeline has
+							// handed us a result we have not uploaded already.
+							if (processedFrame->resultId != selected.uploadedResultId) {
+								ScopedStageTimer timer(&m_stageProfiler, Stage::Upload, processedFrame->sequence);
+								const auto& grid = processedFrame->tileGrid;
+								m_uploadedTiles = uploadTiles(grid, processedFrame->displayTiles, selected.displayTiles,
+									processedFrame->displayUpload, selected.texFrame, 1, 1);
+								m_uploadedTiles += uploadTiles(grid, processedFrame->channelTiles, selected.channelTiles,
+									processedFrame->atlasUpload, selected.texAtlas,
+									FrameProcessor::PREVIEW_SCALE, FrameProcessor::NUM_OF_PREVIEWS);
+								m_headlessUploadedTiles += m_uploadedTiles;
+								m_headlessTiles += 4 * grid.getNumberOfTiles();
+								// Latency is only meaningful for new camera frames
+								if (processedFrame->sequence != selected.uploadedSequence) {
+									uploadedCaptureTime = processedFrame->captureTime;
+								}
+
+								m_uploadedSequence = processedFrame->sequence;
+								selected.uploadedSequence = processedFrame->sequence;
+								selected.uploadedResultId = processedFrame->resultId;
+								++m_headlessUploads;
+							}
 							
 							// Displayed camera frame' size
 							auto frameSize = ImVec2((float)cameraFrame.cols, (float)cameraFrame.rows);
 							
 							// Show the main frame
-							ImGui::Image((ImTextureID)(uintptr_t)m_texRGBA.idx, frameSize);
+							ImGui::Image((ImTextureID)(uintptr_t)selected.texFrame.idx, frameSize);
 							
 							// Color picker
 							ImGui::ColorEdit3("Picked Color", &m_selectedColor.x,
@@ -1074,9 +1585,18 @@ class ShowGUI : public entry::AppI {
 								auto frameChannelSize = ImVec2(
 									frameSize.x * .332f, frameSize.y * .332f);
 										
-								// Show frame's channels
-								for (const auto& texChannel : m_texChannels) {										
-									ImGui::Image(texChannel, frameChannelSize);
+								// Show frame's channels, each a panel of the atlas
+								for (int32_t i = 0; i < FrameProcessor::NUM_OF_PREVIEWS; ++i) {
+									if (m_isAtlasCoverage) {
+										ImVec2 start = ImGui::GetCursorScreenPos();
+										ImGui::GetWindowDrawList()->AddRectFilled(start,
+											ImVec2(start.x + frameChannelSize.x, start.y + frameChannelSize.y),
+											ImGui::GetColorU32(ImVec4(1.0f, 1.0f, 1.0f, 1.0f)));
+									}
+
+									ImGui::Image(selected.texAtlas, frameChannelSize,
+										ImVec2(float(i) / FrameProcessor::NUM_OF_PREVIEWS, 0.0f),
+										ImVec2(float(i + 1) / FrameProcessor::NUM_OF_PREVIEWS, 1.0f));
 									ImGui::SameLine();
 								}
 								ImGui::EndGroup();
@@ -1089,15 +1609,48 @@ class ShowGUI : public entry::AppI {
 						if(!showVideoWindow) {
 							removeState(SHOW_CAMERA);
 						}
+
+						if (m_sources.size() > 1) {
+							showSourceGrid();
+						}
 						
 						imguiEndFrame();
 					}
+					
+					for (auto& source : m_sources) {
+						source->processor.setSettings(frameSettings);
+					}
 				}
 			}		
 			
 			// Advance to next frame. Rendering thread will be
 			// kicked to process submitted rendering primitives.
-			bgfx::frame();
+			{
+				ScopedStageTimer timer(&m_stageProfiler, Stage::Frame, m_uploadedSequence);
+				bgfx::frame();
+			}
+
+			// From the capture of the frame uploaded now, to its
+			// submission, the closest to the photons we can measure.
+			if (uploadedCaptureTime != 0) {
+				m_stageProfiler.record(Stage::Latency, m_uploadedSequence,
+					uploadedCaptureTime, StageProfiler::now());
+			}
+
+			m_stageProfiler.flushCsv();
+
+			// Temporaries of this update go back to its arena
+			m_updateArena.reset();
+			updateAllocationStats();
+			m_memorySampler.sample();
+
+			if (m_frameOptions.headless) {
+				m_headlessUpdateTimes.push_back(bx::getHPCounter() - now);
+				if (m_frameAllocations.heapMats == 0 && m_frameAllocations.overflows == 0) {
+					++m_headlessHeapFreeFrames;
+				}
+			}
+
 			return true;
 		}
 		
@@ -1152,18 +1705,122 @@ class ShowGUI : public entry::AppI {
 		addState(EXIT_REQUEST);
 	}
 
+	static bool isSameClass(const ColorClassifier::ColorClass& _a, const ColorClassifier::ColorClass& _b) {
+		return _a.colorSpaceCode == _b.colorSpaceCode
+			&& _a.lower == _b.lower
+			&& _a.upper == _b.upper;
+	}
+
+	static bool isTextureFormatSupported(bgfx::TextureFormat::Enum _format) {
+		return 0 != (bgfx::getCaps()->formats[_format] & BGFX_CAPS_FORMAT_TEXTURE_2D);
+	}
+
+	// Display format the camera frames are uploaded in, the requested one
+	// if the renderer handles it. BGRA8 is preferred, being the native
+	// layout of most drivers. RGB8 is only used on request, and never on
+	// the D3D11/12 renderers, which mishandle it. RGBA8 is always there.
+	static DisplayFormat chooseDisplayFormat(const std::string& _requested) {
+		auto rendererType = bgfx::getRendererType();
+		bool isRGB8Broken = rendererType == bgfx::RendererType::Direct3D11
+			|| rendererType == bgfx::RendererType::Direct3D12;
+
+		const DisplayFormat* chosen = nullptr;
+		for (const auto& format : s_displayFormats) {
+			if (_requested != format.name) {
+				continue;
+			}
+
+			if (isTextureFormatSupported(format.textureFormat)
+				&& !(format.textureFormat == bgfx::TextureFormat::RGB8 && isRGB8Broken)) {
+				chosen = &format;
+			}
+			else {
+				std::cout << "Texture format " << format.name << " is not supported by the "
+					<< bgfx::getRendererName(rendererType) << " renderer" << std::endl;
+			}
+		}
+
+		if (!chosen) {
+			chosen = isTextureFormatSupported(bgfx::TextureFormat::BGRA8)
+				? &s_displayFormats[0]
+				: &s_displayFormats[2];
+		}
+
+		return *chosen;
+	}
+
+	// Conversion code of the color space currently requested
+	int32_t getColorSpaceCode() {
+		if (hasState(COLOR_SPACE_HSV)) {
+			return cv::COLOR_BGR2HSV;
+		}
+		else if (hasState(COLOR_SPACE_YCrCb)) {
+			return cv::COLOR_BGR2YCrCb;
+		}
+		else if (hasState(COLOR_SPACE_Lab)) {
+			return cv::COLOR_BGR2Lab;
+		}
+
+		return cv::COLOR_BGR2RGB;
+	}
+
 	FrameOptions			m_frameOptions;
-	FrameProcessor			m_frameProcessor;
-	FrameProvider			m_frameProvider;
+	StageProfiler			m_stageProfiler;	// Outlive the pipeline
+	ColorClassifier			m_colorClassifier;
+	FrameScheduler			m_scheduler;		// Workers of all the sources, if many
+	TaskPool				m_bandPool;			// Bands of the frames of every source
+	std::string				m_openCLDevice;		// Processors may run on, empty for none
+
+	// A frame source with its pipeline, and the textures its frames are
+	// uploaded into, along with the stamps of the tiles they hold.
+	struct SourceView {
+		FrameProvider			provider;
+		FrameProcessor			processor;
+		bgfx::TextureHandle		texFrame;			// Camera frame, in the display format
+		bgfx::TextureHandle		texAtlas;			// Channel previews side by side
+		std::vector<uint32_t>	displayTiles;
+		std::vector<uint32_t>	channelTiles;
+		int32_t					uploadedSequence;
+		uint32_t				uploadedResultId;
+		int32_t					budget;				// Frames per second, 0 for all
+	};
+
+	std::vector<std::unique_ptr<SourceView>>	m_sources;
+	int32_t					m_selectedSource;	// Shown in the camera window
 
     entry::MouseState 		m_mouseState;
-	bgfx::TextureHandle		m_texRGBA;
-	bgfx::TextureHandle		m_texChannels[3];
+	DisplayFormat			m_displayFormat;
+	bool					m_isAtlasCoverage;	// A8 coverage, or gray RGBA8
 	std::string				m_progName;
 
 	ImVec4					m_selectedColor;
 	ImVec4					m_minColor;
 	ImVec4					m_maxColor;
+	int32_t					m_uploadedSequence;	// Of the selected source
+	std::vector<uint8_t>	m_uploadTiles;
+	std::vector<cv::Rect>	m_uploadRects;
+	uint32_t				m_uploadedTiles;
+
+	int32_t						m_pickedClass;		// Class right-click defines
+	ColorClassifier::ColorClass	m_lastPick;
+
+	std::vector<int64_t>	m_headlessUpdateTimes;	// Whole update(), in HP counter ticks
+	uint32_t				m_headlessUploads;
+	uint64_t				m_headlessUploadedTiles;
+	uint64_t				m_headlessTiles;
+	uint32_t				m_headlessHeapFreeFrames;
+
+	struct AllocationStats {
+		uint64_t	heapMats;
+		uint64_t	arenaMats;
+		uint64_t	overflows;
+		uint64_t	reserved;		// Bytes of all the arenas
+	};
+
+	FrameArena				m_updateArena;		// Temporaries of update()
+	memprof::FrameSampler	m_memorySampler;
+	AllocationStats			m_lastAllocations;	// Totals at the end of the last update
+	AllocationStats			m_frameAllocations;	// During the last update
 
 	uint32_t	m_states;
 	uint32_t    m_width;
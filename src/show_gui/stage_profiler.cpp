@@ -0,0 +1,210 @@
+#include "stage_profiler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <initializer_list>
+#include <iterator>
+
+namespace {
+
+	// Constant initialized, it is read from operator new when profiling memory
+	thread_local Stage::Enum t_currentStage = Stage::Count;
+}
+
+int64_t StageProfiler::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const char* StageProfiler::getStageName(Stage::Enum _stage) {
+	static const char* names[] = {
+		"capture",
+		"ring write",
+		"detect",
+		"convert",
+		"preview",
+		"mask",
+		"bands",
+		"opencl",
+		"upload",
+		"frame",
+		"latency",
+	};
+
+	static_assert(std::size(names) == Stage::Count, "Stage names mismatch");
+	return _stage < Stage::Count ? names[_stage] : "unknown";
+}
+
+Stage::Enum StageProfiler::getCurrentStage() {
+	return t_currentStage;
+}
+
+Stage::Enum StageProfiler::enterStage(Stage::Enum _stage) {
+	auto previous = t_currentStage;
+	t_currentStage = _stage;
+	return previous;
+}
+
+void StageProfiler::leaveStage(Stage::Enum _previous) {
+	t_currentStage = _previous;
+}
+
+void StageProfiler::record(Stage::Enum _stage, int32_t _sequence, int64_t _start, int64_t _end,
+	const perf::Sample* _counters) {
+	auto duration = _end - _start;
+	{
+		auto& window = m_windows[_stage];
+		std::lock_guard<std::mutex> lock(window.mutex);
+		auto index = window.count % NUM_OF_SAMPLES;
+		window.durations[index] = duration;
+		window.counters[index].valid = 0;
+		if (_counters) {
+			window.counters[index] = *_counters;
+		}
+
+		++window.count;
+	}
+
+	// Latency spans several threads, it is not an activity of the caller's
+	if (_stage != Stage::Latency) {
+		trace::complete(getStageName(_stage), _start, _end);
+	}
+
+	if (m_csvEnabled.load(std::memory_order::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(m_csvMutex);
+		m_csvSamples.push_back({ int32_t(_stage), _sequence, _start - m_epoch, duration });
+	}
+}
+
+StageProfiler::Percentiles StageProfiler::getPercentiles(Stage::Enum _stage) const {
+	int64_t durations[NUM_OF_SAMPLES];
+	uint32_t samples = 0;
+	{
+		const auto& window = m_windows[_stage];
+		std::lock_guard<std::mutex> lock(window.mutex);
+		samples = std::min(window.count, NUM_OF_SAMPLES);
+		std::copy(window.durations, window.durations + samples, durations);
+	}
+
+	if (samples == 0) {
+		return { 0.0, 0.0, 0.0, 0 };
+	}
+
+	auto percentile = [&durations, samples](double _p) {
+		auto nth = durations + std::min(uint32_t(_p * samples), samples - 1);
+		std::nth_element(durations, nth, durations + samples);
+		return *nth * 1e-6;
+	};
+
+	auto p50 = percentile(.50);
+	auto p95 = percentile(.95);
+	auto p99 = percentile(.99);
+	return { p50, p95, p99, samples };
+}
+
+StageProfiler::CounterStats StageProfiler::getCounterStats(Stage::Enum _stage) const {
+	const uint32_t cycles = 1u << perf::Cycles;
+	const uint32_t instructions = 1u << perf::Instructions;
+
+	uint64_t ipcCycles = 0;
+	uint64_t ipcInstructions = 0;
+	uint64_t misses[perf::Count] = {};
+	uint32_t missSamples[perf::Count] = {};
+	uint32_t samples = 0;
+	{
+		const auto& window = m_windows[_stage];
+		std::lock_guard<std::mutex> lock(window.mutex);
+		const uint32_t count = std::min(window.count, NUM_OF_SAMPLES);
+		for (uint32_t i = 0; i < count; ++i) {
+			const auto& sample = window.counters[i];
+			if (sample.valid == 0) {
+				continue;
+			}
+
+			++samples;
+			if ((sample.valid & (cycles | instructions)) == (cycles | instructions)) {
+				ipcCycles += sample.values[perf::Cycles];
+				ipcInstructions += sample.values[perf::Instructions];
+			}
+
+			for (auto counter : { perf::CacheMisses, perf::BranchMisses }) {
+				if (sample.valid & (1u << counter)) {
+					misses[counter] += sample.values[counter];
+					++missSamples[counter];
+				}
+			}
+		}
+	}
+
+	const double pixels = double(m_framePixels.load(std::memory_order::memory_order_relaxed));
+	auto perPixel = [&misses, &missSamples, pixels](perf::Counter _counter) {
+		return missSamples[_counter] > 0 && pixels > 0
+			? double(misses[_counter]) / (double(missSamples[_counter]) * pixels)
+			: -1.0;
+	};
+
+	return {
+		ipcCycles > 0 ? double(ipcInstructions) / double(ipcCycles) : -1.0,
+		perPixel(perf::CacheMisses),
+		perPixel(perf::BranchMisses),
+		samples
+	};
+}
+
+bool StageProfiler::openCsv(const std::string& _path) {
+	closeCsv();
+
+	m_csvFile = std::fopen(_path.c_str(), "w");
+	if (!m_csvFile) {
+		return false;
+	}
+
+	std::fprintf(m_csvFile, "stage,sequence,start_ns,duration_ns\n");
+	m_csvEnabled.store(true, std::memory_order::memory_order_relaxed);
+	return true;
+}
+
+void StageProfiler::flushCsv() {
+	if (!m_csvFile) {
+		return;
+	}
+
+	// Swap the buffers, so that recording threads are not held up by IO
+	{
+		std::lock_guard<std::mutex> lock(m_csvMutex);
+		std::swap(m_csvSamples, m_csvWriting);
+	}
+
+	for (const auto& sample : m_csvWriting) {
+		std::fprintf(m_csvFile, "%s,%d,%lld,%lld\n",
+			getStageName(Stage::Enum(sample.stage)), sample.sequence,
+			(long long)sample.start, (long long)sample.duration);
+	}
+
+	m_csvWriting.clear();
+}
+
+void StageProfiler::closeCsv() {
+	if (m_csvFile) {
+		flushCsv();
+		m_csvEnabled.store(false, std::memory_order::memory_order_relaxed);
+		flushCsv();
+		std::fclose(m_csvFile);
+		m_csvFile = nullptr;
+	}
+}
+
+StageProfiler::StageProfiler()
+	: m_csvEnabled(false)
+	, m_csvFile(nullptr)
+	, m_epoch(now())
+	, m_framePixels(0) {
+	for (auto& window : m_windows) {
+		window.count = 0;
+	}
+}
+
+StageProfiler::~StageProfiler() {
+	closeCsv();
+}
@@ -0,0 +1,170 @@
+#ifndef STAGE_PROFILER_H_HEADER_GUARD
+#define STAGE_PROFILER_H_HEADER_GUARD
+
+#include "perf_counters.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Pipeline stages being timed. Latency is not a stage as such, it spans
+// from the capture of a frame to the bgfx::frame which submits it.
+struct Stage {
+	enum Enum {
+		Capture,		// Grab from the frame source
+		RingWrite,		// Retrieve into the frame ring
+		Detect,			// Tile change detection
+		Convert,		// Conversion into the display format
+		Preview,		// Reduced color space conversion and channel expansion
+		Mask,			// Color classes lookup and masking
+		Bands,			// Convert, mask and preview by bands or tiles, on the band pool
+		OpenCL,			// Convert, mask and preview whole frames on the OpenCL device
+		Upload,			// Texture updates
+		Frame,			// bgfx::frame
+		Latency,		// Capture to submission
+
+		Count
+	};
+};
+
+// Collects per-stage durations from any thread. It keeps a rolling window
+// of the latest samples of each stage for percentiles, together with their
+// hardware counters if enabled, and if requested streams every raw sample
+// to a CSV file. Samples are buffered in memory, the file is only written
+// from whichever thread calls flushCsv(). While tracing, stages are also
+// recorded as trace events of the calling thread.
+class StageProfiler {
+
+	static const uint32_t NUM_OF_SAMPLES = 512;
+
+public:
+
+	struct Percentiles {
+		double		p50;		// Milliseconds
+		double		p95;
+		double		p99;
+		uint32_t	samples;
+	};
+
+	// Hardware counters over the rolling window, negative when unavailable.
+	// Misses are per pixel of a frame, whichever part of it the stage saw.
+	struct CounterStats {
+		double		ipc;					// Instructions per cycle
+		double		cacheMissesPerPixel;	// Last level cache
+		double		branchMissesPerPixel;
+		uint32_t	samples;
+	};
+
+	// Nanoseconds on a monotonic clock, shared by all the stages and traces
+	static int64_t now();
+
+	static const char* getStageName(Stage::Enum _stage);
+
+	// Stage the calling thread is in, Stage::Count outside of any.
+	// Entering a stage returns the previous one, to be restored on leaving.
+	static Stage::Enum getCurrentStage();
+	static Stage::Enum enterStage(Stage::Enum _stage);
+	static void leaveStage(Stage::Enum _previous);
+
+	void record(Stage::Enum _stage, int32_t _sequence, int64_t _start, int64_t _end,
+		const perf::Sample* _counters = nullptr);
+
+	// Percentiles over the rolling window of the given stage
+	Percentiles getPercentiles(Stage::Enum _stage) const;
+
+	CounterStats getCounterStats(Stage::Enum _stage) const;
+
+	// Pixels of a camera frame, which misses are reported per
+	void setFramePixels(int64_t _pixels) {
+		m_framePixels.store(_pixels, std::memory_order::memory_order_relaxed);
+	}
+
+	// Stream samples as "stage,sequence,start_ns,duration_ns" lines
+	bool openCsv(const std::string& _path);
+	void flushCsv();
+	void closeCsv();
+
+	StageProfiler();
+	~StageProfiler();
+
+	StageProfiler(const StageProfiler&) = delete;
+	StageProfiler& operator=(const StageProfiler&) = delete;
+
+private:
+
+	struct Window {
+		mutable std::mutex	mutex;
+		int64_t				durations[NUM_OF_SAMPLES];
+		perf::Sample		counters[NUM_OF_SAMPLES];
+		uint32_t			count;
+	};
+
+	struct Sample {
+		int32_t		stage;
+		int32_t		sequence;
+		int64_t		start;
+		int64_t		duration;
+	};
+
+	Window					m_windows[Stage::Count];
+
+	std::atomic<bool>		m_csvEnabled;
+	std::mutex				m_csvMutex;
+	std::vector<Sample>		m_csvSamples;
+	std::vector<Sample>		m_csvWriting;
+	FILE*					m_csvFile;
+	int64_t					m_epoch;
+	std::atomic<int64_t>	m_framePixels;
+};
+
+// Record the time spent in a scope, during which the calling thread is in
+// the stage, and the hardware counters of the thread if they are enabled.
+// A null profiler only makes the recording a no-op.
+class ScopedStageTimer {
+
+public:
+
+	ScopedStageTimer(StageProfiler* _profiler, Stage::Enum _stage, int32_t _sequence = 0)
+		: m_profiler(_profiler)
+		, m_stage(_stage)
+		, m_previousStage(StageProfiler::enterStage(_stage))
+		, m_sequence(_sequence)
+		, m_start(_profiler ? StageProfiler::now() : 0)
+		, m_hasCounters(_profiler && perf::read(m_startCounters)) {
+
+	}
+
+	~ScopedStageTimer() {
+		if (m_profiler) {
+			// Counters are read innermost, the timing includes their cost
+			perf::Sample counters;
+			bool hasCounters = m_hasCounters && perf::read(counters);
+			if (hasCounters) {
+				counters = perf::subtract(counters, m_startCounters);
+			}
+
+			m_profiler->record(m_stage, m_sequence, m_start, StageProfiler::now(),
+				hasCounters ? &counters : nullptr);
+		}
+
+		StageProfiler::leaveStage(m_previousStage);
+	}
+
+	ScopedStageTimer(const ScopedStageTimer&) = delete;
+	ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+private:
+
+	StageProfiler*	m_profiler;
+	Stage::Enum		m_stage;
+	Stage::Enum		m_previousStage;
+	int32_t			m_sequence;
+	int64_t			m_start;
+	perf::Sample	m_startCounters;
+	bool			m_hasCounters;
+};
+
+#endif // STAGE_PROFILER_H_HEADER_GUARD
@@ -0,0 +1,242 @@
+#include "task_pool.h"
+#include "trace.h"
+
+#include <bx/bx.h>
+#include <opencv2/core/utility.hpp>
+
+#include <algorithm>
+#include <string>
+
+#if BX_PLATFORM_LINUX
+#	include <pthread.h>
+#	include <sched.h>
+#	include <unistd.h>
+#endif
+
+void TaskPool::init(int32_t _numOfWorkers, const std::vector<int32_t>& _affinity, bool _serializeOpenCV) {
+	m_closing = false;
+	if (_numOfWorkers <= 0) {
+		return;
+	}
+
+	// Kernels called by the tasks run on the task's core
+	if (_serializeOpenCV) {
+		m_previousCvThreads = cv::getNumThreads();
+		cv::setNumThreads(0);
+	}
+
+	for (int32_t i = 0; i < _numOfWorkers; ++i) {
+		m_queues.emplace_back(new Queue());
+	}
+
+	for (int32_t i = 0; i < _numOfWorkers; ++i) {
+		m_workers.emplace_back([this, i] {
+			// Traces keep the pointer, the name lives as long as the worker
+			std::string name = "band " + std::to_string(i);
+			trace::setThreadName(name.c_str());
+			run(i);
+		});
+
+#if BX_PLATFORM_LINUX
+		if (!_affinity.empty()) {
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(_affinity[i % _affinity.size()], &cpus);
+			pthread_setaffinity_np(m_workers.back().native_handle(), sizeof(cpus), &cpus);
+		}
+#endif
+	}
+}
+
+void TaskPool::shutdown() {
+	if (m_workers.empty()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closing = true;
+	}
+
+	m_changed.notify_all();
+	for (auto& worker : m_workers) {
+		worker.join();
+	}
+
+	m_workers.clear();
+	m_queues.clear();
+
+	if (m_previousCvThreads >= 0) {
+		cv::setNumThreads(m_previousCvThreads);
+		m_previousCvThreads = -1;
+	}
+}
+
+void TaskPool::parallelFor(int32_t _count, const std::function<void(int32_t _task)>& _body) {
+	if (_count <= 0) {
+		return;
+	}
+
+	m_forks.fetch_add(1, std::memory_order::memory_order_relaxed);
+	if (m_workers.empty() || _count == 1) {
+		for (int32_t i = 0; i < _count; ++i) {
+			_body(i);
+		}
+
+		m_tasks.fetch_add(uint64_t(_count), std::memory_order::memory_order_relaxed);
+		return;
+	}
+
+	Fork fork;
+	fork.body = &_body;
+	fork.remaining = _count;
+
+	// Consecutive tasks go to the same worker, neighbouring bands share
+	// the rows on their edges. Forks start dealing where the last ended.
+	const int32_t numOfQueues = int32_t(m_queues.size());
+	const int32_t first = int32_t(m_nextQueue.fetch_add(1, std::memory_order::memory_order_relaxed) % numOfQueues);
+	for (int32_t i = 0; i < numOfQueues; ++i) {
+		int32_t begin = int32_t(int64_t(_count) * i / numOfQueues);
+		int32_t end = int32_t(int64_t(_count) * (i + 1) / numOfQueues);
+		if (begin == end) {
+			continue;
+		}
+
+		auto& queue = *m_queues[(first + i) % numOfQueues];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		for (int32_t index = begin; index < end; ++index) {
+			queue.tasks.push_back({ &fork, index });
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending.fetch_add(_count, std::memory_order::memory_order_relaxed);
+	}
+
+	m_changed.notify_all();
+
+	// Help rather than wait, with tasks of this fork or of any other
+	Task task;
+	while (take(first, task)) {
+		execute(task);
+	}
+
+	// The last ones are still running on workers
+	std::unique_lock<std::mutex> lock(fork.mutex);
+	fork.done.wait(lock, [&fork] {
+		return fork.remaining == 0;
+	});
+}
+
+TaskPool::Stats TaskPool::getStats() const {
+	return {
+		m_forks.load(std::memory_order::memory_order_relaxed),
+		m_tasks.load(std::memory_order::memory_order_relaxed),
+		m_steals.load(std::memory_order::memory_order_relaxed)
+	};
+}
+
+int32_t TaskPool::getDefaultNumberOfWorkers() {
+	return std::max(int32_t(std::thread::hardware_concurrency()) - 1, 0);
+}
+
+std::vector<int32_t> TaskPool::getAvailableCpus() {
+	std::vector<int32_t> cpus;
+#if BX_PLATFORM_LINUX
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int32_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &set)) {
+				cpus.push_back(cpu);
+			}
+		}
+	}
+#endif
+
+	return cpus;
+}
+
+size_t TaskPool::getL2CacheSize() {
+#if BX_PLATFORM_LINUX && defined(_SC_LEVEL2_CACHE_SIZE)
+	long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (size > 0) {
+		return size_t(size);
+	}
+#endif
+
+	return 256 << 10;
+}
+
+void TaskPool::run(int32_t _worker) {
+	while (true) {
+		Task task;
+		if (take(_worker, task)) {
+			execute(task);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_changed.wait(lock, [this] {
+			return m_closing || m_pending.load(std::memory_order::memory_order_relaxed) > 0;
+		});
+
+		if (m_closing && m_pending.load(std::memory_order::memory_order_relaxed) <= 0) {
+			return;
+		}
+	}
+}
+
+bool TaskPool::take(int32_t _first, Task& _task) {
+	const int32_t numOfQueues = int32_t(m_queues.size());
+	for (int32_t i = 0; i < numOfQueues; ++i) {
+		auto& queue = *m_queues[(_first + i) % numOfQueues];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty()) {
+			continue;
+		}
+
+		// Own tasks in order, stolen ones from the other end
+		if (i == 0) {
+			_task = queue.tasks.front();
+			queue.tasks.pop_front();
+		}
+		else {
+			_task = queue.tasks.back();
+			queue.tasks.pop_back();
+			m_steals.fetch_add(1, std::memory_order::memory_order_relaxed);
+		}
+
+		m_pending.fetch_sub(1, std::memory_order::memory_order_relaxed);
+		return true;
+	}
+
+	return false;
+}
+
+void TaskPool::execute(const Task& _task) {
+	(*_task.fork->body)(_task.index);
+	m_tasks.fetch_add(1, std::memory_order::memory_order_relaxed);
+
+	// The fork may be gone as soon as its caller sees it done
+	std::lock_guard<std::mutex> lock(_task.fork->mutex);
+	if (--_task.fork->remaining == 0) {
+		_task.fork->done.notify_all();
+	}
+}
+
+TaskPool::TaskPool()
+	: m_pending(0)
+	, m_nextQueue(0)
+	, m_closing(false)
+	, m_previousCvThreads(-1)
+	, m_forks(0)
+	, m_tasks(0)
+	, m_steals(0) {
+
+}
+
+TaskPool::~TaskPool() {
+	shutdown();
+}
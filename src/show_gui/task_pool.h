@@ -0,0 +1,110 @@
+#ifndef TASK_POOL_H_HEADER_GUARD
+#define TASK_POOL_H_HEADER_GUARD
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Work-stealing pool the bands of frames are processed on. Each worker
+// has a deque of its own, which the tasks of a fork are dealt into: it
+// takes tasks from the front of its deque, and once it runs out, steals
+// from the back of the others'. The caller of a fork works on tasks too
+// until all of its own are done, so that a fork never waits on workers
+// busy with another one, and nesting forks cannot deadlock.
+//
+// While the pool has workers, OpenCV's own pool can be disabled, so that
+// the kernels a task calls run on the task's core rather than forking onto
+// as many threads again. OpenCV's threads are set for the whole process
+// though: every other OpenCV call, on any thread, then runs serially too.
+class TaskPool {
+
+public:
+
+	struct Stats {
+		uint64_t	forks;
+		uint64_t	tasks;
+		uint64_t	steals;		// Tasks taken from the back of another worker's deque
+	};
+
+	// Start the workers, pinning worker i to CPU _affinity[i % size] if
+	// any are given, and disable OpenCV's pool if _serializeOpenCV.
+	// Without workers, forks run on their caller, with OpenCV's pool left
+	// as it is.
+	void init(int32_t _numOfWorkers, const std::vector<int32_t>& _affinity = std::vector<int32_t>(),
+		bool _serializeOpenCV = true);
+
+	// Wait for the workers to finish their tasks, and give OpenCV back
+	// the threads it had, if it was disabled.
+	void shutdown();
+
+	// Run _body(i) for every i in [0, _count), and return once all of them
+	// have. Any thread may fork, and so may tasks.
+	void parallelFor(int32_t _count, const std::function<void(int32_t _task)>& _body);
+
+	int32_t getNumberOfWorkers() const {
+		return int32_t(m_workers.size());
+	}
+
+	Stats getStats() const;
+
+	// One per core, but one for the caller
+	static int32_t getDefaultNumberOfWorkers();
+
+	// CPUs the process may run on, in order. Empty where unknown.
+	static std::vector<int32_t> getAvailableCpus();
+
+	// Bytes of the L2 cache of a core, or a guess where unknown
+	static size_t getL2CacheSize();
+
+	TaskPool();
+	~TaskPool();
+
+private:
+
+	struct Fork {
+		const std::function<void(int32_t)>*	body;
+		int32_t								remaining;		// Guarded by mutex
+		std::mutex							mutex;
+		std::condition_variable				done;
+	};
+
+	struct Task {
+		Fork*		fork;
+		int32_t		index;
+	};
+
+	struct Queue {
+		std::mutex			mutex;
+		std::deque<Task>	tasks;
+	};
+
+	void run(int32_t _worker);
+
+	// Take a task from the front of queue _first, or else from the back
+	// of the others, in order.
+	bool take(int32_t _first, Task& _task);
+
+	void execute(const Task& _task);
+
+	std::vector<std::unique_ptr<Queue>>	m_queues;			// One per worker, stable
+	std::vector<std::thread>			m_workers;
+	std::mutex							m_mutex;			// Sleeping workers
+	std::condition_variable				m_changed;
+	std::atomic<int32_t>				m_pending;			// Tasks queued, raised under m_mutex
+	std::atomic<uint32_t>				m_nextQueue;		// Where forks start dealing
+	bool								m_closing;
+	int32_t								m_previousCvThreads;	// Negative unless OpenCV's pool is disabled
+
+	std::atomic<uint64_t>				m_forks;
+	std::atomic<uint64_t>				m_tasks;
+	std::atomic<uint64_t>				m_steals;
+};
+
+#endif // TASK_POOL_H_HEADER_GUARD
@@ -0,0 +1,39 @@
+#include "thread_scratch.h"
+#include "memory_profiler.h"
+
+#include <new>
+
+namespace {
+
+	const size_t ALIGNMENT = 64;
+
+	struct Buffer {
+		uint8_t*	data;
+		size_t		capacity;
+
+		~Buffer() {
+			if (data) {
+				::operator delete(data, std::align_val_t(ALIGNMENT));
+			}
+		}
+	};
+
+	thread_local Buffer t_buffers[scratch::Count] = {};
+}
+
+cv::Mat scratch::get(Slot _slot, cv::Size _size, int32_t _type) {
+	auto& buffer = t_buffers[_slot];
+	const size_t size = size_t(_size.area()) * CV_ELEM_SIZE(_type);
+	if (size > buffer.capacity) {
+		// The contents need not survive, only the largest size does
+		if (buffer.data) {
+			::operator delete(buffer.data, std::align_val_t(ALIGNMENT));
+		}
+
+		buffer.data = static_cast<uint8_t*>(::operator new(size, std::align_val_t(ALIGNMENT)));
+		buffer.capacity = size;
+		memprof::countAllocation(size);
+	}
+
+	return cv::Mat(_size, _type, buffer.data);
+}
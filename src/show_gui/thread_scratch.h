@@ -0,0 +1,31 @@
+#ifndef THREAD_SCRATCH_H_HEADER_GUARD
+#define THREAD_SCRATCH_H_HEADER_GUARD
+
+#include <opencv2/core.hpp>
+
+#include <cstdint>
+
+// Buffers of the calling thread, for intermediates which nothing reads
+// once the tile or the row they are computed for is done. A thread has a
+// buffer per slot, aligned on cache lines, which grows to the largest size
+// asked for and is then reused from one call to the next: it stays in the
+// core's cache, and costs no allocation once warm.
+namespace scratch {
+
+	// What a buffer holds. Calls nested on the same thread must not share
+	// a slot, the inner one would overwrite what the outer one holds.
+	enum Slot {
+		Labels,			// Color classes of the pixels being masked
+		ColorSpace,		// Reduced pixels in the requested color space
+		PreviewSums,	// Sums of the blocks of a row being reduced
+		PreviewRow,		// Reduced row, before its conversion
+
+		Count
+	};
+
+	// Continuous matrix over the slot's buffer, holding whatever the
+	// previous use left. Valid until the same thread asks for the slot again.
+	cv::Mat get(Slot _slot, cv::Size _size, int32_t _type);
+}
+
+#endif // THREAD_SCRATCH_H_HEADER_GUARD
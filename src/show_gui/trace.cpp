@@ -0,0 +1,185 @@
+#include "trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace trace {
+
+	namespace {
+
+		static const uint32_t NUM_OF_EVENTS_PER_THREAD = 1 << 16;
+
+		struct Event {
+			const char*	name;
+			int64_t		start;
+			int64_t		duration;
+		};
+
+		struct ThreadBuffer {
+			std::unique_ptr<Event[]>	events;
+			std::atomic<uint32_t>		count;
+			std::atomic<uint32_t>		generation;
+			std::atomic<uint64_t>		dropped;
+			int32_t						tid;
+			std::string					name;		// Guarded by the registry's mutex
+		};
+
+		struct Registry {
+			std::mutex									mutex;
+			std::vector<std::unique_ptr<ThreadBuffer>>	buffers;
+			std::atomic<bool>							enabled;
+			std::atomic<uint32_t>						generation;
+			int64_t										epoch;
+
+			Registry() : enabled(false), generation(0), epoch(now()) {
+
+			}
+		};
+
+		Registry& registry() {
+			static Registry instance;
+			return instance;
+		}
+
+		thread_local ThreadBuffer*	t_buffer = nullptr;
+		thread_local const char*	t_name = nullptr;
+
+		// Buffer of the calling thread, registered on first use
+		ThreadBuffer* threadBuffer() {
+			if (!t_buffer) {
+				auto& r = registry();
+				std::lock_guard<std::mutex> lock(r.mutex);
+
+				std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer());
+				buffer->events.reset(new Event[NUM_OF_EVENTS_PER_THREAD]);
+				buffer->count.store(0, std::memory_order::memory_order_relaxed);
+				buffer->generation.store(~0u, std::memory_order::memory_order_relaxed);
+				buffer->dropped.store(0, std::memory_order::memory_order_relaxed);
+				buffer->tid = int32_t(r.buffers.size()) + 1;
+				buffer->name = t_name ? t_name : "thread " + std::to_string(buffer->tid);
+
+				t_buffer = buffer.get();
+				r.buffers.push_back(std::move(buffer));
+			}
+
+			return t_buffer;
+		}
+
+		// Escape the few characters which would break a JSON string
+		std::string escape(const char* _string) {
+			std::string escaped;
+			for (auto* c = _string; *c; ++c) {
+				if (*c == '"' || *c == '\\') {
+					escaped += '\\';
+				}
+
+				escaped += (unsigned char)*c < 0x20 ? ' ' : *c;
+			}
+
+			return escaped;
+		}
+	}
+
+	int64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	void setThreadName(const char* _name) {
+		t_name = _name;
+		if (t_buffer) {
+			std::lock_guard<std::mutex> lock(registry().mutex);
+			t_buffer->name = _name;
+		}
+	}
+
+	bool isEnabled() {
+		return registry().enabled.load(std::memory_order::memory_order_relaxed);
+	}
+
+	void start() {
+		auto& r = registry();
+		r.generation.fetch_add(1, std::memory_order::memory_order_release);
+		r.enabled.store(true, std::memory_order::memory_order_relaxed);
+	}
+
+	int64_t stop(const char* _path) {
+		auto& r = registry();
+		r.enabled.store(false, std::memory_order::memory_order_relaxed);
+
+		FILE* file = std::fopen(_path, "w");
+		if (!file) {
+			return -1;
+		}
+
+		auto generation = r.generation.load(std::memory_order::memory_order_acquire);
+		int64_t events = 0;
+		uint64_t dropped = 0;
+		const char* separator = "";
+
+		std::fprintf(file, "{\"traceEvents\":[\n");
+
+		std::lock_guard<std::mutex> lock(r.mutex);
+		for (const auto& buffer : r.buffers) {
+			std::fprintf(file,
+				"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				separator, buffer->tid, escape(buffer->name.c_str()).c_str());
+			separator = ",\n";
+
+			// Buffers last written in a previous trace hold stale events
+			if (buffer->generation.load(std::memory_order::memory_order_acquire) != generation) {
+				continue;
+			}
+
+			// Only events published before the count are complete
+			auto count = buffer->count.load(std::memory_order::memory_order_acquire);
+			for (uint32_t i = 0; i < count; ++i) {
+				const auto& event = buffer->events[i];
+				std::fprintf(file,
+					",\n{\"name\":\"%s\",\"cat\":\"show_gui\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+					escape(event.name).c_str(),
+					(event.start - r.epoch) * 1e-3, event.duration * 1e-3,
+					buffer->tid);
+			}
+
+			events += count;
+			dropped += buffer->dropped.load(std::memory_order::memory_order_relaxed);
+		}
+
+		std::fprintf(file, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":%llu}}\n",
+			(unsigned long long)dropped);
+		std::fclose(file);
+		return events;
+	}
+
+	void complete(const char* _name, int64_t _start, int64_t _end) {
+		auto& r = registry();
+		if (!r.enabled.load(std::memory_order::memory_order_relaxed)) {
+			return;
+		}
+
+		auto* buffer = threadBuffer();
+
+		// First event of a new trace on this thread, start over
+		auto generation = r.generation.load(std::memory_order::memory_order_acquire);
+		if (buffer->generation.load(std::memory_order::memory_order_relaxed) != generation) {
+			buffer->count.store(0, std::memory_order::memory_order_relaxed);
+			buffer->dropped.store(0, std::memory_order::memory_order_relaxed);
+			buffer->generation.store(generation, std::memory_order::memory_order_release);
+		}
+
+		auto count = buffer->count.load(std::memory_order::memory_order_relaxed);
+		if (count >= NUM_OF_EVENTS_PER_THREAD) {
+			buffer->dropped.fetch_add(1, std::memory_order::memory_order_relaxed);
+			return;
+		}
+
+		buffer->events[count] = { _name, _start, _end - _start };
+		buffer->count.store(count + 1, std::memory_order::memory_order_release);
+	}
+}
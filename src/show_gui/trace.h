@@ -0,0 +1,63 @@
+#ifndef TRACE_H_HEADER_GUARD
+#define TRACE_H_HEADER_GUARD
+
+#include <cstdint>
+
+// Low-overhead tracing of what each thread is doing, exported as a Chrome
+// trace JSON file, which loads in chrome://tracing and in Perfetto.
+//
+// Every thread appends complete events (name, start, duration) into its
+// own fixed-size buffer, without locks: a buffer has a single writer, and
+// publishes its event count with release semantic for the flush to read.
+// Starting a new trace bumps a generation number, which makes each thread
+// reset its buffer on its next event, so stale events are never exported.
+// Events are dropped, and counted, once a thread's buffer is full.
+namespace trace {
+
+	// Nanoseconds on the monotonic clock events are timed with
+	int64_t now();
+
+	// Name the calling thread in the exported traces
+	void setThreadName(const char* _name);
+
+	bool isEnabled();
+
+	// Start recording, discarding whatever has been recorded before
+	void start();
+
+	// Stop recording, and write the events to a JSON file at _path.
+	// Returns the number of events written, or -1 on failure.
+	int64_t stop(const char* _path);
+
+	// Record an event on the calling thread. _name must be a string
+	// which outlives the trace, typically a literal.
+	void complete(const char* _name, int64_t _start, int64_t _end);
+
+	// Record the lifetime of a scope as an event
+	class Scope {
+
+	public:
+
+		explicit Scope(const char* _name)
+			: m_name(_name)
+			, m_start(isEnabled() ? now() : 0) {
+
+		}
+
+		~Scope() {
+			if (m_start != 0) {
+				complete(m_name, m_start, now());
+			}
+		}
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+
+		const char*	m_name;
+		int64_t		m_start;
+	};
+}
+
+#endif // TRACE_H_HEADER_GUARD
@@ -0,0 +1,170 @@
+#include "umat_pipeline.h"
+
+#include <bx/bx.h>
+#include <opencv2/imgproc.hpp>
+
+#include <iostream>
+#include <limits>
+#include <cstdlib>
+
+namespace {
+
+	// ColorClassifier::Table::lookup, for one pixel of a BGR image
+	const char* s_classifySource =
+		"__kernel void classify(__global const uchar* bgr, int bgrStep, int bgrOffset,\n"
+		"	__global const uint* cells, int bits,\n"
+		"	__global uchar* mask, int maskStep, int maskOffset, int rows, int cols) {\n"
+		"	const int x = get_global_id(0);\n"
+		"	const int y = get_global_id(1);\n"
+		"	if (x >= cols || y >= rows) {\n"
+		"		return;\n"
+		"	}\n"
+		"\n"
+		"	__global const uchar* pixel = bgr + mad24(y, bgrStep, mad24(x, 3, bgrOffset));\n"
+		"	const int shift = 8 - bits;\n"
+		"	const uint cell = ((uint)(pixel[0] >> shift) << (2 * bits))\n"
+		"		| ((uint)(pixel[1] >> shift) << bits)\n"
+		"		| (uint)(pixel[2] >> shift);\n"
+		"	mask[mad24(y, maskStep, maskOffset + x)] = cells[cell] != 0 ? 255 : 0;\n"
+		"}\n";
+}
+
+UMatPipeline::UMatPipeline()
+	: m_cellsVersion(std::numeric_limits<uint32_t>::max()) {
+
+}
+
+bool UMatPipeline::selectDevice(int32_t _deviceId, int32_t _deviceType) {
+	// Disabling OpenCL does not make OpenCV pick its device yet
+	if (_deviceId < 0 || !cv::ocl::haveOpenCL()) {
+		cv::ocl::setUseOpenCL(false);
+		return false;
+	}
+
+	cv::ocl::Context context;
+	if (!context.create(_deviceType) || _deviceId >= int32_t(context.ndevices())) {
+		cv::ocl::setUseOpenCL(false);
+		return false;
+	}
+
+	// OpenCV creates its default context the first time it is needed, on
+	// the device this names: of any platform, of the same type and name.
+	const cv::ocl::Device& device = context.device(_deviceId);
+	const int32_t type = device.type();
+	std::string selector = std::string(":")
+		+ ((type & cv::ocl::Device::TYPE_GPU) ? "GPU"
+			: (type & cv::ocl::Device::TYPE_CPU) ? "CPU"
+			: (type & cv::ocl::Device::TYPE_ACCELERATOR) ? "ACCELERATOR" : "")
+		+ ":" + device.name();
+
+#if BX_PLATFORM_WINDOWS
+	_putenv_s("OPENCV_OPENCL_DEVICE", selector.c_str());
+#else
+	setenv("OPENCV_OPENCL_DEVICE", selector.c_str(), 1);
+#endif
+
+	cv::ocl::setUseOpenCL(true);
+	if (!cv::ocl::useOpenCL()) {
+		return false;
+	}
+
+	// Something has used OpenCL already, which is the device we get
+	if (cv::ocl::Device::getDefault().name() != device.name()) {
+		std::cout << "OpenCL runs on " << cv::ocl::Device::getDefault().name()
+			<< " rather than on " << device.name() << ", picked before" << std::endl;
+	}
+
+	return true;
+}
+
+std::string UMatPipeline::getDeviceName() {
+	if (!cv::ocl::useOpenCL()) {
+		return std::string();
+	}
+
+	return cv::ocl::Device::getDefault().name();
+}
+
+void UMatPipeline::process(const cv::Mat& _bgr, int32_t _fromBGR, int32_t _colorSpaceCode,
+	const ColorClassifier::Table* _table, int32_t _scale,
+	cv::Mat* _image, cv::Mat* _display, cv::Mat* _atlas) {
+	CV_Assert(_bgr.type() == CV_8UC3);
+
+	// The one copy of the frame to the device
+	_bgr.copyTo(m_bgr);
+
+	// Outputs are wrapped rather than copied into, the device writes into
+	// them through the mapping OpenCV makes when a wrapper is released.
+	cv::UMat image;
+	cv::UMat display;
+	cv::UMat atlas;
+
+	const bool masks = _display && _table && _table->classes != 0;
+	if (_image) {
+		image = _image->getUMat(cv::ACCESS_WRITE);
+	}
+
+	cv::UMat& converted = _image ? image : m_image;
+	if (_image || masks) {
+		cv::cvtColor(m_bgr, converted, _fromBGR);
+	}
+
+	if (masks) {
+		classify(*_table);
+
+		display = _display->getUMat(cv::ACCESS_WRITE);
+		display.setTo(cv::Scalar::all(0));
+		converted.copyTo(display, m_mask);
+	}
+
+	if (_atlas) {
+		// Each preview pixel averages a block of the frame, partial blocks
+		// on the right and bottom edges are left out, as on the CPU.
+		const cv::Size previewSize(_atlas->cols / NUM_OF_PREVIEWS, _atlas->rows);
+		cv::resize(m_bgr(cv::Rect(0, 0, previewSize.width * _scale, previewSize.height * _scale)),
+			m_reduced, previewSize, 0, 0, cv::INTER_AREA);
+		cv::cvtColor(m_reduced, m_colorSpace, _colorSpaceCode);
+		cv::split(m_colorSpace, m_channels);
+
+		atlas = _atlas->getUMat(cv::ACCESS_WRITE);
+		for (int32_t i = 0; i < NUM_OF_PREVIEWS; ++i) {
+			cv::UMat panel = atlas(cv::Rect(cv::Point(i * previewSize.width, 0), previewSize));
+			if (_atlas->type() == CV_8UC1) {
+				cv::subtract(cv::Scalar::all(255), m_channels[i], panel);
+			}
+			else {
+				cv::cvtColor(m_channels[i], panel, cv::COLOR_GRAY2BGRA);
+			}
+		}
+	}
+
+	// Map the results back, then drain the queue: queues are per thread,
+	// and the next frame may well be processed on another one.
+	image.release();
+	display.release();
+	atlas.release();
+	cv::ocl::finish();
+}
+
+void UMatPipeline::classify(const ColorClassifier::Table& _table) {
+	if (m_classify.empty()) {
+		m_classify.create("classify", cv::ocl::ProgramSource(s_classifySource));
+		CV_Assert(!m_classify.empty());
+	}
+
+	// Tables are immutable, a version is only uploaded once
+	if (_table.version != m_cellsVersion) {
+		cv::Mat cells(1, int32_t(_table.cells.size()), CV_32SC1, const_cast<uint32_t*>(_table.cells.data()));
+		cells.copyTo(m_cells);
+		m_cellsVersion = _table.version;
+	}
+
+	m_mask.create(m_bgr.size(), CV_8UC1);
+	m_classify.args(cv::ocl::KernelArg::ReadOnlyNoSize(m_bgr),
+		cv::ocl::KernelArg::PtrReadOnly(m_cells), _table.bits,
+		cv::ocl::KernelArg::WriteOnly(m_mask));
+
+	size_t globalSize[] = { size_t(m_bgr.cols), size_t(m_bgr.rows) };
+	const bool ran = m_classify.run(2, globalSize, nullptr, false);
+	CV_Assert(ran);
+}
@@ -0,0 +1,68 @@
+#ifndef UMAT_PIPELINE_H_HEADER_GUARD
+#define UMAT_PIPELINE_H_HEADER_GUARD
+
+#include "color_classifier.h"
+
+#include <opencv2/core.hpp>
+#include <opencv2/core/ocl.hpp>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Conversion into the display format, masking and channel previews of
+// whole frames on OpenCV's transparent API, the counterpart of the CPU
+// stages for OpenCL devices, GPUs as well as CPU runtimes such as PoCL.
+//
+// The camera frame is copied to the device once, every intermediate stays
+// there, and the results are only mapped back to the host at the end of
+// the frame, into the buffers they are uploaded from. Masking looks the
+// pixels up in the classifier's table, uploaded once per version, so that
+// the device masks exactly the pixels the CPU does.
+class UMatPipeline {
+
+public:
+
+	static const int32_t NUM_OF_PREVIEWS = 3;
+
+	// Make device _deviceId, numbered as in a context of _deviceType, the
+	// one the transparent API runs on, and enable it. OpenCV only picks its
+	// device once, call this before anything else uses OpenCL. Returns
+	// false, OpenCL being disabled, if there is no such device.
+	static bool selectDevice(int32_t _deviceId, int32_t _deviceType = cv::ocl::Device::TYPE_ALL);
+
+	// Device the transparent API runs on, empty if OpenCL is disabled
+	static std::string getDeviceName();
+
+	// Process a BGR frame into the outputs given, which are written in
+	// place and must have their size and type already: _image converted
+	// with _fromBGR, _display the same masked with the classes of _table,
+	// and _atlas the NUM_OF_PREVIEWS channels of the frame in the color
+	// space of _colorSpaceCode, _scale times smaller, side by side. Channels
+	// are gray BGRA in a CV_8UC4 atlas, coverage in a CV_8UC1 one. Outputs
+	// left null are not computed, and not mapped.
+	void process(const cv::Mat& _bgr, int32_t _fromBGR, int32_t _colorSpaceCode,
+		const ColorClassifier::Table* _table, int32_t _scale,
+		cv::Mat* _image, cv::Mat* _display, cv::Mat* _atlas);
+
+	UMatPipeline();
+
+private:
+
+	// Mask of the pixels of m_bgr with at least one class in _table
+	void classify(const ColorClassifier::Table& _table);
+
+	cv::ocl::Kernel				m_classify;			// Built on first use
+
+	// Device buffers, kept from one frame to the next
+	cv::UMat					m_bgr;
+	cv::UMat					m_image;
+	cv::UMat					m_mask;
+	cv::UMat					m_cells;
+	uint32_t					m_cellsVersion;		// Of the table m_cells holds
+	cv::UMat					m_reduced;
+	cv::UMat					m_colorSpace;
+	std::vector<cv::UMat>		m_channels;
+};
+
+#endif // UMAT_PIPELINE_H_HEADER_GUARD
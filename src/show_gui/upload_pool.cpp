@@ -0,0 +1,78 @@
+#include "upload_pool.h"
+
+const bgfx::Memory* UploadBuffer::makeRef() {
+	retain();
+	return bgfx::makeRef(data(), m_size, onRelease, this);
+}
+
+const bgfx::Memory* UploadBuffer::makeRef(const cv::Rect& _rect) {
+	uint32_t bytesPerPixel = m_pitch / m_width;
+	uint32_t offset = _rect.y * m_pitch + _rect.x * bytesPerPixel;
+	uint32_t size = (_rect.height - 1) * m_pitch + _rect.width * bytesPerPixel;
+
+	retain();
+	return bgfx::makeRef(data() + offset, size, onRelease, this);
+}
+
+void UploadBuffer::release() {
+	if (m_refs.fetch_sub(1, std::memory_order::memory_order_acq_rel) == 1) {
+		m_pool->recycle(this);
+	}
+}
+
+void UploadBuffer::onRelease(void* /*_ptr*/, void* _userData) {
+	static_cast<UploadBuffer*>(_userData)->release();
+}
+
+UploadBufferRef UploadBufferPool::acquire(uint16_t _width, uint16_t _height, uint32_t _bytesPerPixel) {
+	uint32_t pitch = _width * _bytesPerPixel;
+	uint32_t size = pitch * _height;
+
+	UploadBuffer* buffer = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		// Prefer a free buffer which is already large enough
+		for (size_t i = 0; i < m_freeBuffers.size(); ++i) {
+			if (m_freeBuffers[i]->m_storage.size() >= size) {
+				buffer = m_freeBuffers[i];
+				m_freeBuffers[i] = m_freeBuffers.back();
+				m_freeBuffers.pop_back();
+				break;
+			}
+		}
+
+		if (!buffer) {
+			m_buffers.emplace_back(new UploadBuffer());
+			buffer = m_buffers.back().get();
+			buffer->m_pool = this;
+		}
+	}
+
+	// Only ever grows, steady state does not allocate
+	if (buffer->m_storage.size() < size) {
+		buffer->m_storage.resize(size);
+	}
+
+	buffer->m_refs.store(1, std::memory_order::memory_order_relaxed);
+	buffer->m_size = size;
+	buffer->m_pitch = uint16_t(pitch);
+	buffer->m_width = _width;
+	buffer->m_height = _height;
+	return UploadBufferRef(buffer);
+}
+
+uint32_t UploadBufferPool::getNumberOfBuffers() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return uint32_t(m_buffers.size());
+}
+
+uint32_t UploadBufferPool::getNumberOfBuffersInUse() const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return uint32_t(m_buffers.size() - m_freeBuffers.size());
+}
+
+void UploadBufferPool::recycle(UploadBuffer* _buffer) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_freeBuffers.push_back(_buffer);
+}
@@ -0,0 +1,162 @@
+#ifndef UPLOAD_POOL_H_HEADER_GUARD
+#define UPLOAD_POOL_H_HEADER_GUARD
+
+#include <bgfx/bgfx.h>
+#include <opencv2/core.hpp>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+class UploadBufferPool;
+
+// Pixel storage handed over to bgfx without copying it. A buffer is
+// refcounted: the frame it has been prepared for holds a reference, and
+// so does bgfx from makeRef() until its release callback fires. Once the
+// last reference is gone, the buffer goes back to its pool for reuse.
+class UploadBuffer {
+
+public:
+
+	uint8_t* data() {
+		return m_storage.data();
+	}
+
+	uint32_t size() const {
+		return m_size;
+	}
+
+	uint16_t pitch() const {
+		return m_pitch;
+	}
+
+	uint16_t width() const {
+		return m_width;
+	}
+
+	uint16_t height() const {
+		return m_height;
+	}
+
+	// Mat header over the buffer, so that kernels can write straight into it
+	cv::Mat asMat(int32_t _type) {
+		return cv::Mat(m_height, m_width, _type, data(), m_pitch);
+	}
+
+	// Reference the pixels from a bgfx memory block, the buffer is kept
+	// alive until bgfx has consumed them, from whichever thread it does so.
+	const bgfx::Memory* makeRef();
+
+	// Same, for a rectangle of the image only. Rows keep the buffer's
+	// pitch, which is to be passed along to bgfx.
+	const bgfx::Memory* makeRef(const cv::Rect& _rect);
+
+	void retain() {
+		m_refs.fetch_add(1, std::memory_order::memory_order_relaxed);
+	}
+
+	void release();
+
+private:
+
+	friend class UploadBufferPool;
+
+	static void onRelease(void* _ptr, void* _userData);
+
+	std::vector<uint8_t>	m_storage;
+	UploadBufferPool*		m_pool;
+	std::atomic<int32_t>	m_refs;
+	uint32_t				m_size;
+	uint16_t				m_pitch;
+	uint16_t				m_width;
+	uint16_t				m_height;
+};
+
+// Owning reference to an UploadBuffer.
+class UploadBufferRef {
+
+public:
+
+	UploadBuffer* get() const {
+		return m_buffer;
+	}
+
+	UploadBuffer* operator->() const {
+		return m_buffer;
+	}
+
+	explicit operator bool() const {
+		return m_buffer != nullptr;
+	}
+
+	void reset() {
+		if (m_buffer) {
+			m_buffer->release();
+			m_buffer = nullptr;
+		}
+	}
+
+	UploadBufferRef() : m_buffer(nullptr) {
+
+	}
+
+	explicit UploadBufferRef(UploadBuffer* _buffer) : m_buffer(_buffer) {
+
+	}
+
+	UploadBufferRef(const UploadBufferRef& _other) : m_buffer(_other.m_buffer) {
+		if (m_buffer) {
+			m_buffer->retain();
+		}
+	}
+
+	UploadBufferRef(UploadBufferRef&& _other) : m_buffer(_other.m_buffer) {
+		_other.m_buffer = nullptr;
+	}
+
+	UploadBufferRef& operator=(UploadBufferRef _other) {
+		std::swap(m_buffer, _other.m_buffer);
+		return *this;
+	}
+
+	~UploadBufferRef() {
+		reset();
+	}
+
+private:
+
+	UploadBuffer*	m_buffer;
+};
+
+// Pool of upload buffers. It is thread-safe, buffers are acquired by the
+// pipeline workers and given back from the bgfx render thread.
+class UploadBufferPool {
+
+public:
+
+	// A buffer for a _width x _height image with _bytesPerPixel,
+	// rows tightly packed as bgfx expects them.
+	UploadBufferRef acquire(uint16_t _width, uint16_t _height, uint32_t _bytesPerPixel);
+
+	// Number of buffers ever allocated, and of those currently in use
+	uint32_t getNumberOfBuffers() const;
+	uint32_t getNumberOfBuffersInUse() const;
+
+	UploadBufferPool() = default;
+	UploadBufferPool(const UploadBufferPool&) = delete;
+	UploadBufferPool& operator=(const UploadBufferPool&) = delete;
+
+private:
+
+	friend class UploadBuffer;
+
+	void recycle(UploadBuffer* _buffer);
+
+	mutable std::mutex							m_mutex;
+	std::vector<std::unique_ptr<UploadBuffer>>	m_buffers;
+	std::vector<UploadBuffer*>					m_freeBuffers;
+};
+
+#endif // UPLOAD_POOL_H_HEADER_GUARD